@@ -2,13 +2,26 @@
 
 #include "camera.hpp"
 #include "gfx.hpp"
+#include "gfx/profiler.hpp"
+#include "galaxy/barnes_hut.hpp"
+#include "galaxy/binned_renderer.hpp"
+#include "galaxy/block_timesteps.hpp"
+#include "galaxy/diagnostics.hpp"
+#include "galaxy/frame_writer.hpp"
+#include "galaxy/particle_mesh.hpp"
+#include "galaxy/snapshot.hpp"
+#include "galaxy/sprite_renderer.hpp"
 #include "galaxy/star_data.hpp"
+#include "galaxy/star_sort.hpp"
+#include "galaxy/trajectory.hpp"
+#include "settings.hpp"
+#include <chrono>
 #include <vulkan/vulkan_raii.hpp>
 
 namespace galaxy {
   class Galaxy {
     public:
-      Galaxy();
+      Galaxy(Settings settings);
       ~Galaxy();
 
       void init_gfx();
@@ -16,9 +29,31 @@ namespace galaxy {
 
       void run();
       void update();
+      // simulates steps without rendering and blocks until they are done
+      void fast_forward(uint32_t steps);
+
+    private:
+      // the gravity step from positions()[read_buffer_index] to the other
+      // position buffer
+      void record_sim(vk::raii::CommandBuffer const& command_buffer,
+                      uint32_t read_buffer_index);
+      // count consecutive steps starting at first_step, with barriers between
+      void record_steps(vk::raii::CommandBuffer const& command_buffer,
+                        uint64_t first_step, uint32_t count);
+      // whether the stars are reordered before step
+      bool sort_due(uint64_t step) const;
+      // steps due since the last frame according to the fixed timestep
+      uint32_t take_steps();
+      // copies the intermediate image into the acquired swapchain image
+      void record_present_copy(vk::raii::CommandBuffer const& command_buffer);
+      // waits for every frame still in flight and writes out its readback
+      void finish_readbacks();
+      // file the snapshot after step is written to
+      std::string snapshot_path(uint64_t step);
       
     private:
       gfx::Core m_gfx_core;
+      Settings m_settings;
 
       std::shared_ptr<vk::raii::ShaderModule> m_sim_module;
       std::shared_ptr<vk::raii::ShaderModule> m_calc_coords_module;
@@ -27,7 +62,10 @@ namespace galaxy {
       std::shared_ptr<vk::raii::PipelineLayout> m_calc_coords_pipeline_layout;
       std::shared_ptr<vk::raii::PipelineLayout> m_draw_pipeline_layout;
       std::shared_ptr<vk::raii::Pipeline> m_sim_pipeline;
+      std::shared_ptr<vk::raii::Pipeline> m_sim_tiled_pipeline;
       std::shared_ptr<vk::raii::Pipeline> m_calc_coords_pipeline;
+      // sizes the indirect dispatches over the stars calc_coords kept
+      std::shared_ptr<vk::raii::Pipeline> m_visible_arguments_pipeline;
       std::shared_ptr<vk::raii::Pipeline> m_draw_pipeline;
 
       std::shared_ptr<vk::raii::DescriptorPool> m_descriptor_pool;
@@ -37,20 +75,72 @@ namespace galaxy {
       std::shared_ptr<vk::raii::DescriptorSets> m_draw_descriptor_sets;
 
 
-      std::vector<vk::raii::DeviceMemory> m_device_memories;
-      
       std::shared_ptr<vk::raii::Image> m_intermediate_image;
+      gfx::Allocation m_intermediate_image_memory{nullptr};
       std::shared_ptr<vk::raii::ImageView> m_intermediate_image_view;
 
-      std::shared_ptr<vk::raii::Semaphore> m_image_acquired_semaphore;
-      std::shared_ptr<vk::raii::Semaphore> m_drawing_done_semaphore;
-      std::shared_ptr<vk::raii::Fence> m_fence;
+      // per frame in flight
+      struct Frame {
+        vk::raii::CommandBuffer command_buffer{nullptr};
+        // recorded for the compute queue if the device has one
+        vk::raii::CommandBuffer sim_command_buffer{nullptr};
+        vk::raii::Semaphore image_acquired{nullptr};
+        vk::raii::Fence in_flight{nullptr};
+
+        // headless only: the finished frame is copied here and written out
+        // once the slot comes around again
+        gfx::Allocation readback_memory{nullptr};
+        vk::raii::Buffer readback_buffer{nullptr};
+        uint8_t const* readback_data = nullptr;
+        bool readback_pending = false;
+      };
+      std::vector<Frame> m_frames;
+      std::vector<vk::raii::Semaphore> m_render_finished_semaphores;
+      // with async compute: value f + 1 marks the end of frame f's work on
+      // the compute and the graphics queue respectively
+      vk::raii::Semaphore m_sim_timeline{nullptr};
+      vk::raii::Semaphore m_graphics_timeline{nullptr};
 
       std::shared_ptr<galaxy::GPUStarData> m_gpu_star_data;
+      std::shared_ptr<galaxy::BarnesHut> m_barnes_hut;
+      std::shared_ptr<galaxy::ParticleMesh> m_particle_mesh;
+      // only with --timestep-levels above 1
+      std::shared_ptr<galaxy::BlockTimesteps> m_block_timesteps;
+      // only with --sort-every
+      std::shared_ptr<galaxy::StarSort> m_star_sort;
+      std::shared_ptr<galaxy::BinnedRenderer> m_binned_renderer;
+      // only if the device can rasterize
+      std::shared_ptr<galaxy::SpriteRenderer> m_sprite_renderer;
+      std::shared_ptr<galaxy::FrameWriter> m_frame_writer;
+      std::shared_ptr<galaxy::SnapshotWriter> m_snapshot_writer;
+      // only with --trajectory
+      std::shared_ptr<galaxy::TrajectoryWriter> m_trajectory_writer;
+      // only with --diagnostics-every
+      std::shared_ptr<galaxy::Diagnostics> m_diagnostics;
+      std::shared_ptr<gfx::Profiler> m_profiler;
 
       galaxy::Camera m_camera;
 
       uint32_t m_image_index = 0;
+      uint32_t m_frame_index = 0;
+      // simulation steps taken so far
       uint64_t m_positions_index = 0;
+      uint64_t m_frame_count = 0;
+
+      std::chrono::steady_clock::time_point m_last_update;
+      // simulated time owed, in seconds
+      double m_accumulator = 0.0;
+      bool m_fast_forward_requested = false;
+      // set by S, and kept while every snapshot slot is busy
+      bool m_snapshot_requested = false;
+      // kept while every trajectory slot is busy
+      bool m_trajectory_requested = false;
+      // kept while every diagnostics slot is busy
+      bool m_diagnostics_requested = false;
+      // the frame submitted last reads the velocities on the graphics queue,
+      // so the next step must not start before it finished
+      bool m_velocities_read = false;
+      // draw with m_sprite_renderer rather than the compute renderer
+      bool m_draw_sprites = false;
   };
 }
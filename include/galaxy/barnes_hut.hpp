@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vulkan/vulkan_raii.hpp>
+
+#include "galaxy/radix_sort.hpp"
+#include "galaxy/star_data.hpp"
+#include "gfx.hpp"
+
+namespace galaxy {
+// the opening angle the keys can raise it to, larger angles only make the
+// forces less accurate without making the walk any cheaper
+const static float MAX_OPENING_ANGLE = 2.0f;
+
+// O(N log N) gravity solver. Every step rebuilds a Morton-ordered radix tree
+// over the stars on the GPU and walks it with an opening angle criterion.
+class BarnesHut {
+public:
+    BarnesHut() = delete;
+    ~BarnesHut();
+
+    BarnesHut(gfx::Core& core, GPUStarData& star_data, float opening_angle);
+
+    // reads positions()[positions_index] and writes the other position
+    // buffer, like the direct-sum sim pipeline
+    void record(vk::raii::CommandBuffer const& command_buffer,
+                uint32_t positions_index);
+
+    float opening_angle() { return m_opening_angle; }
+    void set_opening_angle(float opening_angle) {
+        m_opening_angle = opening_angle;
+    }
+
+private:
+    struct PushConstants {
+        uint32_t star_count;
+        uint32_t positions_index;
+        float opening_angle;
+    };
+
+    void dispatch(vk::raii::CommandBuffer const& command_buffer,
+                  vk::raii::Pipeline const& pipeline);
+
+    GPUStarData& m_star_data;
+    RadixSort m_radix_sort;
+
+    gfx::Allocation m_bounds_memory{nullptr};
+    vk::raii::Buffer m_bounds{nullptr};
+
+    gfx::Allocation m_nodes_memory{nullptr};
+    vk::raii::Buffer m_nodes{nullptr};
+
+    gfx::Allocation m_parents_memory{nullptr};
+    vk::raii::Buffer m_parents{nullptr};
+
+    gfx::Allocation m_visits_memory{nullptr};
+    vk::raii::Buffer m_visits{nullptr};
+
+    vk::raii::DescriptorPool m_descriptor_pool{nullptr};
+    vk::raii::DescriptorSetLayout m_set_layout{nullptr};
+    vk::raii::DescriptorSets m_descriptor_sets{nullptr};
+
+    vk::raii::PipelineLayout m_pipeline_layout{nullptr};
+    vk::raii::Pipeline m_bounds_pipeline{nullptr};
+    vk::raii::Pipeline m_morton_pipeline{nullptr};
+    vk::raii::Pipeline m_build_pipeline{nullptr};
+    vk::raii::Pipeline m_summarize_pipeline{nullptr};
+    vk::raii::Pipeline m_force_pipeline{nullptr};
+
+    float m_opening_angle = 0.5f;
+    uint32_t m_positions_index = 0;
+};
+}  // namespace galaxy
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <vulkan/vulkan_raii.hpp>
+
+#include "galaxy/star_data.hpp"
+#include "gfx.hpp"
+
+namespace galaxy {
+// Replacement for the per-pixel draw pass. Stars are binned into 16x16
+// pixel tiles by their footprint, so each pixel only visits the stars that
+// are bright enough to matter there instead of all of them.
+class BinnedRenderer {
+public:
+    BinnedRenderer() = delete;
+    ~BinnedRenderer();
+
+    // threshold: brightness below which a star is considered invisible,
+    // bounds its footprint. entries_per_star sizes the tile lists.
+    BinnedRenderer(gfx::Core& core, GPUStarData& star_data,
+                   vk::raii::DescriptorSetLayout const& draw_set_layout,
+                   glm::ivec2 screen_dimensions, float threshold,
+                   uint32_t entries_per_star);
+
+    // expects the screen coordinates of positions()[positions_index] in
+    // coords() and the stars on screen in visible(), and writes every pixel
+    // of the image bound in draw_set
+    void record(vk::raii::CommandBuffer const& command_buffer,
+                vk::DescriptorSet draw_set, uint32_t positions_index);
+
+    // Grows the tile lists if a finished frame needed more entries than
+    // they hold, which dropped the stars that didn't fit from that frame.
+    // Waits for the device to go idle when it grows.
+    void fit_bin_entries();
+
+private:
+    struct PushConstants {
+        glm::ivec2 screen_dimensions;
+        uint32_t positions_index;
+        uint32_t star_count;
+        uint32_t tiles_x;
+        uint32_t tiles_y;
+        uint32_t capacity;
+        float threshold;
+    };
+
+    // bin_entries for capacity entries, and the set pointing at it
+    void allocate_bin_entries();
+
+    gfx::Core& m_core;
+    GPUStarData& m_star_data;
+
+    gfx::Allocation m_tile_counts_memory{nullptr};
+    vk::raii::Buffer m_tile_counts{nullptr};
+    gfx::Allocation m_tile_offsets_memory{nullptr};
+    vk::raii::Buffer m_tile_offsets{nullptr};
+    gfx::Allocation m_tile_cursors_memory{nullptr};
+    vk::raii::Buffer m_tile_cursors{nullptr};
+    gfx::Allocation m_bin_entries_memory{nullptr};
+    vk::raii::Buffer m_bin_entries{nullptr};
+    // host visible, written by bin_scan
+    gfx::Allocation m_bin_demand_memory{nullptr};
+    vk::raii::Buffer m_bin_demand{nullptr};
+
+    vk::raii::DescriptorPool m_descriptor_pool{nullptr};
+    vk::raii::DescriptorSetLayout m_set_layout{nullptr};
+    vk::raii::DescriptorSets m_descriptor_sets{nullptr};
+
+    vk::raii::PipelineLayout m_pipeline_layout{nullptr};
+    vk::raii::Pipeline m_count_pipeline{nullptr};
+    vk::raii::Pipeline m_scan_pipeline{nullptr};
+    vk::raii::Pipeline m_scatter_pipeline{nullptr};
+    vk::raii::Pipeline m_draw_pipeline{nullptr};
+
+    PushConstants m_push_constants;
+};
+}  // namespace galaxy
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <vulkan/vulkan_raii.hpp>
+
+#include "galaxy/star_data.hpp"
+#include "gfx.hpp"
+
+namespace galaxy {
+// the finest step is 1 / 2^(MAX_TIMESTEP_LEVELS - 1) of a whole step
+const static uint32_t MAX_TIMESTEP_LEVELS = 8;
+
+// Direct-sum steps with hierarchical power-of-two timesteps. A step is split
+// into 2^(level_count - 1) substeps and every star only has the pull on it
+// summed as often as its own level asks for. Every block starts at substep
+// 0, so all stars kick there and a step costs at least one sim.slang step;
+// the saving is against running every star at the finest level. Each
+// substep compacts the stars due into a list and sizes the kick dispatch on
+// the GPU, so nothing is read back. With a single level a step is exactly a
+// step of sim.slang.
+class BlockTimesteps {
+public:
+    BlockTimesteps() = delete;
+    ~BlockTimesteps();
+
+    // levels 1 to MAX_TIMESTEP_LEVELS, accuracy is the fraction of a star's
+    // time scale |a| / |da/dt| its step may take
+    BlockTimesteps(gfx::Core& core, GPUStarData& star_data,
+                   uint32_t level_count, float accuracy);
+
+    // reads positions()[positions_index] and writes the other position
+    // buffer, like the direct-sum sim pipeline
+    void record(vk::raii::CommandBuffer const& command_buffer,
+                uint32_t positions_index);
+
+private:
+    struct PushConstants {
+        uint32_t star_count;
+        uint32_t positions_index;
+        uint32_t substep;
+        uint32_t level_count;
+        uint32_t first;
+        uint32_t last;
+        float accuracy;
+        float step_time;
+    };
+
+    void bind(vk::raii::CommandBuffer const& command_buffer,
+              vk::raii::Pipeline const& pipeline);
+
+    GPUStarData& m_star_data;
+    PushConstants m_push_constants{};
+
+    gfx::Allocation m_levels_memory{nullptr};
+    vk::raii::Buffer m_levels{nullptr};
+    gfx::Allocation m_active_stars_memory{nullptr};
+    vk::raii::Buffer m_active_stars{nullptr};
+    gfx::Allocation m_kick_arguments_memory{nullptr};
+    vk::raii::Buffer m_kick_arguments{nullptr};
+    gfx::Allocation m_kicks_memory{nullptr};
+    vk::raii::Buffer m_kicks{nullptr};
+    gfx::Allocation m_scratch_positions_memory{nullptr};
+    vk::raii::Buffer m_scratch_positions{nullptr};
+
+    vk::raii::DescriptorPool m_descriptor_pool{nullptr};
+    vk::raii::DescriptorSetLayout m_set_layout{nullptr};
+    vk::raii::DescriptorSets m_descriptor_sets{nullptr};
+
+    vk::raii::PipelineLayout m_pipeline_layout{nullptr};
+    vk::raii::Pipeline m_select_pipeline{nullptr};
+    vk::raii::Pipeline m_arguments_pipeline{nullptr};
+    vk::raii::Pipeline m_kick_pipeline{nullptr};
+    vk::raii::Pipeline m_drift_pipeline{nullptr};
+};
+}  // namespace galaxy
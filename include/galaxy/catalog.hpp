@@ -0,0 +1,25 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "galaxy/star_data.hpp"
+#include "gfx.hpp"
+
+namespace galaxy {
+// Star catalogs are CSV or whitespace separated ASCII tables whose first line
+// names the columns, like the HYG database. Positions are read from x, y and z
+// in parsecs. The mass follows from absmag, or from mag and the distance, and
+// the tint from the B-V colour index in ci. Other columns are ignored, and
+// rows without a position are skipped.
+//
+// Parses the catalog at path on every core into owned star data. Throws if
+// the file can't be read or has no x, y and z columns.
+StarData parse_catalog(std::string const& path);
+
+// Loads the catalog at path through its binary sidecar <path>.gsnap, a
+// snapshot of the stars at rest that is written on the first load and used
+// instead of parsing for as long as it is newer than the catalog.
+std::shared_ptr<GPUStarData> load_catalog(gfx::Core& core,
+                                          std::string const& path);
+}  // namespace galaxy
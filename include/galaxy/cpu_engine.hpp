@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <span>
+#include <vector>
+
+#include "galaxy/star_data.hpp"
+#include "gfx.hpp"
+#include "settings.hpp"
+
+namespace galaxy {
+bool cpu_kernel_supported(CpuKernel kernel);
+// the widest kernel the CPU running this supports
+CpuKernel best_cpu_kernel();
+char const* cpu_kernel_name(CpuKernel kernel);
+
+// Direct-sum gravity on the CPU, for machines without a usable Vulkan device
+// and as a reference for the GPU solvers. A step does exactly what sim.slang
+// does, with the same softening and timestep, so the two only differ by
+// rounding. The pair loop runs over blocks of stars that stay in the cache,
+// split into ranges of stars across every core, in SIMD lanes of 8 or 16
+// stars when the CPU has AVX2 or AVX-512.
+class CpuEngine {
+public:
+    CpuEngine() = delete;
+    ~CpuEngine();
+    CpuEngine(CpuEngine const&) = delete;
+    CpuEngine& operator=(CpuEngine const&) = delete;
+
+    // Simulates the stars of star_data, whose positions are updated in place
+    // after every step. velocities holds one vec4 per star, or nothing for
+    // stars at rest. thread_count 0 uses every core.
+    CpuEngine(StarData& star_data, std::span<glm::vec4 const> velocities,
+              CpuKernel kernel = best_cpu_kernel(), uint32_t thread_count = 0);
+
+    // one step of sim.slang
+    void step();
+
+    // in the layout of the velocities buffer of GPUStarData
+    std::span<glm::vec4 const> velocities() const { return m_velocities; }
+    CpuKernel kernel() const { return m_kernel; }
+    uint32_t thread_count() const { return m_thread_count; }
+
+private:
+    // the accelerations of stars [begin, end) from every star
+    void accelerate(uint32_t begin, uint32_t end);
+
+    StarData& m_star_data;
+    CpuKernel m_kernel;
+    uint32_t m_thread_count = 1;
+    // the star count rounded up to whole SIMD lanes, the padding stars have
+    // no mass
+    uint32_t m_padded_count = 0;
+
+    // positions and G times the masses, axis by axis
+    std::vector<float> m_x;
+    std::vector<float> m_y;
+    std::vector<float> m_z;
+    std::vector<float> m_gm;
+    std::vector<float> m_ax;
+    std::vector<float> m_ay;
+    std::vector<float> m_az;
+    std::vector<glm::vec4> m_velocities;
+};
+
+// Generates Plummer stars on the GPU, runs a few steps of sim.slang and of
+// every CPU kernel this CPU supports from the same state and compares the
+// positions. Returns whether every kernel agreed with the GPU.
+bool check_cpu_engine(gfx::Core& core, uint32_t star_count);
+
+// Simulates settings.cpu_steps steps of the catalog, or of a random cube of
+// settings.star_count stars, without touching Vulkan, and writes the result
+// as a snapshot if a prefix is set. Returns false if that failed.
+bool run_cpu(Settings const& settings);
+}  // namespace galaxy
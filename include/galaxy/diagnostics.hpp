@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <optional>
+#include <vector>
+#include <vulkan/vulkan_raii.hpp>
+
+#include "galaxy/star_data.hpp"
+#include "gfx.hpp"
+
+namespace galaxy {
+// what the diagnostics kernels leave in their result buffer, in units of
+// mass_unit kg. Must match DiagnosticsResult in shaders/diagnostics.slangh.
+struct DiagnosticsResult {
+    glm::vec3 momentum;
+    float mass;
+    glm::vec3 center_of_mass;
+    float kinetic_energy;
+    float potential_energy;
+    float bounding_radius;
+    float mass_unit;
+    uint32_t reserved;
+};
+static_assert(sizeof(DiagnosticsResult) == 48);
+
+// conserved quantities of the stars after a step, in SI units
+struct DiagnosticsSample {
+    uint64_t step;
+    double kinetic_energy;
+    double potential_energy;
+    double total_energy;
+    // relative change of the total energy since the first sample
+    double energy_drift;
+    glm::dvec3 momentum;
+    double mass;
+    glm::vec3 center_of_mass;
+    // largest distance of a star from the center of mass
+    float bounding_radius;
+};
+
+// Reduces the star buffers to their energies, momentum and extent on the
+// GPU. Only the few result scalars are copied into one of a ring of host
+// visible buffers, so watching a run this way doesn't read back the stars.
+// The potential energy is summed over all pairs with the direct-sum pair
+// loop and costs about as much as a direct-sum step.
+class Diagnostics {
+public:
+    Diagnostics() = delete;
+    ~Diagnostics();
+    Diagnostics(Diagnostics const&) = delete;
+    Diagnostics& operator=(Diagnostics const&) = delete;
+
+    Diagnostics(gfx::Core& core, GPUStarData& star_data, uint32_t slots);
+
+    // Records the reductions over positions()[positions_index] and the
+    // velocities after everything recorded before. frame_fence must be the
+    // fence the command buffer is submitted with. Returns false if every slot
+    // is still busy, nothing is recorded then.
+    bool record(vk::raii::CommandBuffer const& command_buffer,
+                uint32_t positions_index, uint64_t step,
+                vk::Fence frame_fence);
+
+    // the samples whose frames finished since the last call, in step order
+    std::vector<DiagnosticsSample> poll();
+
+private:
+    struct PushConstants {
+        uint32_t star_count;
+        uint32_t positions_index;
+        uint32_t group_count;
+    };
+
+    struct Slot {
+        vk::raii::Buffer buffer{nullptr};
+        gfx::Allocation memory{nullptr};
+        bool busy = false;
+        vk::Fence fence;
+        uint64_t step = 0;
+    };
+
+    void dispatch(vk::raii::CommandBuffer const& command_buffer,
+                  vk::raii::Pipeline const& pipeline,
+                  PushConstants const& push_constants, uint32_t group_count);
+
+    gfx::Core& m_core;
+    GPUStarData& m_star_data;
+    std::vector<Slot> m_slots;
+    uint32_t m_group_count = 0;
+    // total energy of the first sample, the drift is measured against it
+    std::optional<double> m_initial_energy;
+
+    gfx::Allocation m_partials_memory{nullptr};
+    vk::raii::Buffer m_partials{nullptr};
+    gfx::Allocation m_result_memory{nullptr};
+    vk::raii::Buffer m_result{nullptr};
+
+    vk::raii::DescriptorPool m_descriptor_pool{nullptr};
+    vk::raii::DescriptorSetLayout m_set_layout{nullptr};
+    vk::raii::DescriptorSets m_descriptor_sets{nullptr};
+
+    vk::raii::PipelineLayout m_pipeline_layout{nullptr};
+    vk::raii::Pipeline m_stars_pipeline{nullptr};
+    vk::raii::Pipeline m_combine_pipeline{nullptr};
+    vk::raii::Pipeline m_radius_pipeline{nullptr};
+};
+
+// prints a sample as one line
+void print_diagnostics(DiagnosticsSample const& sample);
+}  // namespace galaxy
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "settings.hpp"
+
+namespace galaxy {
+// Streams rendered frames into a file, either as raw RGBA8 one after another
+// or as a YUV4MPEG2 (.y4m) video that e.g. ffmpeg and mpv read directly.
+class FrameWriter {
+public:
+    FrameWriter() = delete;
+    ~FrameWriter();
+    FrameWriter(FrameWriter const&) = delete;
+    FrameWriter& operator=(FrameWriter const&) = delete;
+
+    FrameWriter(std::string const& path, OutputFormat format, uint32_t width,
+                uint32_t height, uint32_t fps);
+
+    // rgba: width * height tightly packed RGBA8 pixels
+    void write(uint8_t const* rgba);
+
+private:
+    std::FILE* m_file = nullptr;
+    OutputFormat m_format;
+    uint32_t m_width = 0;
+    uint32_t m_height = 0;
+    // Y, Cb and Cr planes of one y4m frame
+    std::vector<uint8_t> m_planes;
+};
+}  // namespace galaxy
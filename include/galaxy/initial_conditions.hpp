@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <vulkan/vulkan_raii.hpp>
+
+#include "galaxy/star_data.hpp"
+#include "gfx.hpp"
+#include "settings.hpp"
+
+namespace galaxy {
+// Generates the stars on the GPU with a counter-based RNG (Philox4x32-10).
+// The same seed and parameters give the same stars on a given device.
+class InitialConditions {
+public:
+    InitialConditions() = delete;
+    ~InitialConditions();
+
+    InitialConditions(gfx::Core& core, GPUStarData& star_data);
+
+    // writes both position buffers with the masses, the velocities and tints
+    void record(vk::raii::CommandBuffer const& command_buffer,
+                InitialModel model, uint64_t seed, float radius,
+                float star_mass);
+
+private:
+    struct PushConstants {
+        uint32_t star_count;
+        uint32_t model;
+        uint32_t seed_low;
+        uint32_t seed_high;
+        float radius;
+        float star_mass;
+    };
+
+    GPUStarData& m_star_data;
+
+    vk::raii::PipelineLayout m_pipeline_layout{nullptr};
+    vk::raii::Pipeline m_pipeline{nullptr};
+};
+}  // namespace galaxy
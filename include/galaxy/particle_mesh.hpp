@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstdint>
+#include <vulkan/vulkan_raii.hpp>
+
+#include "galaxy/star_data.hpp"
+#include "gfx.hpp"
+
+namespace galaxy {
+// O(N + G log G) gravity solver for star counts even a tree is too slow for.
+// Every step deposits the mass onto a grid fitted to the stars, solves for
+// the potential with FFTs on the GPU and interpolates the forces back.
+// Structure finer than a grid cell is lost, so it suits smooth, large-scale
+// distributions.
+class ParticleMesh {
+public:
+    ParticleMesh() = delete;
+    ~ParticleMesh();
+
+    // Grids of grid_size^3 nodes, a power of two from 16 to 256. Transforms
+    // the kernel once and blocks until that is done. The FFT grid takes
+    // 12 * (2 * grid_size)^3 bytes.
+    ParticleMesh(gfx::Core& core, GPUStarData& star_data, uint32_t grid_size);
+
+    // reads positions()[positions_index] and writes the other position
+    // buffer, like the direct-sum sim pipeline
+    void record(vk::raii::CommandBuffer const& command_buffer,
+                uint32_t positions_index);
+
+    uint32_t grid_size() { return m_grid_size; }
+
+private:
+    struct PushConstants {
+        uint32_t star_count;
+        uint32_t positions_index;
+        uint32_t grid_size;
+        uint32_t fft_size;
+        uint32_t log2_fft_size;
+        uint32_t axis;
+        uint32_t inverse;
+        uint32_t group_count;
+    };
+
+    void dispatch(vk::raii::CommandBuffer const& command_buffer,
+                  vk::raii::Pipeline const& pipeline, uint32_t group_count_x,
+                  uint32_t group_count_y = 1, uint32_t group_count_z = 1);
+    // a dispatch over every node of the FFT grid
+    void dispatch_fft_grid(vk::raii::CommandBuffer const& command_buffer,
+                           vk::raii::Pipeline const& pipeline);
+    // the 3D FFT of the FFT grid in place, one dispatch per axis
+    void record_fft(vk::raii::CommandBuffer const& command_buffer,
+                    bool inverse);
+
+    GPUStarData& m_star_data;
+    uint32_t m_grid_size = 0;
+    uint32_t m_fft_size = 0;
+    uint32_t m_group_count = 0;
+    PushConstants m_push_constants{};
+
+    gfx::Allocation m_bounds_memory{nullptr};
+    vk::raii::Buffer m_bounds{nullptr};
+    gfx::Allocation m_partials_memory{nullptr};
+    vk::raii::Buffer m_partials{nullptr};
+    gfx::Allocation m_params_memory{nullptr};
+    vk::raii::Buffer m_params{nullptr};
+    gfx::Allocation m_mass_grid_memory{nullptr};
+    vk::raii::Buffer m_mass_grid{nullptr};
+    gfx::Allocation m_fft_grid_memory{nullptr};
+    vk::raii::Buffer m_fft_grid{nullptr};
+    gfx::Allocation m_kernel_memory{nullptr};
+    vk::raii::Buffer m_kernel{nullptr};
+
+    vk::raii::DescriptorPool m_descriptor_pool{nullptr};
+    vk::raii::DescriptorSetLayout m_set_layout{nullptr};
+    vk::raii::DescriptorSets m_descriptor_sets{nullptr};
+
+    vk::raii::PipelineLayout m_pipeline_layout{nullptr};
+    vk::raii::Pipeline m_bounds_pipeline{nullptr};
+    vk::raii::Pipeline m_setup_pipeline{nullptr};
+    vk::raii::Pipeline m_deposit_pipeline{nullptr};
+    vk::raii::Pipeline m_load_pipeline{nullptr};
+    vk::raii::Pipeline m_fft_pipeline{nullptr};
+    vk::raii::Pipeline m_convolve_pipeline{nullptr};
+    vk::raii::Pipeline m_force_pipeline{nullptr};
+};
+}  // namespace galaxy
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <vulkan/vulkan_raii.hpp>
+
+#include "gfx.hpp"
+
+namespace galaxy {
+// GPU least-significant-digit radix sort of (uint key, uint value) pairs,
+// 4 bits per pass. Callers fill keys() and values(), record() sorts them in
+// place by key.
+class RadixSort {
+public:
+    RadixSort() = delete;
+    ~RadixSort();
+
+    RadixSort(gfx::Core& core, uint32_t capacity);
+
+    // Only the lowest key_bits bits of each key take part in the ordering.
+    // The value 0xFFFFFFFF is reserved and must not be used as a value.
+    void record(vk::raii::CommandBuffer const& command_buffer, uint32_t count,
+                uint32_t key_bits = 32);
+
+    vk::raii::Buffer& keys() { return m_keys[0]; }
+    vk::raii::Buffer& values() { return m_values[0]; }
+
+    uint32_t capacity() { return m_capacity; }
+
+private:
+    struct PushConstants {
+        uint32_t count;
+        uint32_t shift;
+        uint32_t block_count;
+        uint32_t flip;
+    };
+
+    // [0] holds the sorted result, [1] is the scratch side of the ping-pong
+    std::vector<gfx::Allocation> m_keys_memories;
+    std::vector<vk::raii::Buffer> m_keys;
+    std::vector<gfx::Allocation> m_values_memories;
+    std::vector<vk::raii::Buffer> m_values;
+
+    gfx::Allocation m_histograms_memory{nullptr};
+    vk::raii::Buffer m_histograms{nullptr};
+
+    vk::raii::DescriptorPool m_descriptor_pool{nullptr};
+    vk::raii::DescriptorSetLayout m_set_layout{nullptr};
+    vk::raii::DescriptorSets m_descriptor_sets{nullptr};
+
+    vk::raii::PipelineLayout m_pipeline_layout{nullptr};
+    vk::raii::Pipeline m_histogram_pipeline{nullptr};
+    vk::raii::Pipeline m_scan_pipeline{nullptr};
+    vk::raii::Pipeline m_scatter_pipeline{nullptr};
+
+    uint32_t m_capacity = 0;
+};
+}  // namespace galaxy
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan_raii.hpp>
+
+#include "galaxy/star_data.hpp"
+#include "gfx.hpp"
+
+namespace galaxy {
+// Snapshot files hold the complete simulation state in the layout of the GPU
+// buffers (see star_layout.hpp): the header, then the positions with the
+// masses, the velocities as vec4 and the packed tints, each section starting
+// at a multiple of SNAPSHOT_ALIGNMENT so the mapped file can be copied from
+// directly. All values are little endian. Version 1 kept the masses in a
+// section of their own and can't be read anymore.
+const static uint32_t SNAPSHOT_VERSION = 2;
+const static uint64_t SNAPSHOT_ALIGNMENT = 4096;
+
+struct SnapshotHeader {
+    // "GLXSNAP" and a terminating zero
+    char magic[8];
+    uint32_t version;
+    uint32_t star_count;
+    // simulation steps taken when the snapshot was recorded
+    uint64_t step;
+    uint64_t positions_offset;
+    uint64_t velocities_offset;
+    uint64_t tints_offset;
+    uint64_t reserved;
+    uint64_t file_size;
+};
+static_assert(sizeof(SnapshotHeader) == 64);
+
+// header of a snapshot of star_count stars, with the magic and offsets set
+SnapshotHeader make_snapshot_header(uint32_t star_count, uint64_t step);
+
+// Maps a snapshot file and streams it into the buffers of a new GPUStarData
+// through the transfer queue. Throws if the file isn't a valid snapshot.
+std::shared_ptr<GPUStarData> load_snapshot(gfx::Core& core,
+                                           std::string const& path,
+                                           uint64_t& step);
+
+// Writes star_data as a snapshot of step, blocking. The stars are at rest
+// unless velocities holds one per star. Returns false if the file couldn't be
+// written.
+bool write_snapshot(StarData const& star_data, std::string const& path,
+                    std::span<glm::vec4 const> velocities = {},
+                    uint64_t step = 0);
+
+// Writes snapshots without stalling the frame loop. The state is copied into
+// one of a ring of host visible buffers by the frame's own command buffer and
+// written to disk on a worker thread once the frame's fence signals.
+class SnapshotWriter {
+public:
+    SnapshotWriter() = delete;
+    ~SnapshotWriter();
+    SnapshotWriter(SnapshotWriter const&) = delete;
+    SnapshotWriter& operator=(SnapshotWriter const&) = delete;
+
+    // slot buffers are allocated on first use
+    SnapshotWriter(gfx::Core& core, GPUStarData& star_data, uint32_t slots);
+
+    // Records copying positions()[positions_index] and the other buffers
+    // after everything recorded before. frame_fence must be the fence the
+    // command buffer is submitted with. Returns false if every slot is still
+    // busy, nothing is recorded then.
+    bool record(vk::raii::CommandBuffer const& command_buffer,
+                uint32_t positions_index, uint64_t step,
+                std::string const& path, vk::Fence frame_fence);
+
+    // hands finished copies to the worker threads and retires written slots
+    void poll();
+
+    // records, submits and writes a snapshot right away, for when no frame is
+    // being recorded
+    void save(uint32_t positions_index, uint64_t step, std::string const& path);
+
+    // blocks until every recorded snapshot is on disk
+    void finish();
+
+private:
+    enum class SlotState {
+        eIdle,
+        eCopying,
+        eWriting,
+    };
+
+    struct Slot {
+        vk::raii::Buffer buffer{nullptr};
+        gfx::Allocation memory{nullptr};
+        SlotState state = SlotState::eIdle;
+        vk::Fence fence;
+        std::string path;
+        std::future<bool> written;
+    };
+
+    void start_writing(Slot& slot);
+
+    gfx::Core& m_core;
+    GPUStarData& m_star_data;
+    std::vector<Slot> m_slots;
+};
+}  // namespace galaxy
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <vulkan/vulkan_raii.hpp>
+
+#include "galaxy/star_data.hpp"
+#include "gfx.hpp"
+
+namespace galaxy {
+// Replacement for the compute draw passes that goes through the rasterizer.
+// Every visible star is an instanced quad over its footprint, and additive
+// blending sums the stars into an HDR color attachment, so the cost follows
+// the pixels the stars cover instead of pixels times stars.
+class SpriteRenderer {
+public:
+    SpriteRenderer() = delete;
+    ~SpriteRenderer();
+
+    // threshold: brightness below which a star is considered invisible,
+    // bounds its quad like the footprint of the binned renderer
+    SpriteRenderer(gfx::Core& core, GPUStarData& star_data,
+                   vk::raii::DescriptorSetLayout const& draw_set_layout,
+                   glm::ivec2 screen_dimensions, float threshold);
+
+    // expects the screen coordinates of positions()[positions_index] in
+    // coords() and the stars on screen in visible(), and writes every pixel
+    // of the image bound in draw_set
+    void record(vk::raii::CommandBuffer const& command_buffer,
+                vk::DescriptorSet draw_set, uint32_t positions_index);
+
+private:
+    struct PushConstants {
+        glm::ivec2 screen_dimensions;
+        uint32_t positions_index;
+        float threshold;
+    };
+
+    void bind(vk::raii::CommandBuffer const& command_buffer,
+              vk::PipelineBindPoint bind_point, vk::DescriptorSet draw_set);
+
+    GPUStarData& m_star_data;
+    PushConstants m_push_constants{};
+
+    gfx::Allocation m_draw_arguments_memory{nullptr};
+    vk::raii::Buffer m_draw_arguments{nullptr};
+    gfx::Allocation m_hdr_image_memory{nullptr};
+    vk::raii::Image m_hdr_image{nullptr};
+    vk::raii::ImageView m_hdr_image_view{nullptr};
+
+    vk::raii::DescriptorPool m_descriptor_pool{nullptr};
+    vk::raii::DescriptorSetLayout m_set_layout{nullptr};
+    vk::raii::DescriptorSets m_descriptor_sets{nullptr};
+
+    vk::raii::PipelineLayout m_pipeline_layout{nullptr};
+    vk::raii::Pipeline m_arguments_pipeline{nullptr};
+    vk::raii::Pipeline m_sprite_pipeline{nullptr};
+    vk::raii::Pipeline m_resolve_pipeline{nullptr};
+};
+}  // namespace galaxy
@@ -2,9 +2,15 @@
 
 #include <glm/fwd.hpp>
 #include <glm/glm.hpp>
+#include <span>
 #include <vector>
 #include <vulkan/vulkan_raii.hpp>
 
+#include "galaxy/star_layout.hpp"
+#include "gfx.hpp"
+#include "gfx/allocator.hpp"
+#include "gfx/staging.hpp"
+
 namespace galaxy {
 struct Star {
     glm::vec3 position;
@@ -12,30 +18,61 @@ struct Star {
     glm::float32_t weight;
 };
 
+// Star attributes in the layout of the GPU buffers, see star_layout.hpp: the
+// mass rides along with the position and the tint is packed. The storage is
+// either owned by StarData or borrowed from a StagingArena, in which case the
+// stars are written straight into mapped memory and GPUStarData only records
+// the copies.
 class StarData {
 public:
     StarData();
-
-    Star operator[](uint32_t i) {
+    // Borrows room for capacity stars from arena. Stays valid until the arena
+    // is submitted, which GPUStarData does.
+    StarData(gfx::StagingArena& arena, uint32_t capacity);
+    StarData(StarData const&) = delete;
+    StarData& operator=(StarData const&) = delete;
+    StarData(StarData&& other) = default;
+    StarData& operator=(StarData&& other) = default;
+
+    // staging room StarData(arena, count) needs
+    static vk::DeviceSize staging_size(uint32_t count);
+
+    Star operator[](uint32_t i) const {
         return Star{
-            .position = m_positions[i],
-            .tint = m_tints[i],
-            .weight = m_weights[i],
+            .position = m_positions[i].position,
+            .tint = unpack_tint(m_tints[i]),
+            .weight = m_positions[i].mass,
         };
     }
 
+    // borrowed storage can't grow past its capacity
+    void reserve(uint32_t capacity);
+    // new stars are left uninitialized, for span writes
+    void resize(uint32_t size);
     void push(Star star);
 
-    std::vector<glm::vec3>& positions() { return m_positions; }
-    std::vector<glm::vec3>& tints() { return m_tints; }
-    std::vector<glm::float32_t>& weights() { return m_weights; }
+    std::span<PositionMass> positions() { return {m_positions, m_size}; }
+    std::span<PackedTint> tints() { return {m_tints, m_size}; }
+    std::span<PositionMass const> positions() const {
+        return {m_positions, m_size};
+    }
+    std::span<PackedTint const> tints() const { return {m_tints, m_size}; }
 
-    uint32_t size() { return m_positions.size(); }
+    uint32_t size() const { return m_size; }
+    uint32_t capacity() const { return m_capacity; }
+
+    // the arena the storage is borrowed from, nullptr if owned
+    gfx::StagingArena* arena() const { return m_arena; }
 
 private:
-    std::vector<glm::vec3> m_positions;
-    std::vector<glm::vec3> m_tints;
-    std::vector<glm::float32_t> m_weights;
+    std::vector<PositionMass> m_owned_positions;
+    std::vector<PackedTint> m_owned_tints;
+
+    PositionMass* m_positions = nullptr;
+    PackedTint* m_tints = nullptr;
+    uint32_t m_size = 0;
+    uint32_t m_capacity = 0;
+    gfx::StagingArena* m_arena = nullptr;
 };
 
 class GPUStarData {
@@ -43,10 +80,16 @@ public:
     GPUStarData() = delete;
     ~GPUStarData();
 
-    GPUStarData(vk::raii::Device& device,
-                vk::raii::PhysicalDevice& physical_device,
-                vk::raii::CommandBuffer& command_buffer, vk::raii::Queue& queue,
-                StarData star_data);
+    // buffers with undefined contents, for a generator to fill
+    GPUStarData(gfx::Core& core, uint32_t star_count);
+    // Starts uploading star_data and returns without waiting for it, see
+    // wait_for_upload(). Borrowed star_data is submitted with its arena,
+    // owned star_data is staged first.
+    GPUStarData(gfx::Core& core, StarData const& star_data);
+
+    // the buffers must not be read before this returns, returns at once
+    // without an upload
+    void wait_for_upload();
 
     vk::raii::DescriptorSetLayout& descriptor_set_layout() {
         return m_set_layout;
@@ -56,30 +99,39 @@ public:
 
     std::vector<vk::raii::Buffer>& positions() { return m_positions; }
     vk::raii::Buffer& tints() { return m_tints; }
-    vk::raii::Buffer& weights() { return m_weights; }
     vk::raii::Buffer& coords() { return m_screen_pos; }
     vk::raii::Buffer& velocities() { return m_velocities; }
+    // indices of the stars on screen and the indirect dispatch over them,
+    // see STAR_VISIBLE_* in star_layout.h
+    vk::raii::Buffer& visible() { return m_visible; }
+    vk::raii::Buffer& visible_arguments() { return m_visible_arguments; }
+
+    uint32_t star_count() { return m_star_count; }
 
 private:
-    std::vector<vk::raii::DeviceMemory> m_positions_memories;
+    std::vector<gfx::Allocation> m_positions_memories;
     std::vector<vk::raii::Buffer> m_positions;
 
-    vk::raii::DeviceMemory m_weights_memory{nullptr};
-    vk::raii::Buffer m_weights{nullptr};
-
-    vk::raii::DeviceMemory m_tints_memory{nullptr};
+    gfx::Allocation m_tints_memory{nullptr};
     vk::raii::Buffer m_tints{nullptr};
 
-    vk::raii::DeviceMemory m_screen_pos_memory{nullptr};
+    gfx::Allocation m_screen_pos_memory{nullptr};
     vk::raii::Buffer m_screen_pos{nullptr};
 
-    vk::raii::DeviceMemory m_velocities_memory{nullptr};
+    gfx::Allocation m_velocities_memory{nullptr};
     vk::raii::Buffer m_velocities{nullptr};
 
+    gfx::Allocation m_visible_memory{nullptr};
+    vk::raii::Buffer m_visible{nullptr};
+    gfx::Allocation m_visible_arguments_memory{nullptr};
+    vk::raii::Buffer m_visible_arguments{nullptr};
+
     vk::raii::DescriptorPool m_descriptor_pool{nullptr};
     vk::raii::DescriptorSetLayout m_set_layout{nullptr};
     vk::raii::DescriptorSets m_descriptor_sets{nullptr};
 
+    gfx::Upload m_upload{nullptr};
+
     uint32_t m_star_count = 0;
 };
 }  // namespace galaxy
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+
+#include "../../shaders/star_layout.h"
+
+namespace galaxy {
+// Element types of the star buffers in std430 layout. They mirror
+// shaders/star_layout.slangh, and both sides check their sizes against
+// shaders/star_layout.h.
+
+// position in meters and mass in kg, read with a single vec4 load
+struct PositionMass {
+    glm::vec3 position;
+    glm::float32_t mass;
+};
+static_assert(sizeof(PositionMass) == STAR_POSITION_STRIDE);
+static_assert(offsetof(PositionMass, mass) == 12);
+
+// rgb as half floats, red in the low half of red_green
+struct PackedTint {
+    uint32_t red_green;
+    uint32_t blue;
+};
+static_assert(sizeof(PackedTint) == STAR_TINT_STRIDE);
+
+// velocity in meters per second, w unused
+static_assert(sizeof(glm::vec4) == STAR_VELOCITY_STRIDE);
+
+// 13.3 fixed point screen coordinates, x in the low 16 bits
+using PackedCoords = uint32_t;
+static_assert(sizeof(PackedCoords) == STAR_COORDS_STRIDE);
+
+inline PackedTint pack_tint(glm::vec3 tint) {
+    return PackedTint{
+        .red_green = glm::packHalf2x16(glm::vec2(tint.r, tint.g)),
+        .blue = glm::packHalf2x16(glm::vec2(tint.b, 0.0f)),
+    };
+}
+
+inline glm::vec3 unpack_tint(PackedTint tint) {
+    return glm::vec3(glm::unpackHalf2x16(tint.red_green),
+                     glm::unpackHalf2x16(tint.blue).x);
+}
+}  // namespace galaxy
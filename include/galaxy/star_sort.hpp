@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstdint>
+#include <vulkan/vulkan_raii.hpp>
+
+#include "galaxy/radix_sort.hpp"
+#include "galaxy/star_data.hpp"
+#include "gfx.hpp"
+
+namespace galaxy {
+// Reorders every star buffer of a GPUStarData by the Morton code of the
+// stars' positions, so stars that are close in space are close in memory and
+// neighbouring threads of the per-star passes read neighbouring data. The
+// order decays as the stars move, so it is meant to be rerun every few steps.
+class StarSort {
+public:
+    StarSort() = delete;
+    ~StarSort();
+
+    StarSort(gfx::Core& core, GPUStarData& star_data);
+
+    // Sorts positions()[positions_index], which carry the masses, together
+    // with the velocities and tints. The other position buffer is left alone,
+    // the next step overwrites it. Ends with the stars written by compute
+    // shaders, callers put a compute barrier after it.
+    void record(vk::raii::CommandBuffer const& command_buffer,
+                uint32_t positions_index);
+
+    // the index each star had before the first sort, one uint per star
+    vk::raii::Buffer& star_ids() { return m_star_ids; }
+    // the sorted Morton codes of the last sort
+    vk::raii::Buffer& keys() { return m_radix_sort.keys(); }
+
+private:
+    struct PushConstants {
+        uint32_t star_count;
+        uint32_t positions_index;
+    };
+
+    void dispatch(vk::raii::CommandBuffer const& command_buffer,
+                  vk::raii::Pipeline const& pipeline,
+                  uint32_t positions_index);
+
+    GPUStarData& m_star_data;
+    RadixSort m_radix_sort;
+
+    gfx::Allocation m_bounds_memory{nullptr};
+    vk::raii::Buffer m_bounds{nullptr};
+
+    gfx::Allocation m_scratch_positions_memory{nullptr};
+    vk::raii::Buffer m_scratch_positions{nullptr};
+    gfx::Allocation m_scratch_velocities_memory{nullptr};
+    vk::raii::Buffer m_scratch_velocities{nullptr};
+    gfx::Allocation m_scratch_tints_memory{nullptr};
+    vk::raii::Buffer m_scratch_tints{nullptr};
+
+    gfx::Allocation m_star_ids_memory{nullptr};
+    vk::raii::Buffer m_star_ids{nullptr};
+    gfx::Allocation m_scratch_ids_memory{nullptr};
+    vk::raii::Buffer m_scratch_ids{nullptr};
+
+    vk::raii::DescriptorPool m_descriptor_pool{nullptr};
+    vk::raii::DescriptorSetLayout m_set_layout{nullptr};
+    vk::raii::DescriptorSets m_descriptor_sets{nullptr};
+
+    vk::raii::PipelineLayout m_pipeline_layout{nullptr};
+    vk::raii::Pipeline m_bounds_pipeline{nullptr};
+    vk::raii::Pipeline m_morton_pipeline{nullptr};
+    vk::raii::Pipeline m_gather_pipeline{nullptr};
+};
+
+// Sorts generated stars twice and checks on the host that the star buffers
+// were permuted consistently and end up in Morton order. Returns whether
+// every check passed.
+bool check_star_sort(gfx::Core& core, uint32_t star_count);
+
+// times sorting and a Barnes-Hut step before and after sorting for a range
+// of star counts
+void benchmark_star_sort(gfx::Core& core);
+}  // namespace galaxy
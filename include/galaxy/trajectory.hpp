@@ -0,0 +1,190 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+#include <vulkan/vulkan_raii.hpp>
+
+#include "galaxy/star_data.hpp"
+#include "gfx.hpp"
+
+namespace galaxy {
+// Trajectory files hold the positions of every star at a series of steps.
+// Each frame's positions are quantized to 16 bits per axis relative to the
+// frame's bounding box and stored as the difference to the frame before, with
+// the low and high bytes of each axis in separate planes so they compress
+// well. Frames are grouped into independently deflated chunks whose first
+// frame is stored whole. The index at index_offset lists the chunks and then
+// the frames, so any frame can be decoded from the start of its chunk. All
+// values are little endian.
+const static uint32_t TRAJECTORY_VERSION = 1;
+// quantization steps per axis across the bounding box
+const static uint32_t TRAJECTORY_LEVELS = 65535;
+
+struct TrajectoryHeader {
+    // "GLXTRAJ" and a terminating zero
+    char magic[8];
+    uint32_t version;
+    uint32_t star_count;
+    // every chunk but the last holds this many frames
+    uint32_t frames_per_chunk;
+    uint32_t frame_count;
+    uint32_t chunk_count;
+    uint32_t reserved;
+    // 0 until the writer finished, the file is unreadable then
+    uint64_t index_offset;
+    uint64_t reserved2[3];
+};
+static_assert(sizeof(TrajectoryHeader) == 64);
+
+struct TrajectoryChunk {
+    uint64_t offset;
+    uint64_t compressed_size;
+    uint32_t first_frame;
+    uint32_t frame_count;
+};
+static_assert(sizeof(TrajectoryChunk) == 24);
+
+struct TrajectoryFrame {
+    // simulation steps taken when the positions were recorded
+    uint64_t step;
+    // bounding box the positions are quantized in
+    float min[3];
+    float max[3];
+};
+static_assert(sizeof(TrajectoryFrame) == 32);
+
+// Streams trajectory frames to a file without stalling the frame loop. The
+// positions are copied into one of a ring of host visible buffers by the
+// frame's own command buffer, and a worker thread quantizes, encodes and
+// compresses them once the frame's fence signals.
+class TrajectoryWriter {
+public:
+    TrajectoryWriter() = delete;
+    ~TrajectoryWriter();
+    TrajectoryWriter(TrajectoryWriter const&) = delete;
+    TrajectoryWriter& operator=(TrajectoryWriter const&) = delete;
+
+    // Creates path right away and throws if it can't. Slot buffers are
+    // allocated on first use. If the stars get reordered, star_ids holds the
+    // original index of every star (see StarSort) and the frames are written
+    // in that order.
+    TrajectoryWriter(gfx::Core& core, GPUStarData& star_data,
+                     std::string const& path, uint32_t slots,
+                     vk::Buffer star_ids = nullptr);
+
+    // Records copying positions()[positions_index] after everything recorded
+    // before. frame_fence must be the fence the command buffer is submitted
+    // with. Returns false if every slot is still busy, nothing is recorded
+    // then.
+    bool record(vk::raii::CommandBuffer const& command_buffer,
+                uint32_t positions_index, uint64_t step,
+                vk::Fence frame_fence);
+
+    // hands finished copies to the worker thread
+    void poll();
+
+    // blocks until every recorded frame is encoded, then writes the index
+    // and closes the file
+    void finish();
+
+private:
+    enum class SlotState {
+        eIdle,
+        eCopying,
+        eEncoding,
+    };
+
+    struct Slot {
+        vk::raii::Buffer buffer{nullptr};
+        gfx::Allocation memory{nullptr};
+        // set back to idle by the worker
+        std::atomic<SlotState> state = SlotState::eIdle;
+        vk::Fence fence;
+        uint64_t step = 0;
+    };
+
+    void queue(Slot& slot);
+    void work();
+    void encode(Slot& slot);
+    void write_chunk();
+    bool write(void const* data, size_t size);
+
+    gfx::Core& m_core;
+    GPUStarData& m_star_data;
+    vk::Buffer m_star_ids;
+    std::string m_path;
+    std::vector<Slot> m_slots;
+    uint32_t m_frames_per_chunk = 1;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::deque<Slot*> m_queue;
+    bool m_stopping = false;
+    std::thread m_worker;
+
+    // only touched by the worker until it is joined
+    std::FILE* m_file = nullptr;
+    uint64_t m_file_offset = 0;
+    bool m_failed = false;
+    // positions put back into the original order of the stars
+    std::vector<PositionMass> m_ordered;
+    // quantized positions of the last frame, axis by axis
+    std::vector<uint16_t> m_previous;
+    std::vector<uint16_t> m_current;
+    std::vector<uint8_t> m_chunk;
+    std::vector<uint8_t> m_compressed;
+    std::vector<TrajectoryChunk> m_chunks;
+    std::vector<TrajectoryFrame> m_frames;
+};
+
+// Random access to the frames of a finished trajectory file. Throws if the
+// file isn't a valid trajectory.
+class TrajectoryReader {
+public:
+    TrajectoryReader() = delete;
+    ~TrajectoryReader();
+    TrajectoryReader(TrajectoryReader const&) = delete;
+    TrajectoryReader& operator=(TrajectoryReader const&) = delete;
+
+    explicit TrajectoryReader(std::string const& path);
+
+    uint32_t star_count() const { return m_header.star_count; }
+    uint32_t frame_count() const { return m_header.frame_count; }
+    std::span<TrajectoryChunk const> chunks() const { return m_chunks; }
+    TrajectoryFrame const& frame(uint32_t index) const {
+        return m_frames[index];
+    }
+
+    // Decodes frame index into positions, which must hold star_count()
+    // entries. Reading the frames of a chunk in order decodes each frame once,
+    // jumping backwards decodes again from the start of the chunk.
+    void read(uint32_t index, std::span<glm::vec3> positions);
+
+private:
+    void load_chunk(uint32_t chunk);
+
+    std::FILE* m_file = nullptr;
+    TrajectoryHeader m_header{};
+    std::vector<TrajectoryChunk> m_chunks;
+    std::vector<TrajectoryFrame> m_frames;
+
+    // the decompressed chunk of the frame decoded last, and its quantized
+    // positions
+    uint32_t m_loaded_chunk = UINT32_MAX;
+    uint32_t m_decoded_frame = UINT32_MAX;
+    std::vector<uint8_t> m_compressed;
+    std::vector<uint8_t> m_chunk;
+    std::vector<uint16_t> m_quantized;
+};
+
+// prints what a trajectory file holds and how fast it decodes
+void inspect_trajectory(std::string const& path);
+}  // namespace galaxy
@@ -5,15 +5,21 @@
 #include <glm/ext/vector_uint2.hpp>
 #include <glm/glm.hpp>
 #include <glm/integer.hpp>
+#include <chrono>
 #include <memory>
+#include <string>
 #include <vulkan/vulkan_raii.hpp>
 
 #include <glfwpp/glfwpp.h>
 
+#include "gfx/allocator.hpp"
+
 namespace gfx {
 class Core {
 public:
-    Core();
+    // headless skips GLFW, the surface and the swapchain. Frames then only
+    // exist in images the caller creates and reads back itself.
+    Core(bool headless = false);
     ~Core();
     Core(const Core&&) = delete;
     Core& operator=(const Core&& other) = delete;
@@ -29,6 +35,23 @@ public:
     void upload_uniform_buffer(const T& data);
 
     vk::raii::ShaderModule create_shader_module(std::string path);
+    // goes through the pipeline cache and counts towards
+    // report_pipeline_creation()
+    vk::raii::Pipeline create_compute_pipeline(
+        std::string path, vk::raii::PipelineLayout const& layout,
+        vk::SpecializationInfo const* specialization_info = nullptr);
+    // Triangle lists without vertex buffers into a single color attachment
+    // of color_format, for dynamic rendering. Viewport and scissor are
+    // dynamic. Counts like create_compute_pipeline().
+    vk::raii::Pipeline create_graphics_pipeline(
+        std::string vertex_path, std::string fragment_path,
+        vk::raii::PipelineLayout const& layout, vk::Format color_format,
+        vk::PipelineColorBlendAttachmentState const& blend_attachment);
+
+    // prints the time spent creating pipelines and the cache hits
+    void report_pipeline_creation();
+    // also done on destruction
+    void save_pipeline_cache();
 
     std::shared_ptr<vk::raii::Context> context() { return m_context; }
     std::shared_ptr<vk::raii::Instance> instance() { return m_instance; }
@@ -49,18 +72,43 @@ public:
         return m_swapchain_image_views;
     }
     vk::raii::Buffer& uniform_buffer() { return m_uniform_buffer; }
-    vk::raii::DeviceMemory& uniform_buffer_memory() {
-        return m_uniform_buffer_memory;
-    }
+    Allocation& uniform_buffer_memory() { return m_uniform_buffer_memory; }
+    // every buffer and image memory comes from here
+    std::shared_ptr<Allocator> allocator() { return m_allocator; }
     std::shared_ptr<vk::raii::Queue> graphics_queue() {
         return m_graphics_queue;
     }
     std::shared_ptr<vk::raii::Queue> present_queue() { return m_present_queue; }
+    // only set if has_async_compute()
+    std::shared_ptr<vk::raii::Queue> compute_queue() { return m_compute_queue; }
+    std::shared_ptr<vk::raii::CommandPool> compute_command_pool() {
+        return m_compute_command_pool;
+    }
+    // only set if has_transfer_queue()
+    std::shared_ptr<vk::raii::Queue> transfer_queue() {
+        return m_transfer_queue;
+    }
+    std::shared_ptr<vk::raii::CommandPool> transfer_command_pool() {
+        return m_transfer_command_pool;
+    }
     vk::Format swapchain_format() { return m_format; }
-    glfw::GlfwLibrary& glfw() { return m_glfw; }
+    // only set without headless
+    std::shared_ptr<glfw::GlfwLibrary> glfw() { return m_glfw; }
 
     glfw::Window& window() { return m_window; }
 
+    bool headless() { return m_headless; }
+
+    // whether the pipelineStatisticsQuery feature is enabled
+    bool pipeline_statistics() { return m_pipeline_statistics; }
+
+    // whether the graphics family can draw and dynamic rendering is enabled,
+    // a headless device may only compute
+    bool has_rasterization() { return m_rasterization; }
+
+    // size of the window, or of the frames rendered headless
+    vk::Extent2D extent();
+
     uint32_t graphics_family_index() {
         return m_graphics_family_index;
     }
@@ -69,13 +117,46 @@ public:
         return m_present_family_index;
     }
 
+    uint32_t compute_family_index() {
+        return m_compute_family_index;
+    }
+
+    uint32_t transfer_family_index() {
+        return m_transfer_family_index;
+    }
+
+    // true if the device has a compute family separate from graphics
+    bool has_async_compute() { return m_compute_queue != nullptr; }
+
+    // true if the device has a family that can only transfer
+    bool has_transfer_queue() { return m_transfer_queue != nullptr; }
+
+    // families that access shared resources, for concurrent sharing
+    std::vector<uint32_t> queue_family_indices();
+    // the same plus the transfer family, for buffers a StagingArena fills
+    std::vector<uint32_t> upload_family_indices();
+
 private:
+    // pick the physical device and queue families
+    void init_windowed_device();
+    void init_headless_device();
+    void init_swapchain();
+    // loads the cache file of this device and driver if there is a valid one
+    void init_pipeline_cache();
+    // adds a pipeline created since start to report_pipeline_creation()
+    void count_pipeline_creation(std::chrono::steady_clock::time_point start,
+                                 vk::PipelineCreationFeedback const& feedback);
+
     std::shared_ptr<vk::raii::Context> m_context;
     std::shared_ptr<vk::raii::Instance> m_instance;
     std::shared_ptr<vk::raii::PhysicalDevice> m_physical_device;
     std::shared_ptr<vk::raii::Device> m_device;
     std::shared_ptr<vk::raii::Queue> m_graphics_queue;
     std::shared_ptr<vk::raii::Queue> m_present_queue;
+    std::shared_ptr<vk::raii::Queue> m_compute_queue;
+    std::shared_ptr<vk::raii::CommandPool> m_compute_command_pool;
+    std::shared_ptr<vk::raii::Queue> m_transfer_queue;
+    std::shared_ptr<vk::raii::CommandPool> m_transfer_command_pool;
     std::shared_ptr<vk::raii::CommandPool> m_command_pool;
     std::shared_ptr<vk::raii::CommandBuffers> m_command_buffers;
     std::shared_ptr<vk::raii::SurfaceKHR> m_surface;
@@ -83,15 +164,33 @@ private:
     std::vector<vk::Image> m_swapchain_images;
     std::vector<vk::raii::ImageView> m_swapchain_image_views;
 
+    // declared before everything allocated from it, so it is destroyed after
+    std::shared_ptr<Allocator> m_allocator;
+
+    vk::raii::PipelineCache m_pipeline_cache{nullptr};
+    std::string m_pipeline_cache_path;
+    bool m_pipeline_cache_loaded = false;
+    double m_pipeline_creation_ms = 0.0;
+    uint32_t m_pipeline_count = 0;
+    uint32_t m_pipeline_cache_hits = 0;
+    // pipelines the driver gave no feedback for count as neither
+    uint32_t m_pipeline_cache_misses = 0;
+
     vk::raii::Buffer m_uniform_buffer{nullptr};
-    vk::raii::DeviceMemory m_uniform_buffer_memory{nullptr};
+    Allocation m_uniform_buffer_memory{nullptr};
 
     vk::Format m_format;
 
     uint32_t m_graphics_family_index = 0;
     uint32_t m_present_family_index = 0;
+    uint32_t m_compute_family_index = 0;
+    uint32_t m_transfer_family_index = 0;
+
+    bool m_headless = false;
+    bool m_pipeline_statistics = false;
+    bool m_rasterization = false;
 
-    glfw::GlfwLibrary m_glfw = glfw::init();
+    std::shared_ptr<glfw::GlfwLibrary> m_glfw;
     glfw::Window m_window;
 };
 }  // namespace gfx
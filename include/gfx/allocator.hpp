@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
+#include <vulkan/vulkan_raii.hpp>
+
+namespace gfx {
+class Allocator;
+
+// A range of one of the allocator's memory blocks. Returns the range to its
+// block when destroyed, so it must not outlive the Allocator.
+class Allocation {
+public:
+    Allocation() = default;
+    Allocation(std::nullptr_t) {}
+    ~Allocation();
+    Allocation(Allocation const&) = delete;
+    Allocation& operator=(Allocation const&) = delete;
+    Allocation(Allocation&& other) noexcept;
+    Allocation& operator=(Allocation&& other) noexcept;
+
+    vk::DeviceMemory memory() const { return m_memory; }
+    vk::DeviceSize offset() const { return m_offset; }
+    vk::DeviceSize size() const { return m_size; }
+    // host visible memory stays mapped for the lifetime of its block,
+    // nullptr for everything else
+    void* mapped() const { return m_mapped; }
+
+private:
+    friend class Allocator;
+
+    void release();
+
+    Allocator* m_allocator = nullptr;
+    uint32_t m_block = 0;
+    vk::DeviceMemory m_memory;
+    vk::DeviceSize m_offset = 0;
+    vk::DeviceSize m_size = 0;
+    void* m_mapped = nullptr;
+};
+
+// Suballocates buffers and images from large vk::DeviceMemory blocks, one
+// pool of blocks per memory type. Free ranges of a block are kept sorted by
+// offset, allocations take the first that fits after alignment, and freed
+// ranges merge with their neighbours. Buffers and optimally tiled images
+// never share a block, which keeps bufferImageGranularity out of the
+// picture.
+class Allocator {
+public:
+    Allocator() = delete;
+    ~Allocator();
+    Allocator(Allocator const&) = delete;
+    Allocator& operator=(Allocator const&) = delete;
+
+    // memory_budget: whether VK_EXT_memory_budget is enabled on device
+    Allocator(vk::raii::Device& device,
+              vk::raii::PhysicalDevice& physical_device, bool memory_budget);
+
+    // Picks a type with required | preferred if there is one, otherwise one
+    // with required. linear is false for optimally tiled images.
+    Allocation allocate(vk::MemoryRequirements const& requirements,
+                        vk::MemoryPropertyFlags required,
+                        vk::MemoryPropertyFlags preferred = {},
+                        bool linear = true);
+
+    std::pair<vk::raii::Buffer, Allocation> create_buffer(
+        vk::BufferCreateInfo const& create_info,
+        vk::MemoryPropertyFlags required,
+        vk::MemoryPropertyFlags preferred = {});
+    std::pair<vk::raii::Image, Allocation> create_image(
+        vk::ImageCreateInfo const& create_info,
+        vk::MemoryPropertyFlags required,
+        vk::MemoryPropertyFlags preferred = {});
+
+    // Bytes of device local memory that can still be allocated. With
+    // VK_EXT_memory_budget this is what the driver grants the process,
+    // otherwise the heap sizes minus what this allocator holds.
+    vk::DeviceSize device_local_available();
+
+    // per heap: blocks held, bytes suballocated and the driver's budget
+    void print_report();
+
+private:
+    friend class Allocation;
+
+    struct Block {
+        vk::raii::DeviceMemory memory{nullptr};
+        vk::DeviceSize size = 0;
+        vk::DeviceSize used = 0;
+        uint32_t memory_type = 0;
+        bool linear = true;
+        // holds a single allocation too big to share a block
+        bool dedicated = false;
+        uint8_t* mapped = nullptr;
+        // offset -> size
+        std::map<vk::DeviceSize, vk::DeviceSize> free_ranges;
+    };
+
+    uint32_t find_memory_type(uint32_t type_bits,
+                              vk::MemoryPropertyFlags required,
+                              vk::MemoryPropertyFlags preferred);
+    uint32_t create_block(uint32_t memory_type, vk::DeviceSize size,
+                          bool linear, bool dedicated);
+    bool try_allocate(uint32_t block_index,
+                      vk::MemoryRequirements const& requirements,
+                      Allocation& allocation);
+    void free(Allocation& allocation);
+
+    vk::raii::Device& m_device;
+    vk::PhysicalDeviceMemoryProperties m_memory_properties;
+    vk::raii::PhysicalDevice& m_physical_device;
+    bool m_memory_budget = false;
+
+    // indices stay stable, released blocks leave a nullptr behind
+    std::vector<std::unique_ptr<Block>> m_blocks;
+};
+}  // namespace gfx
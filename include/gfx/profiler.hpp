@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan_raii.hpp>
+
+#include "gfx.hpp"
+
+namespace gfx {
+// Brackets GPU passes with timestamp queries (and compute invocation counts
+// where pipeline statistics are supported) and keeps a rolling window of the
+// results per pass. There is a query pool per frame in flight; a slot's
+// results are read once its fence has been waited on.
+class Profiler {
+public:
+    Profiler() = delete;
+    ~Profiler();
+
+    // window: number of frames the statistics are computed over
+    Profiler(Core& core, uint32_t frames_in_flight, uint32_t window);
+
+    // Call after the fence of slot was waited on. Collects what the slot
+    // measured last time and makes it the target of the following calls.
+    void begin_frame(uint32_t slot);
+    // prints a report every window frames
+    void end_frame();
+
+    // passes must not nest, each begin is closed by the next end
+    void begin(vk::raii::CommandBuffer const& command_buffer,
+               std::string const& name);
+    void end(vk::raii::CommandBuffer const& command_buffer);
+
+    // for work that only has CPU timings, like waiting on acquire or present
+    void add_cpu_sample(std::string const& name, double milliseconds);
+
+    void print_report();
+    void write_json(std::string const& path);
+
+private:
+    struct Pass {
+        std::string name;
+        // in milliseconds, at most window of the latest frames
+        std::deque<double> samples;
+        std::deque<uint64_t> invocations;
+        bool cpu = false;
+    };
+
+    uint32_t pass_index(std::string const& name, bool cpu);
+
+    std::vector<vk::raii::QueryPool> m_timestamp_pools;
+    std::vector<vk::raii::QueryPool> m_statistics_pools;
+    // passes written to each slot's pools, in query order
+    std::vector<std::vector<uint32_t>> m_slot_passes;
+
+    std::vector<Pass> m_passes;
+
+    uint32_t m_slot = 0;
+    uint32_t m_window = 0;
+    uint64_t m_frame_count = 0;
+    // nanoseconds per timestamp tick
+    float m_timestamp_period = 1.0f;
+    uint64_t m_timestamp_mask = ~0ull;
+};
+}  // namespace gfx
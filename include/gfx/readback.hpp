@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include <vulkan/vulkan_raii.hpp>
+
+namespace gfx {
+class Core;
+
+// Records with record into a one-time command buffer, submits it to the
+// graphics queue and blocks until it executed. Meant for checks and
+// benchmarks, not for the frame loop.
+void submit_and_wait(
+    Core& core,
+    std::function<void(vk::raii::CommandBuffer const&)> const& record);
+
+// copies the first size bytes of buffer into data after all work submitted
+// before, blocking
+void read_back(Core& core, vk::Buffer buffer, void* data, vk::DeviceSize size);
+
+template <typename T>
+std::vector<T> read_back(Core& core, vk::Buffer buffer, uint32_t count) {
+    std::vector<T> data(count);
+    read_back(core, buffer, data.data(), sizeof(T) * count);
+    return data;
+}
+}  // namespace gfx
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <vector>
+#include <vulkan/vulkan_raii.hpp>
+
+#include "gfx/allocator.hpp"
+
+namespace gfx {
+class Core;
+
+// The copies of one StagingArena::submit(). Owns the staging memory until
+// the transfer is done and waits for it when destroyed.
+class Upload {
+public:
+    Upload() = default;
+    Upload(std::nullptr_t) {}
+    ~Upload();
+    Upload(Upload const&) = delete;
+    Upload& operator=(Upload const&) = delete;
+    Upload(Upload&& other) = default;
+    Upload& operator=(Upload&& other) = default;
+
+    // true once the destination buffers hold the data
+    bool done();
+    // blocks until done() and releases the staging memory
+    void wait();
+
+    // bytes staged on the host, filled regions not included
+    vk::DeviceSize size() const { return m_size; }
+
+private:
+    friend class StagingArena;
+
+    vk::raii::Device* m_device = nullptr;
+    vk::raii::Buffer m_staging_buffer{nullptr};
+    Allocation m_staging_memory{nullptr};
+    vk::raii::CommandBuffer m_command_buffer{nullptr};
+    vk::raii::Fence m_fence{nullptr};
+    vk::DeviceSize m_size = 0;
+};
+
+// Packs the data for any number of device local buffers into one persistently
+// mapped staging buffer and copies all of it with a single submission, on the
+// dedicated transfer queue if the device has one. Destination buffers must be
+// shared with Core::upload_family_indices() and have TransferDst usage.
+//
+// An arena is used once: submit() hands its staging memory to the returned
+// Upload.
+class StagingArena {
+public:
+    // every staged range starts at a multiple of this
+    const static vk::DeviceSize ALIGNMENT = 16;
+
+    static vk::DeviceSize aligned(vk::DeviceSize size) {
+        return (size + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+    }
+
+    StagingArena() = delete;
+    // capacity: sum of aligned() sizes of everything staged
+    StagingArena(Core& core, vk::DeviceSize capacity);
+
+    // space for count Ts in the mapped staging buffer, valid until submit()
+    template <typename T>
+    std::span<T> allocate(size_t count) {
+        return std::span<T>(static_cast<T*>(reserve(sizeof(T) * count)),
+                            count);
+    }
+
+    // copies a range returned by allocate(), or part of one, to destination
+    template <typename T>
+    void copy(std::span<T const> staged, vk::Buffer destination,
+              vk::DeviceSize destination_offset = 0) {
+        copy_range(staged.data(), staged.size_bytes(), destination,
+                   destination_offset);
+    }
+
+    // allocate() and copy() to every destination at destination_offset
+    template <typename T>
+    std::span<T> stage(std::vector<vk::Buffer> const& destinations,
+                       size_t count, vk::DeviceSize destination_offset = 0) {
+        std::span<T> staged = allocate<T>(count);
+        for (vk::Buffer destination : destinations) {
+            copy<T>(staged, destination, destination_offset);
+        }
+        return staged;
+    }
+    template <typename T>
+    std::span<T> stage(vk::Buffer destination, size_t count,
+                       vk::DeviceSize destination_offset = 0) {
+        return stage<T>(std::vector<vk::Buffer>{destination}, count,
+                        destination_offset);
+    }
+
+    template <typename T>
+    void upload(std::span<T const> data, vk::Buffer destination,
+                vk::DeviceSize destination_offset = 0) {
+        std::memcpy(
+            stage<T>(destination, data.size(), destination_offset).data(),
+            data.data(), data.size_bytes());
+    }
+
+    // sets size bytes of destination to the repeated value without staging
+    void fill(vk::Buffer destination, vk::DeviceSize size, uint32_t value = 0,
+              vk::DeviceSize destination_offset = 0);
+
+    // records and submits everything staged so far
+    Upload submit();
+
+    vk::DeviceSize capacity() const { return m_capacity; }
+    vk::DeviceSize used() const { return m_used; }
+
+private:
+    struct Copy {
+        vk::Buffer destination;
+        vk::BufferCopy region;
+    };
+    struct Fill {
+        vk::Buffer destination;
+        vk::DeviceSize offset;
+        vk::DeviceSize size;
+        uint32_t value;
+    };
+
+    void* reserve(vk::DeviceSize size);
+    void copy_range(void const* staged, vk::DeviceSize size,
+                    vk::Buffer destination, vk::DeviceSize destination_offset);
+
+    Core& m_core;
+    vk::raii::Buffer m_staging_buffer{nullptr};
+    Allocation m_staging_memory{nullptr};
+    vk::DeviceSize m_capacity = 0;
+    vk::DeviceSize m_used = 0;
+    std::vector<Copy> m_copies;
+    std::vector<Fill> m_fills;
+};
+
+// times staging and copying buffers of growing size and prints the
+// bandwidth of both
+void benchmark_staging(Core& core);
+}  // namespace gfx
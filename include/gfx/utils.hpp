@@ -6,6 +6,8 @@
 #include <vulkan/vulkan_enums.hpp>
 #include <vulkan/vulkan_raii.hpp>
 
+#include "gfx/allocator.hpp"
+
 namespace gfx {
 namespace util {
 
@@ -13,6 +15,12 @@ const uint32_t TIMEOUT = 100000000;
 
 uint32_t find_graphics_queue_family_index(
     std::vector<vk::QueueFamilyProperties> const& queue_family_properties);
+uint32_t find_compute_queue_family_index(
+    std::vector<vk::QueueFamilyProperties> const& queue_family_properties);
+uint32_t find_transfer_queue_family_index(
+    std::vector<vk::QueueFamilyProperties> const& queue_family_properties);
+uint32_t find_compute_capable_queue_family_index(
+    std::vector<vk::QueueFamilyProperties> const& queue_family_properties);
 std::tuple<uint32_t, uint32_t> find_graphics_and_present_queue_family_index(
     vk::raii::PhysicalDevice const& physical_device,
     vk::raii::SurfaceKHR const& surface);
@@ -32,10 +40,13 @@ void set_image_layout(vk::raii::CommandBuffer const& commandBuffer,
                       vk::Image image, vk::Format format,
                       vk::ImageLayout oldImageLayout,
                       vk::ImageLayout newImageLayout);
-void copy_buffers_to_device_local(
-    vk::raii::Device& device, vk::raii::CommandBuffer& command_buffer,
-    vk::raii::Queue queue, std::vector<vk::raii::Buffer> const& staging_buffers,
-    std::vector<vk::raii::Buffer*> const& device_buffers,
-    std::vector<vk::DeviceSize> sizes);
+std::pair<vk::raii::Buffer, Allocation> make_buffer(
+    Allocator& allocator, vk::DeviceSize size, vk::BufferUsageFlags usage,
+    vk::MemoryPropertyFlags properties);
+void update_storage_buffer_descriptors(
+    vk::raii::Device const& device, vk::DescriptorSet descriptor_set,
+    std::vector<vk::Buffer> const& buffers);
+void compute_barrier(vk::raii::CommandBuffer const& command_buffer);
+void indirect_barrier(vk::raii::CommandBuffer const& command_buffer);
 }  // namespace util
 }  // namespace gfx
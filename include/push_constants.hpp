@@ -11,5 +11,6 @@ struct PushConstants {
   glm::mat4 view_projection_matrix;
   glm::ivec2 screen_dimensions;
   uint32_t positions_index;
+  uint32_t star_count;
 };
 }  // namespace galaxy
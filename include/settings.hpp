@@ -0,0 +1,145 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+
+namespace galaxy {
+enum class Solver {
+    eDirect,
+    eTiled,
+    eBarnesHut,
+    eParticleMesh,
+};
+
+enum class Renderer {
+    ePerPixel,
+    eBinned,
+    eSprites,
+};
+
+// values must match the MODEL_* constants of initial_conditions.slang
+enum class InitialModel {
+    eCube,
+    ePlummer,
+    eDisk,
+    eSpiral,
+};
+
+// instruction sets the pair loop of the CPU engine is compiled for
+enum class CpuKernel {
+    eScalar,
+    eAvx2,
+    eAvx512,
+};
+
+enum class OutputFormat {
+    eRaw,
+    eY4m,
+};
+
+struct Settings {
+    static Settings from_args(int argc, char** argv);
+
+    uint32_t star_count = 2048;
+    // star_count is picked from the free device memory instead
+    bool auto_star_count = false;
+    // initial conditions, generated on the GPU from seed
+    InitialModel initial_model = InitialModel::eCube;
+    uint64_t seed = 1;
+    // scale radius of the model in meters
+    float model_radius = 1.0e10f;
+    // kg, the models other than the cube give every star the same mass
+    float star_mass = 1.0e20f;
+    // star catalog the stars are loaded from instead of the model
+    std::string catalog_path;
+    // frames the CPU may record ahead of the GPU
+    uint32_t frames_in_flight = 2;
+    Solver solver = Solver::eDirect;
+    // a tree node of size s seen from distance d is treated as a single
+    // point mass when s / d < opening_angle
+    float opening_angle = 0.5f;
+    // stars staged in shared memory per step of the tiled direct-sum kernel,
+    // also its workgroup size
+    uint32_t tile_size = 256;
+    // nodes per axis of the particle-mesh grid, a power of two from 16 to
+    // 256
+    uint32_t pm_grid_size = 64;
+    // power-of-two timestep levels of the direct solver, 1 gives every star
+    // the same step
+    uint32_t timestep_levels = 1;
+    // fraction of a star's time scale |a| / |da/dt| its step may take
+    float timestep_accuracy = 0.02f;
+
+    Renderer renderer = Renderer::ePerPixel;
+    // brightness (in output color units) below which the binned and sprite
+    // renderers drop a star's contribution to a pixel
+    float brightness_threshold = 1.0f / 512.0f;
+    // average tile list entries reserved per star by the binned renderer
+    uint32_t bin_entries_per_star = 16;
+
+    // fixed simulation rate independent of the frame rate, 0 runs one step
+    // per presented frame
+    uint32_t steps_per_second = 60;
+    // most steps recorded before a single frame, a larger backlog is dropped
+    uint32_t max_substeps = 4;
+    // steps simulated without rendering before the first frame, and again
+    // whenever F is pressed
+    uint32_t fast_forward_steps = 0;
+
+    // render without a window into the intermediate image only
+    bool headless = false;
+    // frames rendered before a headless run exits
+    uint32_t frame_count = 600;
+    // file the headless frames are streamed into, nothing is written if empty
+    std::string output_path;
+    OutputFormat output_format = OutputFormat::eY4m;
+    // frame rate of the headless output, each frame advances the simulation
+    // by 1 / fps seconds
+    uint32_t fps = 60;
+
+    // time every pass of the frame with GPU timestamps
+    bool profile = false;
+    // frames the profiler statistics are computed over and printed after
+    uint32_t profile_window = 120;
+    // where the profiler results are dumped as JSON on exit, if set
+    std::string profile_json;
+
+    // snapshots are written to <snapshot_prefix>-<step>.gsnap
+    std::string snapshot_prefix;
+    // steps between snapshots, 0 for none besides S and the one on exit
+    uint64_t snapshot_every = 0;
+    // snapshot the run resumes from instead of generating stars
+    std::string restore_path;
+
+    // positions are appended to this trajectory file every trajectory_every
+    // steps, not counting fast-forwarded ones
+    std::string trajectory_path;
+    uint64_t trajectory_every = 10;
+    // only print what this trajectory file holds and exit
+    std::string inspect_trajectory_path;
+
+    // steps between printing the energies, momentum and extent of the stars,
+    // 0 for none
+    uint64_t diagnostics_every = 0;
+
+    // steps between reordering the stars in Morton order, 0 never sorts
+    uint64_t sort_every = 0;
+
+    // simulate cpu_steps steps on the CPU instead, without Vulkan
+    bool cpu = false;
+    uint64_t cpu_steps = 100;
+    // the widest kernel the CPU supports if unset
+    std::optional<CpuKernel> cpu_kernel;
+
+    // only run the staging upload benchmark, headless
+    bool benchmark_staging = false;
+    // only check the Morton sort on star_count generated stars
+    bool check_sort = false;
+    // only run the Morton sort benchmark
+    bool benchmark_sort = false;
+    // only compare the CPU engine with sim.slang on star_count generated
+    // stars
+    bool check_cpu = false;
+};
+}  // namespace galaxy
@@ -0,0 +1,33 @@
+// Layout of the star buffers, shared by the host (galaxy/star_layout.hpp) and
+// the shaders (star_layout.slangh). Only preprocessor definitions, so both
+// languages can include it.
+
+// bindings of the star buffers in GPUStarData's descriptor set
+#define STAR_POSITIONS1_BINDING 0
+#define STAR_TINTS_BINDING 1
+#define STAR_COORDS_BINDING 2
+#define STAR_POSITIONS2_BINDING 3
+#define STAR_VELOCITIES_BINDING 4
+#define STAR_VISIBLE_BINDING 5
+#define STAR_VISIBLE_ARGUMENTS_BINDING 6
+#define STAR_BINDING_COUNT 7
+
+// bytes per star in each buffer
+#define STAR_POSITION_STRIDE 16
+#define STAR_VELOCITY_STRIDE 16
+#define STAR_TINT_STRIDE 8
+#define STAR_COORDS_STRIDE 4
+
+// screen coordinates are stored as 13.3 fixed point per axis, so the screen
+// can be at most STAR_COORDS_MAX_EXTENT pixels wide and high
+#define STAR_COORDS_FRACTION_BITS 3
+#define STAR_COORDS_MAX_EXTENT 8191
+#define STAR_COORDS_OFF_SCREEN 0xFFFFFFFFu
+
+// The culling pass appends the indices of the stars on screen to the visible
+// list. The visible arguments are a VkDispatchIndirectCommand over the list
+// in workgroups of STAR_VISIBLE_WORKGROUP_SIZE, followed by the list's length
+// at STAR_VISIBLE_COUNT_INDEX.
+#define STAR_VISIBLE_WORKGROUP_SIZE 256
+#define STAR_VISIBLE_COUNT_INDEX 3
+#define STAR_VISIBLE_ARGUMENTS_SIZE 4
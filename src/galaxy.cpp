@@ -1,60 +1,121 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
 #include <cmath>
 #include <cstdint>
 #include <cstdlib>
+#include <format>
 #include <galaxy.hpp>
 #include <glm/fwd.hpp>
 #include <iostream>
+#include <map>
 #include <memory>
-#include <random>
 #include <vulkan/vulkan_enums.hpp>
 #include <vulkan/vulkan_handles.hpp>
 #include <vulkan/vulkan_raii.hpp>
 #include <vulkan/vulkan_structs.hpp>
 
+#include "galaxy/catalog.hpp"
+#include "galaxy/initial_conditions.hpp"
 #include "galaxy/star_data.hpp"
 #include "gfx/utils.hpp"
 #include "push_constants.hpp"
 #include "vulkan/vulkan.hpp"
 
-const static uint32_t STAR_COUNT = 2048;
+// must match numthreads of sim.slang and calculate_screen_coords.slang
+const static uint32_t STAR_WORKGROUP_SIZE = 32;
+// steps per fast-forward submission, even so that every full batch starts
+// from the same position buffer and batches that sort on the same steps can
+// share a recording
+const static uint32_t FAST_FORWARD_BATCH = 256;
+// generous estimate of the device memory one star takes across the star
+// buffers, the tree, the sort and the tile lists, used by --stars auto
+const static vk::DeviceSize BYTES_PER_STAR = 256;
 
 namespace galaxy {
-Galaxy::Galaxy() { init_gfx(); }
+Galaxy::Galaxy(Settings settings)
+    : m_gfx_core(settings.headless), m_settings(settings) {
+    init_gfx();
+    m_gfx_core.allocator()->print_report();
+    if (m_gfx_core.headless()) {
+        return;
+    }
+
+    // [ and ] tune the Barnes-Hut opening angle while running
+    m_gfx_core.window().keyEvent.setCallback(
+        [this](glfw::Window&, glfw::KeyCode key_code, int,
+               glfw::KeyState key_state, glfw::ModifierKeyBit) {
+            if (key_state == glfw::KeyState::Release) {
+                return;
+            }
+            if (key_code == glfw::KeyCode::F) {
+                m_fast_forward_requested = m_settings.fast_forward_steps > 0;
+                return;
+            }
+            if (key_code == glfw::KeyCode::S) {
+                m_snapshot_requested = true;
+                return;
+            }
+            if (key_code == glfw::KeyCode::M) {
+                m_gfx_core.allocator()->print_report();
+                return;
+            }
+            if (key_code == glfw::KeyCode::R && m_sprite_renderer) {
+                m_draw_sprites = !m_draw_sprites;
+                const char* renderer = m_binned_renderer ? "binned"
+                                                         : "per-pixel";
+                printf("renderer: %s\n",
+                       m_draw_sprites ? "sprites" : renderer);
+                return;
+            }
+            if (!m_barnes_hut) {
+                return;
+            }
+            float opening_angle = m_barnes_hut->opening_angle();
+            switch (key_code) {
+                case glfw::KeyCode::LeftBracket:
+                    opening_angle = std::max(opening_angle - 0.05f, 0.05f);
+                    break;
+                case glfw::KeyCode::RightBracket:
+                    opening_angle =
+                        std::min(opening_angle + 0.05f, MAX_OPENING_ANGLE);
+                    break;
+                default:
+                    return;
+            }
+            m_barnes_hut->set_opening_angle(opening_angle);
+            printf("opening angle: %.2f\n", opening_angle);
+        });
+}
 
 Galaxy::~Galaxy() {
-    for (auto& i : m_device_memories) {
-        i.clear();
-    }
+    // frames may still be in flight
+    m_gfx_core.device()->waitIdle();
 }
 
 void Galaxy::init_gfx() {
     try {
+        // the packed screen coordinates of the stars can't address more
+        vk::Extent2D screen = m_gfx_core.extent();
+        if (screen.width > STAR_COORDS_MAX_EXTENT ||
+            screen.height > STAR_COORDS_MAX_EXTENT) {
+            throw std::runtime_error(
+                "the screen is larger than " +
+                std::to_string(STAR_COORDS_MAX_EXTENT) + " pixels");
+        }
+
         vk::ImageCreateInfo image_ci(
             {}, vk::ImageType::e2D, vk::Format::eR8G8B8A8Unorm,
-            vk::Extent3D(vk::Extent2D{static_cast<uint32_t>(std::get<0>(
-                                          m_gfx_core.window().getSize())),
-                                      static_cast<uint32_t>(std::get<1>(
-                                          m_gfx_core.window().getSize()))},
-                         1),
+            vk::Extent3D(m_gfx_core.extent(), 1),
             1, 1, vk::SampleCountFlagBits::e1, vk::ImageTiling::eOptimal,
             vk::ImageUsageFlagBits::eTransferSrc |
                 vk::ImageUsageFlagBits::eStorage);
-        m_intermediate_image =
-            std::make_shared<vk::raii::Image>(*m_gfx_core.device(), image_ci);
-
-        vk::PhysicalDeviceMemoryProperties memory_properties =
-            m_gfx_core.physical_device()->getMemoryProperties();
-        vk::MemoryRequirements memory_requirements =
-            *m_intermediate_image->getMemoryRequirements();
-        uint32_t memory_type_index = gfx::util::find_memory_type(
-            memory_properties, memory_requirements.memoryTypeBits,
-            vk::MemoryPropertyFlagBits::eHostVisible);
-
-        vk::MemoryAllocateInfo memory_allocate_info(memory_requirements.size,
-                                                    memory_type_index);
-        vk::raii::DeviceMemory device_memory =
-            vk::raii::DeviceMemory(*m_gfx_core.device(), memory_allocate_info);
-        m_intermediate_image->bindMemory(device_memory, 0);
+        auto [intermediate_image, intermediate_image_memory] =
+            m_gfx_core.allocator()->create_image(
+                image_ci, vk::MemoryPropertyFlagBits::eDeviceLocal);
+        m_intermediate_image = std::make_shared<vk::raii::Image>(
+            std::move(intermediate_image));
+        m_intermediate_image_memory = std::move(intermediate_image_memory);
 
         vk::ImageViewCreateInfo image_view_create_info(
             {}, *m_intermediate_image, vk::ImageViewType::e2D,
@@ -141,50 +202,184 @@ void Galaxy::init_gfx() {
             *m_gfx_core.device().get(),
             vk::PipelineLayoutCreateInfo({}, set_layouts, push_constant_range));
 
-        vk::raii::ShaderModule screen_coords_shader =
-            m_gfx_core.create_shader_module(
-                "./shaders/calculate_screen_coords.slang.spirv");
-        vk::raii::ShaderModule draw_shader =
-            m_gfx_core.create_shader_module("./shaders/draw.slang.spirv");
-        vk::raii::ShaderModule sim_shader =
-            m_gfx_core.create_shader_module("./shaders/sim.slang.spirv");
-
-        vk::PipelineShaderStageCreateInfo
-            screen_coords_stage_pipeline_create_info(
-                {}, vk::ShaderStageFlagBits::eCompute, screen_coords_shader,
-                "main");
-        vk::PipelineShaderStageCreateInfo draw_stage_pipeline_create_info(
-            {}, vk::ShaderStageFlagBits::eCompute, draw_shader, "main");
-        vk::PipelineShaderStageCreateInfo sim_stage_pipeline_create_info(
-            {}, vk::ShaderStageFlagBits::eCompute, sim_shader, "main");
-
-        vk::ComputePipelineCreateInfo screen_coords_pipeline_ci =
-            vk::ComputePipelineCreateInfo()
-                .setStage(screen_coords_stage_pipeline_create_info)
-                .setLayout(*m_calc_coords_pipeline_layout);
-        vk::ComputePipelineCreateInfo sim_pipeline_ci =
-            vk::ComputePipelineCreateInfo()
-                .setStage(sim_stage_pipeline_create_info)
-                .setLayout(*m_sim_pipeline_layout);
-        vk::ComputePipelineCreateInfo draw_pipeline_ci =
-            vk::ComputePipelineCreateInfo()
-                .setStage(draw_stage_pipeline_create_info)
-                .setLayout(*m_draw_pipeline_layout);
-
         m_calc_coords_pipeline = std::make_shared<vk::raii::Pipeline>(
-            *m_gfx_core.device(), nullptr, screen_coords_pipeline_ci);
+            m_gfx_core.create_compute_pipeline(
+                "./shaders/calculate_screen_coords.slang.spirv",
+                *m_calc_coords_pipeline_layout));
+        m_visible_arguments_pipeline = std::make_shared<vk::raii::Pipeline>(
+            m_gfx_core.create_compute_pipeline(
+                "./shaders/visible_arguments.slang.spirv",
+                *m_calc_coords_pipeline_layout));
         m_sim_pipeline = std::make_shared<vk::raii::Pipeline>(
-            *m_gfx_core.device(), nullptr, sim_pipeline_ci);
+            m_gfx_core.create_compute_pipeline("./shaders/sim.slang.spirv",
+                                               *m_sim_pipeline_layout));
         m_draw_pipeline = std::make_shared<vk::raii::Pipeline>(
-            *m_gfx_core.device(), nullptr, draw_pipeline_ci);
+            m_gfx_core.create_compute_pipeline("./shaders/draw.slang.spirv",
+                                               *m_draw_pipeline_layout));
+
+        if (m_settings.solver == Solver::eTiled) {
+            // the tile size is also the workgroup size, which Vulkan only
+            // guarantees up to 128
+            vk::PhysicalDeviceLimits limits =
+                m_gfx_core.physical_device()->getProperties().limits;
+            uint32_t max_tile_size =
+                std::min(limits.maxComputeWorkGroupInvocations,
+                         limits.maxComputeWorkGroupSize[0]);
+            if (m_settings.tile_size > max_tile_size) {
+                throw std::runtime_error(std::format(
+                    "tile size {} is larger than the {} invocations a "
+                    "workgroup of this device can have",
+                    m_settings.tile_size, max_tile_size));
+            }
+            vk::SpecializationMapEntry specialization_entry(
+                0, 0, sizeof(uint32_t));
+            vk::SpecializationInfo specialization_info(
+                1, &specialization_entry, sizeof(uint32_t),
+                &m_settings.tile_size);
+            m_sim_tiled_pipeline = std::make_shared<vk::raii::Pipeline>(
+                m_gfx_core.create_compute_pipeline(
+                    "./shaders/sim_tiled.slang.spirv", *m_sim_pipeline_layout,
+                    &specialization_info));
+        }
+
+        if (m_settings.solver == Solver::eBarnesHut) {
+            m_barnes_hut = std::make_shared<galaxy::BarnesHut>(
+                m_gfx_core, *m_gpu_star_data, m_settings.opening_angle);
+        }
+        if (m_settings.solver == Solver::eParticleMesh) {
+            m_particle_mesh = std::make_shared<galaxy::ParticleMesh>(
+                m_gfx_core, *m_gpu_star_data, m_settings.pm_grid_size);
+        }
+        if (m_settings.solver == Solver::eDirect &&
+            m_settings.timestep_levels > 1) {
+            m_block_timesteps = std::make_shared<galaxy::BlockTimesteps>(
+                m_gfx_core, *m_gpu_star_data, m_settings.timestep_levels,
+                m_settings.timestep_accuracy);
+        }
+
+        if (m_settings.sort_every > 0) {
+            m_star_sort = std::make_shared<galaxy::StarSort>(
+                m_gfx_core, *m_gpu_star_data);
+        }
+
+        if (m_settings.renderer == Renderer::eBinned) {
+            m_binned_renderer = std::make_shared<galaxy::BinnedRenderer>(
+                m_gfx_core, *m_gpu_star_data, *m_draw_set_layout,
+                m_camera.push_constants().screen_dimensions,
+                m_settings.brightness_threshold,
+                m_settings.bin_entries_per_star);
+        }
+        // created whenever the device can rasterize, so R can switch to it
+        m_draw_sprites = m_settings.renderer == Renderer::eSprites;
+        if (m_gfx_core.has_rasterization()) {
+            m_sprite_renderer = std::make_shared<galaxy::SpriteRenderer>(
+                m_gfx_core, *m_gpu_star_data, *m_draw_set_layout,
+                m_camera.push_constants().screen_dimensions,
+                m_settings.brightness_threshold);
+        } else if (m_draw_sprites) {
+            throw std::runtime_error(
+                "the sprite renderer needs a graphics queue and dynamic "
+                "rendering");
+        }
+
+        /* FRAMES IN FLIGHT */
+        vk::raii::CommandBuffers frame_command_buffers(
+            *m_gfx_core.device(),
+            vk::CommandBufferAllocateInfo(*m_gfx_core.command_pool(),
+                                          vk::CommandBufferLevel::ePrimary,
+                                          m_settings.frames_in_flight));
+        for (auto& command_buffer : frame_command_buffers) {
+            m_frames.push_back(Frame{
+                .command_buffer = std::move(command_buffer),
+                .sim_command_buffer = nullptr,
+                .image_acquired = vk::raii::Semaphore(
+                    *m_gfx_core.device(), vk::SemaphoreCreateInfo()),
+                // signaled so the first wait on every frame returns at once
+                .in_flight = vk::raii::Fence(
+                    *m_gfx_core.device(),
+                    vk::FenceCreateInfo(vk::FenceCreateFlagBits::eSignaled)),
+            });
+        }
+        if (m_gfx_core.has_async_compute()) {
+            vk::raii::CommandBuffers sim_command_buffers(
+                *m_gfx_core.device(),
+                vk::CommandBufferAllocateInfo(
+                    *m_gfx_core.compute_command_pool(),
+                    vk::CommandBufferLevel::ePrimary,
+                    m_settings.frames_in_flight));
+            for (auto i = 0; i < m_frames.size(); i++) {
+                m_frames[i].sim_command_buffer =
+                    std::move(sim_command_buffers[i]);
+            }
+
+            // counts finished steps on either queue
+            vk::SemaphoreTypeCreateInfo timeline_create_info(
+                vk::SemaphoreType::eTimeline, 0);
+            m_sim_timeline = vk::raii::Semaphore(
+                *m_gfx_core.device(),
+                vk::SemaphoreCreateInfo({}, &timeline_create_info));
+            m_graphics_timeline = vk::raii::Semaphore(
+                *m_gfx_core.device(),
+                vk::SemaphoreCreateInfo({}, &timeline_create_info));
+        }
 
-        m_device_memories.push_back(std::move(device_memory));
-        m_image_acquired_semaphore = std::make_shared<vk::raii::Semaphore>(
-            *m_gfx_core.device(), vk::SemaphoreCreateInfo());
-        m_drawing_done_semaphore = std::make_shared<vk::raii::Semaphore>(
-            *m_gfx_core.device(), vk::SemaphoreCreateInfo());
-        m_fence = std::make_shared<vk::raii::Fence>(*m_gfx_core.device(),
-                                                    vk::FenceCreateInfo());
+        if (m_gfx_core.headless()) {
+            vk::Extent2D extent = m_gfx_core.extent();
+            vk::DeviceSize frame_size = 4 * extent.width * extent.height;
+            for (auto& frame : m_frames) {
+                // cached memory makes reading the frame back on the host fast
+                std::tie(frame.readback_buffer, frame.readback_memory) =
+                    m_gfx_core.allocator()->create_buffer(
+                        vk::BufferCreateInfo(
+                            {}, frame_size,
+                            vk::BufferUsageFlagBits::eTransferDst),
+                        vk::MemoryPropertyFlagBits::eHostVisible |
+                            vk::MemoryPropertyFlagBits::eHostCoherent,
+                        vk::MemoryPropertyFlagBits::eHostCached);
+                frame.readback_data =
+                    static_cast<uint8_t const*>(frame.readback_memory.mapped());
+            }
+            if (!m_settings.output_path.empty()) {
+                m_frame_writer = std::make_shared<galaxy::FrameWriter>(
+                    m_settings.output_path, m_settings.output_format,
+                    extent.width, extent.height, m_settings.fps);
+            }
+        }
+
+        // one slot per frame in flight lets every frame record a snapshot
+        m_snapshot_writer = std::make_shared<galaxy::SnapshotWriter>(
+            m_gfx_core, *m_gpu_star_data, m_settings.frames_in_flight);
+        if (!m_settings.trajectory_path.empty()) {
+            // one slot more than frames in flight keeps recording while the
+            // worker still encodes an older frame
+            m_trajectory_writer = std::make_shared<galaxy::TrajectoryWriter>(
+                m_gfx_core, *m_gpu_star_data, m_settings.trajectory_path,
+                m_settings.frames_in_flight + 1,
+                m_star_sort ? *m_star_sort->star_ids() : vk::Buffer{});
+            // the starting positions are the first frame
+            m_trajectory_requested = true;
+        }
+        if (m_settings.diagnostics_every > 0) {
+            m_diagnostics = std::make_shared<galaxy::Diagnostics>(
+                m_gfx_core, *m_gpu_star_data, m_settings.frames_in_flight + 1);
+            // the drift is measured from the starting state
+            m_diagnostics_requested = true;
+        }
+
+        m_gfx_core.report_pipeline_creation();
+
+        if (m_settings.profile) {
+            m_profiler = std::make_shared<gfx::Profiler>(
+                m_gfx_core, m_settings.frames_in_flight,
+                m_settings.profile_window);
+        }
+
+        // present waits on these, so there is one per swapchain image rather
+        // than per frame
+        for (auto i = 0; i < m_gfx_core.swapchain_images().size(); i++) {
+            m_render_finished_semaphores.emplace_back(
+                *m_gfx_core.device(), vk::SemaphoreCreateInfo());
+        }
 
     } catch (vk::SystemError& err) {
         std::cout << "vk::SystemError: " << err.what() << std::endl;
@@ -199,42 +394,104 @@ void Galaxy::init_gfx() {
 }
 
 void Galaxy::init_star_data() {
-    galaxy::StarData star_data;
-    for (auto i = 0; i < STAR_COUNT; i++) {
-        Star random_star;
-
-        std::random_device r;
-        std::default_random_engine e1(r());
-        // tint
-        std::uniform_real_distribution<float> tint_dist(0.0, 1.0);
-        glm::vec3 tint(tint_dist(e1), tint_dist(e1), tint_dist(e1));
-        random_star.tint = tint;
-
-        // position (only x and y)
-        std::uniform_real_distribution<float> pos_dist(-10.0, 10.0);
-        glm::vec3 pos(pos_dist(e1), pos_dist(e1), pos_dist(e1));
-        random_star.position = pos * 3000000000.0f;
-
-        // weight
-        std::uniform_real_distribution<float> weight_dist(
-            pow(18.0, 8.0), 2.0 * pow(10.0, 20.0));
-        random_star.weight = weight_dist(e1);
+    if (!m_settings.restore_path.empty()) {
+        m_gpu_star_data = load_snapshot(m_gfx_core, m_settings.restore_path,
+                                        m_positions_index);
+        m_settings.star_count = m_gpu_star_data->star_count();
+        return;
+    }
+    if (!m_settings.catalog_path.empty()) {
+        m_gpu_star_data = load_catalog(m_gfx_core, m_settings.catalog_path);
+        m_settings.star_count = m_gpu_star_data->star_count();
+        return;
+    }
 
-        star_data.push(random_star);
+    if (m_settings.auto_star_count) {
+        // a quarter of what is left keeps room for the driver and other
+        // processes
+        vk::DeviceSize budget =
+            m_gfx_core.allocator()->device_local_available() / 4;
+        vk::DeviceSize star_count =
+            std::min<vk::DeviceSize>(budget / BYTES_PER_STAR, UINT32_MAX);
+        m_settings.star_count =
+            std::max<uint32_t>(1024, star_count / 1024 * 1024);
+        printf("--stars auto: simulating %u stars\n", m_settings.star_count);
     }
 
     m_gpu_star_data = std::make_shared<galaxy::GPUStarData>(
-        *m_gfx_core.device(), *m_gfx_core.physical_device(),
-        (*m_gfx_core.command_buffers()).front(), *m_gfx_core.graphics_queue(),
-        star_data);
+        m_gfx_core, m_settings.star_count);
+
+    galaxy::InitialConditions initial_conditions(m_gfx_core, *m_gpu_star_data);
+    auto start = std::chrono::steady_clock::now();
+    vk::raii::CommandBuffers command_buffers(
+        *m_gfx_core.device(),
+        vk::CommandBufferAllocateInfo(*m_gfx_core.command_pool(),
+                                      vk::CommandBufferLevel::ePrimary, 1));
+    vk::raii::CommandBuffer& command_buffer = command_buffers.front();
+    command_buffer.begin(vk::CommandBufferBeginInfo(
+        vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+    initial_conditions.record(command_buffer, m_settings.initial_model,
+                              m_settings.seed, m_settings.model_radius,
+                              m_settings.star_mass);
+    command_buffer.end();
+    m_gfx_core.graphics_queue()->submit(
+        vk::SubmitInfo({}, {}, *command_buffer));
+    m_gfx_core.graphics_queue()->waitIdle();
+    printf("generated %u stars in %.2f ms\n", m_settings.star_count,
+           std::chrono::duration<double, std::milli>(
+               std::chrono::steady_clock::now() - start)
+               .count());
 }
 
 void Galaxy::run() {
     try {
         m_gfx_core.upload_uniform_buffer(glm::vec3(1.0, 0.0, 0.0));
-        while (!m_gfx_core.should_close()) {
+        m_gpu_star_data->wait_for_upload();
+        fast_forward(m_settings.fast_forward_steps);
+        m_last_update = std::chrono::steady_clock::now();
+        auto start = m_last_update;
+        while (m_gfx_core.headless()
+                   ? m_frame_count < m_settings.frame_count
+                   : !m_gfx_core.should_close()) {
+            if (m_fast_forward_requested) {
+                m_fast_forward_requested = false;
+                fast_forward(m_settings.fast_forward_steps);
+                // the time spent fast-forwarding is not owed to the sim
+                m_last_update = std::chrono::steady_clock::now();
+            }
             this->update();
         }
+        if (m_gfx_core.headless()) {
+            finish_readbacks();
+            double seconds = std::chrono::duration<double>(
+                                 std::chrono::steady_clock::now() - start)
+                                 .count();
+            printf("rendered %llu frames in %.2f s (%.1f fps)\n",
+                   static_cast<unsigned long long>(m_frame_count), seconds,
+                   m_frame_count / seconds);
+        }
+        if (!m_settings.snapshot_prefix.empty()) {
+            m_gfx_core.device()->waitIdle();
+            m_snapshot_writer->save(m_positions_index % 2, m_positions_index,
+                                    snapshot_path(m_positions_index));
+        }
+        m_snapshot_writer->finish();
+        if (m_trajectory_writer) {
+            m_trajectory_writer->finish();
+        }
+        if (m_diagnostics) {
+            // the samples of the frames still in flight
+            m_gfx_core.device()->waitIdle();
+            for (DiagnosticsSample const& sample : m_diagnostics->poll()) {
+                print_diagnostics(sample);
+            }
+        }
+        if (m_profiler) {
+            m_profiler->print_report();
+            if (!m_settings.profile_json.empty()) {
+                m_profiler->write_json(m_settings.profile_json);
+            }
+        }
     } catch (vk::SystemError& err) {
         std::cout << "vk::SystemError: " << err.what() << std::endl;
         exit(-1);
@@ -246,55 +503,366 @@ void Galaxy::run() {
         exit(-1);
     }
 }
+void Galaxy::record_sim(vk::raii::CommandBuffer const& command_buffer,
+                        uint32_t read_buffer_index) {
+    if (m_barnes_hut) {
+        m_barnes_hut->record(command_buffer, read_buffer_index);
+        return;
+    }
+    if (m_particle_mesh) {
+        m_particle_mesh->record(command_buffer, read_buffer_index);
+        return;
+    }
+    if (m_block_timesteps) {
+        m_block_timesteps->record(command_buffer, read_buffer_index);
+        return;
+    }
+
+    uint32_t star_count = m_gpu_star_data->star_count();
+    PushConstants push_constants = m_camera.push_constants();
+    push_constants.positions_index = read_buffer_index;
+    push_constants.star_count = star_count;
+
+    command_buffer.pushConstants<PushConstants>(
+        *m_sim_pipeline_layout, vk::ShaderStageFlagBits::eCompute, 0,
+        {push_constants});
+    command_buffer.bindDescriptorSets(
+        vk::PipelineBindPoint::eCompute, *m_sim_pipeline_layout, 0,
+        {(*m_draw_descriptor_sets).front(),
+         m_gpu_star_data->descriptor_sets().front()},
+        nullptr);
+    if (m_sim_tiled_pipeline) {
+        command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                                    *m_sim_tiled_pipeline);
+        command_buffer.dispatch(
+            (star_count + m_settings.tile_size - 1) / m_settings.tile_size, 1,
+            1);
+    } else {
+        command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                                    *m_sim_pipeline);
+        command_buffer.dispatch(
+            (star_count + STAR_WORKGROUP_SIZE - 1) / STAR_WORKGROUP_SIZE, 1,
+            1);
+    }
+}
+
+void Galaxy::record_steps(vk::raii::CommandBuffer const& command_buffer,
+                          uint64_t first_step, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        if (i > 0) {
+            gfx::util::compute_barrier(command_buffer);
+        }
+        if (sort_due(first_step + i)) {
+            m_star_sort->record(command_buffer, (first_step + i) % 2);
+            gfx::util::compute_barrier(command_buffer);
+        }
+        record_sim(command_buffer, (first_step + i) % 2);
+    }
+}
+
+bool Galaxy::sort_due(uint64_t step) const {
+    return m_star_sort && step % m_settings.sort_every == 0;
+}
+
+uint32_t Galaxy::take_steps() {
+    if (m_settings.steps_per_second == 0) {
+        return 1;
+    }
+    if (m_gfx_core.headless()) {
+        // Output time, not wall time: every frame advances the simulation by
+        // exactly 1 / fps, however long it takes to render.
+        uint64_t rate = m_settings.steps_per_second;
+        return (m_frame_count + 1) * rate / m_settings.fps -
+               m_frame_count * rate / m_settings.fps;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    m_accumulator += std::chrono::duration<double>(now - m_last_update).count();
+    m_last_update = now;
+
+    double step_duration = 1.0 / m_settings.steps_per_second;
+    uint32_t steps = static_cast<uint32_t>(m_accumulator / step_duration);
+    if (steps > m_settings.max_substeps) {
+        // The GPU can't keep up. Catching up would only make the next frame
+        // slower still, so the sim slows down instead.
+        steps = m_settings.max_substeps;
+        m_accumulator = 0.0;
+    } else {
+        m_accumulator -= steps * step_duration;
+    }
+    return steps;
+}
+
+void Galaxy::finish_readbacks() {
+    // slots are used round robin, so the oldest frame sits at m_frame_index
+    for (auto i = 0; i < m_frames.size(); i++) {
+        Frame& frame = m_frames[(m_frame_index + i) % m_frames.size()];
+        while (m_gfx_core.device()->waitForFences(
+                   {*frame.in_flight}, true, gfx::util::TIMEOUT) ==
+               vk::Result::eTimeout);
+        if (frame.readback_pending && m_frame_writer) {
+            m_frame_writer->write(frame.readback_data);
+        }
+        frame.readback_pending = false;
+    }
+}
+
+std::string Galaxy::snapshot_path(uint64_t step) {
+    std::string prefix = m_settings.snapshot_prefix.empty()
+                             ? "snapshot"
+                             : m_settings.snapshot_prefix;
+    return std::format("{}-{:010}.gsnap", prefix, step);
+}
+
+void Galaxy::fast_forward(uint32_t steps) {
+    if (steps == 0) {
+        return;
+    }
+    m_gfx_core.device()->waitIdle();
+    auto start = std::chrono::steady_clock::now();
+
+    vk::CommandBufferAllocateInfo allocate_info(
+        *m_gfx_core.command_pool(), vk::CommandBufferLevel::ePrimary, 1);
+
+    uint32_t batch_count = steps / FAST_FORWARD_BATCH;
+    uint32_t remaining_steps = steps % FAST_FORWARD_BATCH;
+
+    // The sorts of a batch are all set by the step of its first sort, so a
+    // recording can be resubmitted for every batch whose first sort falls
+    // on the same step of the batch. Without sorting that is all of them.
+    auto first_sort = [&](uint64_t first_step) -> uint64_t {
+        if (!m_star_sort) {
+            return FAST_FORWARD_BATCH;
+        }
+        uint64_t every = m_settings.sort_every;
+        return std::min<uint64_t>((every - first_step % every) % every,
+                                  FAST_FORWARD_BATCH);
+    };
+    std::map<uint64_t, vk::raii::CommandBuffer> batches;
+    for (uint32_t i = 0; i < batch_count; i++) {
+        uint64_t first_step =
+            m_positions_index + static_cast<uint64_t>(i) * FAST_FORWARD_BATCH;
+        auto batch = batches.find(first_sort(first_step));
+        if (batch == batches.end()) {
+            vk::raii::CommandBuffers allocated(*m_gfx_core.device(),
+                                               allocate_info);
+            batch = batches
+                        .emplace(first_sort(first_step),
+                                 std::move(allocated.front()))
+                        .first;
+            batch->second.begin(vk::CommandBufferBeginInfo(
+                vk::CommandBufferUsageFlagBits::eSimultaneousUse));
+            gfx::util::compute_barrier(batch->second);
+            record_steps(batch->second, first_step, FAST_FORWARD_BATCH);
+            batch->second.end();
+        }
+        m_gfx_core.graphics_queue()->submit(
+            vk::SubmitInfo({}, {}, *batch->second));
+    }
+
+    vk::raii::CommandBuffers rest(*m_gfx_core.device(), allocate_info);
+    if (remaining_steps > 0) {
+        rest.front().begin(vk::CommandBufferBeginInfo(
+            vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+        gfx::util::compute_barrier(rest.front());
+        record_steps(rest.front(),
+                     m_positions_index + static_cast<uint64_t>(batch_count) *
+                                             FAST_FORWARD_BATCH,
+                     remaining_steps);
+        rest.front().end();
+        m_gfx_core.graphics_queue()->submit(
+            vk::SubmitInfo({}, {}, *rest.front()));
+    }
+
+    m_gfx_core.graphics_queue()->waitIdle();
+    m_positions_index += steps;
+
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+    printf("fast-forwarded %u steps in %.1f ms (%.0f steps/s)\n", steps,
+           seconds * 1000.0, steps / seconds);
+}
+
+void Galaxy::record_present_copy(
+    vk::raii::CommandBuffer const& command_buffer) {
+    vk::ImageSubresourceLayers image_subresource_layers(
+        vk::ImageAspectFlagBits::eColor, 0, 0, 1);
+
+    // The swapchain image is only touched from here on, so the submission
+    // waits for the acquire at the transfer stage and the simulation and
+    // draw work recorded before can start before the image is available.
+    vk::ImageMemoryBarrier2 acquire_barrier(
+        vk::PipelineStageFlagBits2::eTransfer, {},
+        vk::PipelineStageFlagBits2::eTransfer,
+        vk::AccessFlagBits2::eTransferWrite, vk::ImageLayout::eUndefined,
+        vk::ImageLayout::eTransferDstOptimal, VK_QUEUE_FAMILY_IGNORED,
+        VK_QUEUE_FAMILY_IGNORED, m_gfx_core.swapchain_images()[m_image_index],
+        vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1));
+    command_buffer.pipelineBarrier2(
+        vk::DependencyInfo({}, {}, {}, acquire_barrier));
+
+    vk::ImageCopy image_copy(image_subresource_layers, vk::Offset3D(),
+                             image_subresource_layers, vk::Offset3D(0, 0, 0),
+                             vk::Extent3D(640, 480, 1));
+
+    command_buffer.copyImage(*m_intermediate_image,
+                             vk::ImageLayout::eTransferSrcOptimal,
+                             m_gfx_core.swapchain_images()[m_image_index],
+                             vk::ImageLayout::eTransferDstOptimal, image_copy);
+
+    vk::ImageMemoryBarrier pre_present_barrier(
+        vk::AccessFlagBits::eTransferWrite, {},
+        vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::ePresentSrcKHR,
+        VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED,
+        m_gfx_core.swapchain_images()[m_image_index],
+        vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1));
+
+    command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                                   vk::PipelineStageFlagBits::eBottomOfPipe,
+                                   {}, nullptr, nullptr, pre_present_barrier);
+}
+
 void Galaxy::update() {
+    Frame& frame = m_frames[m_frame_index];
+
+    // only wait for the frame that last used this slot, the others keep
+    // running on the GPU while this one is recorded
+    while (m_gfx_core.device()->waitForFences(
+               {*frame.in_flight}, true, gfx::util::TIMEOUT) ==
+           vk::Result::eTimeout);
+    // before the reset, a snapshot or trajectory frame this slot recorded
+    // last time is done
+    m_snapshot_writer->poll();
+    if (m_trajectory_writer) {
+        m_trajectory_writer->poll();
+    }
+    if (m_diagnostics) {
+        for (DiagnosticsSample const& sample : m_diagnostics->poll()) {
+            print_diagnostics(sample);
+        }
+    }
+    if (m_binned_renderer) {
+        m_binned_renderer->fit_bin_entries();
+    }
+    m_gfx_core.device()->resetFences({*frame.in_flight});
+    if (m_profiler) {
+        m_profiler->begin_frame(m_frame_index);
+    }
+
+    // the frame this slot rendered last time is complete now, writing it
+    // out here keeps frames_in_flight - 1 others rendering meanwhile
+    if (frame.readback_pending) {
+        if (m_frame_writer) {
+            m_frame_writer->write(frame.readback_data);
+        }
+        frame.readback_pending = false;
+    }
+
     vk::Result result;
-    std::tie(result, m_image_index) = m_gfx_core.swapchain()->acquireNextImage(
-        gfx::util::TIMEOUT, *m_image_acquired_semaphore);
-    if (result != vk::Result::eSuccess) {
-        printf("bad result: %i\n", static_cast<uint32_t>(result));
-        exit(static_cast<uint32_t>(result));
+    if (!m_gfx_core.headless()) {
+        auto acquire_start = std::chrono::steady_clock::now();
+        std::tie(result, m_image_index) =
+            m_gfx_core.swapchain()->acquireNextImage(gfx::util::TIMEOUT,
+                                                     *frame.image_acquired);
+        if (m_profiler) {
+            m_profiler->add_cpu_sample(
+                "acquire", std::chrono::duration<double, std::milli>(
+                               std::chrono::steady_clock::now() - acquire_start)
+                               .count());
+        }
+        if (result != vk::Result::eSuccess) {
+            printf("bad result: %i\n", static_cast<uint32_t>(result));
+            exit(static_cast<uint32_t>(result));
+        }
+        assert(m_image_index < m_gfx_core.swapchain_images().size());
     }
-    assert(m_image_index < m_gfx_core.swapchain_images().size());
     m_gfx_core.update();
 
-    uint32_t read_buffer_index = m_positions_index % 2;
-    uint32_t write_buffer_index = (m_positions_index + 1) % 2;
+    uint32_t step_count = take_steps();
+    // the buffer holding the positions after this frame's steps
+    uint32_t latest_buffer_index = (m_positions_index + step_count) % 2;
 
-    (*m_gfx_core.command_buffers())
-        .front()
-        .begin(vk::CommandBufferBeginInfo(
+    if (m_gfx_core.has_async_compute() && step_count > 0) {
+        vk::raii::CommandBuffer& sim_command_buffer = frame.sim_command_buffer;
+        sim_command_buffer.reset();
+        sim_command_buffer.begin(vk::CommandBufferBeginInfo(
             vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+        // orders this step after the previous one on the compute queue
+        gfx::util::compute_barrier(sim_command_buffer);
+        if (m_profiler) {
+            m_profiler->begin(sim_command_buffer, "sim");
+        }
+        record_steps(sim_command_buffer, m_positions_index, step_count);
+        if (m_profiler) {
+            m_profiler->end(sim_command_buffer);
+        }
+        sim_command_buffer.end();
+
+        // A single step only overwrites the position buffer that frames
+        // before the previous one drew from, so the previous frame can still
+        // be drawing and presenting. More steps write both buffers and have
+        // to wait for it, and so does sorting, which moves the tints it
+        // draws with, and any step after a frame that reads the velocities.
+        bool sorts = false;
+        for (uint32_t i = 0; i < step_count; i++) {
+            sorts = sorts || sort_due(m_positions_index + i);
+        }
+        uint64_t wait_value = m_frame_count;
+        if (step_count == 1 && !sorts && !m_velocities_read) {
+            wait_value = m_frame_count == 0 ? 0 : m_frame_count - 1;
+        }
+        vk::SemaphoreSubmitInfo wait_graphics(
+            *m_graphics_timeline, wait_value,
+            vk::PipelineStageFlagBits2::eComputeShader);
+        vk::CommandBufferSubmitInfo sim_command_buffer_info(
+            *sim_command_buffer);
+        vk::SemaphoreSubmitInfo signal_sim(
+            *m_sim_timeline, m_frame_count + 1,
+            vk::PipelineStageFlagBits2::eComputeShader);
+        m_gfx_core.compute_queue()->submit2(vk::SubmitInfo2(
+            {}, wait_graphics, sim_command_buffer_info, signal_sim));
+    }
+
+    vk::raii::CommandBuffer& command_buffer = frame.command_buffer;
+    command_buffer.reset();
+    command_buffer.begin(vk::CommandBufferBeginInfo(
+        vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+
+    // Frames share the star buffers and the intermediate image. The frame
+    // submitted before this one may still be executing, so its writes (the
+    // positions this step reads) and reads (the buffer this step overwrites)
+    // have to complete first. Queue submission order makes this barrier
+    // cover the previous submission.
+    vk::MemoryBarrier2 previous_frame_barrier(
+        vk::PipelineStageFlagBits2::eAllCommands,
+        vk::AccessFlagBits2::eMemoryWrite,
+        vk::PipelineStageFlagBits2::eAllCommands,
+        vk::AccessFlagBits2::eMemoryRead | vk::AccessFlagBits2::eMemoryWrite);
+    command_buffer.pipelineBarrier2(
+        vk::DependencyInfo({}, previous_frame_barrier, {}, {}));
 
-    gfx::util::set_image_layout((*m_gfx_core.command_buffers()).front(),
-                                m_gfx_core.swapchain_images()[m_image_index],
+    gfx::util::set_image_layout(command_buffer, *m_intermediate_image,
                                 m_gfx_core.swapchain_format(),
                                 vk::ImageLayout::eUndefined,
-                                vk::ImageLayout::eTransferDstOptimal);
+                                vk::ImageLayout::eGeneral);
 
-    gfx::util::set_image_layout(
-        (*m_gfx_core.command_buffers()).front(), *m_intermediate_image,
-        m_gfx_core.swapchain_format(), vk::ImageLayout::eUndefined,
-        vk::ImageLayout::eGeneral);
+    if (!m_gfx_core.has_async_compute() && step_count > 0) {
+        if (m_profiler) {
+            m_profiler->begin(command_buffer, "sim");
+        }
+        record_steps(command_buffer, m_positions_index, step_count);
+        if (m_profiler) {
+            m_profiler->end(command_buffer);
+        }
+    }
 
-    PushConstants push_constants = m_camera.push_constants();
-    push_constants.positions_index = read_buffer_index;
+    uint32_t star_count = m_gpu_star_data->star_count();
+    uint32_t star_group_count =
+        (star_count + STAR_WORKGROUP_SIZE - 1) / STAR_WORKGROUP_SIZE;
 
-    (*m_gfx_core.command_buffers())
-        .front()
-        .pushConstants<PushConstants>(*m_sim_pipeline_layout,
-                                      vk::ShaderStageFlagBits::eCompute, 0,
-                                      {push_constants});
-    (*m_gfx_core.command_buffers())
-        .front()
-        .bindPipeline(vk::PipelineBindPoint::eCompute, *m_sim_pipeline);
-    (*m_gfx_core.command_buffers())
-        .front()
-        .bindDescriptorSets(vk::PipelineBindPoint::eCompute,
-                            *m_sim_pipeline_layout, 0,
-                            {(*m_draw_descriptor_sets).front(),
-                             m_gpu_star_data->descriptor_sets().front()},
-                            nullptr);
-    (*m_gfx_core.command_buffers()).front().dispatch(STAR_COUNT / 32, 1, 1);
+    PushConstants push_constants = m_camera.push_constants();
+    push_constants.star_count = star_count;
 
     vk::BufferMemoryBarrier2KHR sim_to_calc_positions_barrier(
         vk::PipelineStageFlagBits2::eComputeShader,
@@ -302,7 +870,7 @@ void Galaxy::update() {
         vk::PipelineStageFlagBits2::eComputeShader,
         vk::AccessFlagBits2::eShaderRead, m_gfx_core.present_family_index(),
         m_gfx_core.present_family_index(),
-        m_gpu_star_data->positions()[write_buffer_index], 0, vk::WholeSize);
+        m_gpu_star_data->positions()[latest_buffer_index], 0, vk::WholeSize);
 
     vk::BufferMemoryBarrier2KHR calc_coords_write_barrier(
         vk::PipelineStageFlagBits2::eComputeShader,
@@ -313,121 +881,227 @@ void Galaxy::update() {
         m_gfx_core.present_family_index(), m_gpu_star_data->coords(), 0,
         vk::WholeSize);
 
+    // the previous frame's draw may still read the visible count
+    vk::MemoryBarrier2 draw_to_clear_barrier(
+        vk::PipelineStageFlagBits2::eComputeShader |
+            vk::PipelineStageFlagBits2::eDrawIndirect,
+        {}, vk::PipelineStageFlagBits2::eTransfer,
+        vk::AccessFlagBits2::eTransferWrite);
+    command_buffer.pipelineBarrier2(
+        vk::DependencyInfo({}, draw_to_clear_barrier, {}, {}));
+    command_buffer.fillBuffer(*m_gpu_star_data->visible_arguments(), 0,
+                              vk::WholeSize, 0);
+
+    vk::BufferMemoryBarrier2KHR clear_to_calc_visible_barrier(
+        vk::PipelineStageFlagBits2::eTransfer,
+        vk::AccessFlagBits2::eTransferWrite,
+        vk::PipelineStageFlagBits2::eComputeShader,
+        vk::AccessFlagBits2::eShaderRead | vk::AccessFlagBits2::eShaderWrite,
+        m_gfx_core.present_family_index(), m_gfx_core.present_family_index(),
+        m_gpu_star_data->visible_arguments(), 0, vk::WholeSize);
+
     std::vector<vk::BufferMemoryBarrier2KHR> buffers_to_sync = {
-        sim_to_calc_positions_barrier, calc_coords_write_barrier};
+        sim_to_calc_positions_barrier, calc_coords_write_barrier,
+        clear_to_calc_visible_barrier};
 
     vk::DependencyInfoKHR sim_calc_coords_dependency({}, {}, buffers_to_sync,
                                                      {});
-    (*m_gfx_core.command_buffers())
-        .front()
-        .pipelineBarrier2(sim_calc_coords_dependency);
+    command_buffer.pipelineBarrier2(sim_calc_coords_dependency);
 
     push_constants.positions_index =
-        write_buffer_index;  // ***CRITICAL: Must read the recently written
-                             // positions***
-    (*m_gfx_core.command_buffers())
-        .front()
-        .pushConstants<PushConstants>(*m_calc_coords_pipeline_layout,
-                                      vk::ShaderStageFlagBits::eCompute, 0,
-                                      {push_constants});
-
-    (*m_gfx_core.command_buffers())
-        .front()
-        .bindPipeline(vk::PipelineBindPoint::eCompute, *m_calc_coords_pipeline);
-
-    (*m_gfx_core.command_buffers())
-        .front()
-        .bindDescriptorSets(vk::PipelineBindPoint::eCompute,
-                            *m_calc_coords_pipeline_layout, 0,
-                            {(*m_draw_descriptor_sets).front(),
-                             m_gpu_star_data->descriptor_sets().front()},
-                            nullptr);
-    (*m_gfx_core.command_buffers()).front().dispatch(STAR_COUNT / 32, 1, 1);
-
-    vk::BufferMemoryBarrier2KHR calc_to_draw_coords_barrier(
-        vk::PipelineStageFlagBits2::eComputeShader,
-        vk::AccessFlagBits2::eShaderWrite,
-        vk::PipelineStageFlagBits2::eComputeShader,
-        vk::AccessFlagBits2::eShaderRead, m_gfx_core.present_family_index(),
-        m_gfx_core.present_family_index(), m_gpu_star_data->coords(), 0,
-        vk::WholeSize);  // m_gpu_star_data->coords() is the screen position
-                         // buffer
-
-    vk::DependencyInfoKHR calc_draw_dependency({}, {},
-                                               calc_to_draw_coords_barrier, {});
-    (*m_gfx_core.command_buffers())
-        .front()
-        .pipelineBarrier2(calc_draw_dependency);
-
-    (*m_gfx_core.command_buffers())
-        .front()
-        .bindPipeline(vk::PipelineBindPoint::eCompute, *m_draw_pipeline);
-    (*m_gfx_core.command_buffers())
-        .front()
-        .bindDescriptorSets(vk::PipelineBindPoint::eCompute,
-                            *m_draw_pipeline_layout, 0,
-                            {(*m_draw_descriptor_sets).front(),
-                             m_gpu_star_data->descriptor_sets().front()},
-                            nullptr);
-    (*m_gfx_core.command_buffers()).front().dispatch(640 / 8, 480 / 8, 1);
+        latest_buffer_index;  // ***CRITICAL: Must read the recently written
+                              // positions***
+    command_buffer.pushConstants<PushConstants>(
+        *m_calc_coords_pipeline_layout, vk::ShaderStageFlagBits::eCompute, 0,
+        {push_constants});
 
-    vk::ImageSubresourceLayers image_subresource_layers(
-        vk::ImageAspectFlagBits::eColor, 0, 0, 1);
+    command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                                *m_calc_coords_pipeline);
 
-    gfx::util::set_image_layout(
-        (*m_gfx_core.command_buffers()).front(), *m_intermediate_image,
-        m_gfx_core.swapchain_format(), vk::ImageLayout::eUndefined,
-        vk::ImageLayout::eTransferSrcOptimal);
+    command_buffer.bindDescriptorSets(
+        vk::PipelineBindPoint::eCompute, *m_calc_coords_pipeline_layout, 0,
+        {(*m_draw_descriptor_sets).front(),
+         m_gpu_star_data->descriptor_sets().front()},
+        nullptr);
+    if (m_profiler) {
+        m_profiler->begin(command_buffer, "calc_coords");
+    }
+    command_buffer.dispatch(star_group_count, 1, 1);
+    gfx::util::compute_barrier(command_buffer);
+    command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                                *m_visible_arguments_pipeline);
+    command_buffer.dispatch(1, 1, 1);
+    if (m_profiler) {
+        m_profiler->end(command_buffer);
+    }
 
-    vk::ImageCopy image_copy(image_subresource_layers, vk::Offset3D(),
-                             image_subresource_layers, vk::Offset3D(0, 0, 0),
-                             vk::Extent3D(640, 480, 1));
+    // the screen coordinates, the visible list and the indirect arguments
+    // over it
+    gfx::util::indirect_barrier(command_buffer);
 
-    (*m_gfx_core.command_buffers())
-        .front()
-        .copyImage(*m_intermediate_image, vk::ImageLayout::eTransferSrcOptimal,
-                   m_gfx_core.swapchain_images()[m_image_index],
-                   vk::ImageLayout::eTransferDstOptimal, image_copy);
+    if (m_profiler) {
+        m_profiler->begin(command_buffer, "draw");
+    }
+    if (m_draw_sprites) {
+        m_sprite_renderer->record(command_buffer,
+                                  (*m_draw_descriptor_sets).front(),
+                                  latest_buffer_index);
+    } else if (m_binned_renderer) {
+        m_binned_renderer->record(command_buffer,
+                                  (*m_draw_descriptor_sets).front(),
+                                  latest_buffer_index);
+    } else {
+        command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                                    *m_draw_pipeline);
+        command_buffer.bindDescriptorSets(
+            vk::PipelineBindPoint::eCompute, *m_draw_pipeline_layout, 0,
+            {(*m_draw_descriptor_sets).front(),
+             m_gpu_star_data->descriptor_sets().front()},
+            nullptr);
+        command_buffer.dispatch(640 / 8, 480 / 8, 1);
+    }
+    if (m_profiler) {
+        m_profiler->end(command_buffer);
+    }
 
-    vk::ImageMemoryBarrier pre_present_barrier(
-        vk::AccessFlagBits::eTransferWrite, {},
-        vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::ePresentSrcKHR,
-        VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED,
-        m_gfx_core.swapchain_images()[m_image_index],
+    vk::ImageSubresourceLayers image_subresource_layers(
+        vk::ImageAspectFlagBits::eColor, 0, 0, 1);
+
+    // from general, the draw pass wrote the image and the copy has to see it
+    vk::ImageMemoryBarrier2 draw_to_copy_barrier(
+        vk::PipelineStageFlagBits2::eComputeShader,
+        vk::AccessFlagBits2::eShaderWrite, vk::PipelineStageFlagBits2::eTransfer,
+        vk::AccessFlagBits2::eTransferRead, vk::ImageLayout::eGeneral,
+        vk::ImageLayout::eTransferSrcOptimal, VK_QUEUE_FAMILY_IGNORED,
+        VK_QUEUE_FAMILY_IGNORED, *m_intermediate_image,
         vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1));
+    command_buffer.pipelineBarrier2(
+        vk::DependencyInfo({}, {}, {}, draw_to_copy_barrier));
+
+    if (m_profiler) {
+        m_profiler->begin(command_buffer, "copy");
+    }
+    if (m_gfx_core.headless()) {
+        vk::BufferImageCopy readback_copy(0, 0, 0, image_subresource_layers,
+                                          vk::Offset3D(0, 0, 0),
+                                          vk::Extent3D(m_gfx_core.extent(), 1));
+        command_buffer.copyImageToBuffer(*m_intermediate_image,
+                                         vk::ImageLayout::eTransferSrcOptimal,
+                                         *frame.readback_buffer, readback_copy);
+        vk::MemoryBarrier2 readback_barrier(
+            vk::PipelineStageFlagBits2::eTransfer,
+            vk::AccessFlagBits2::eTransferWrite,
+            vk::PipelineStageFlagBits2::eHost, vk::AccessFlagBits2::eHostRead);
+        command_buffer.pipelineBarrier2(
+            vk::DependencyInfo({}, readback_barrier, {}, {}));
+        frame.readback_pending = true;
+    } else {
+        record_present_copy(command_buffer);
+    }
+    if (m_profiler) {
+        m_profiler->end(command_buffer);
+    }
 
-    (*m_gfx_core.command_buffers())
-        .front()
-        .pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
-                         vk::PipelineStageFlagBits::eTopOfPipe, {}, nullptr,
-                         nullptr, pre_present_barrier);
-    (*m_gfx_core.command_buffers()).front().end();
+    uint64_t step = m_positions_index + step_count;
+    if (m_settings.snapshot_every > 0 &&
+        step / m_settings.snapshot_every !=
+            m_positions_index / m_settings.snapshot_every) {
+        m_snapshot_requested = true;
+    }
+    m_velocities_read = false;
+    if (m_snapshot_requested) {
+        m_snapshot_requested = !m_snapshot_writer->record(
+            command_buffer, latest_buffer_index, step, snapshot_path(step),
+            *frame.in_flight);
+        m_velocities_read = !m_snapshot_requested;
+    }
+    if (m_trajectory_writer) {
+        if (step / m_settings.trajectory_every !=
+            m_positions_index / m_settings.trajectory_every) {
+            m_trajectory_requested = true;
+        }
+        if (m_trajectory_requested) {
+            m_trajectory_requested = !m_trajectory_writer->record(
+                command_buffer, latest_buffer_index, step, *frame.in_flight);
+        }
+    }
+    if (m_diagnostics) {
+        if (step / m_settings.diagnostics_every !=
+            m_positions_index / m_settings.diagnostics_every) {
+            m_diagnostics_requested = true;
+        }
+        if (m_diagnostics_requested) {
+            if (m_profiler) {
+                m_profiler->begin(command_buffer, "diagnostics");
+            }
+            m_diagnostics_requested = !m_diagnostics->record(
+                command_buffer, latest_buffer_index, step, *frame.in_flight);
+            if (m_profiler) {
+                m_profiler->end(command_buffer);
+            }
+            m_velocities_read = m_velocities_read || !m_diagnostics_requested;
+        }
+    }
+    command_buffer.end();
 
-    vk::PipelineStageFlags wait_destination_stage_mask(
-        vk::PipelineStageFlagBits::eColorAttachmentOutput);
-    vk::SubmitInfo submit_info(**m_image_acquired_semaphore,
-                               wait_destination_stage_mask,
-                               *(*m_gfx_core.command_buffers()).front());
-    m_gfx_core.graphics_queue()->submit(submit_info, **m_fence);
+    vk::Semaphore render_finished;
+    std::vector<vk::SemaphoreSubmitInfo> wait_semaphores;
+    std::vector<vk::SemaphoreSubmitInfo> signal_semaphores;
+    if (!m_gfx_core.headless()) {
+        render_finished = *m_render_finished_semaphores[m_image_index];
+        wait_semaphores.emplace_back(*frame.image_acquired, 0,
+                                     vk::PipelineStageFlagBits2::eTransfer);
+        signal_semaphores.emplace_back(
+            render_finished, 0, vk::PipelineStageFlagBits2::eAllCommands);
+    }
+    if (m_gfx_core.has_async_compute()) {
+        // the sprite renderer reads the stars from its vertex shader
+        vk::PipelineStageFlags2 sim_wait_stages =
+            m_sprite_renderer ? vk::PipelineStageFlagBits2::eComputeShader |
+                                    vk::PipelineStageFlagBits2::eVertexShader
+                              : vk::PipelineStageFlagBits2::eComputeShader;
+        if (step_count > 0) {
+            wait_semaphores.emplace_back(*m_sim_timeline, m_frame_count + 1,
+                                         sim_wait_stages);
+        }
+        signal_semaphores.emplace_back(
+            *m_graphics_timeline, m_frame_count + 1,
+            vk::PipelineStageFlagBits2::eAllCommands);
+    }
+    vk::CommandBufferSubmitInfo command_buffer_info(*command_buffer);
+    m_gfx_core.graphics_queue()->submit2(
+        vk::SubmitInfo2({}, wait_semaphores, command_buffer_info,
+                        signal_semaphores),
+        *frame.in_flight);
 
-    while (m_gfx_core.device()->waitForFences(
-               {*m_fence}, true, gfx::util::TIMEOUT) == vk::Result::eTimeout);
-    m_gfx_core.device()->resetFences({*m_fence});
-
-    vk::PresentInfoKHR present_info(nullptr, **m_gfx_core.swapchain(),
-                                    m_image_index);
-    result = m_gfx_core.present_queue()->presentKHR(present_info);
-    switch (result) {
-        case vk::Result::eSuccess:
-            break;
-        case vk::Result::eSuboptimalKHR:
-            printf(
-                "vk::Queue::presentKHR returned vk::Result::eSuboptimalKHR!\n");
-            break;
-        default:
-            assert(false);
+    if (!m_gfx_core.headless()) {
+        vk::PresentInfoKHR present_info(
+            render_finished, **m_gfx_core.swapchain(), m_image_index);
+        auto present_start = std::chrono::steady_clock::now();
+        result = m_gfx_core.present_queue()->presentKHR(present_info);
+        if (m_profiler) {
+            m_profiler->add_cpu_sample(
+                "present", std::chrono::duration<double, std::milli>(
+                               std::chrono::steady_clock::now() - present_start)
+                               .count());
+        }
+        switch (result) {
+            case vk::Result::eSuccess:
+                break;
+            case vk::Result::eSuboptimalKHR:
+                printf(
+                    "vk::Queue::presentKHR returned "
+                    "vk::Result::eSuboptimalKHR!\n");
+                break;
+            default:
+                assert(false);
+        }
     }
-    m_gfx_core.device()->waitIdle();
-    m_positions_index += 1;
+    if (m_profiler) {
+        m_profiler->end_frame();
+    }
+    m_positions_index += step_count;
+    m_frame_count += 1;
+    m_frame_index = (m_frame_index + 1) % m_frames.size();
 }
 }  // namespace galaxy
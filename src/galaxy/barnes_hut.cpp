@@ -0,0 +1,147 @@
+#include "galaxy/barnes_hut.hpp"
+
+#include <algorithm>
+#include <array>
+#include <vulkan/vulkan_enums.hpp>
+#include <vulkan/vulkan_raii.hpp>
+#include <vulkan/vulkan_structs.hpp>
+
+#include "gfx/utils.hpp"
+
+// must match numthreads of the barnes_hut_*.slang kernels
+const static uint32_t WORKGROUP_SIZE = 256;
+// sizeof(Node) in barnes_hut.slangh under std430
+const static vk::DeviceSize NODE_SIZE = 48;
+
+namespace galaxy {
+BarnesHut::BarnesHut(gfx::Core& core, GPUStarData& star_data,
+                     float opening_angle)
+    : m_star_data(star_data),
+      m_radix_sort(core, star_data.star_count()),
+      m_opening_angle(opening_angle) {
+    vk::raii::Device& device = *core.device();
+
+    uint32_t star_count = star_data.star_count();
+    uint32_t node_count = 2 * star_count - 1;
+    uint32_t internal_count = std::max(star_count - 1, 1u);
+
+    std::tie(m_bounds, m_bounds_memory) = gfx::util::make_buffer(
+        *core.allocator(), sizeof(uint32_t) * 6,
+        vk::BufferUsageFlagBits::eStorageBuffer |
+            vk::BufferUsageFlagBits::eTransferDst,
+        vk::MemoryPropertyFlagBits::eDeviceLocal);
+    std::tie(m_nodes, m_nodes_memory) = gfx::util::make_buffer(
+        *core.allocator(), NODE_SIZE * node_count,
+        vk::BufferUsageFlagBits::eStorageBuffer,
+        vk::MemoryPropertyFlagBits::eDeviceLocal);
+    std::tie(m_parents, m_parents_memory) = gfx::util::make_buffer(
+        *core.allocator(), sizeof(uint32_t) * node_count,
+        vk::BufferUsageFlagBits::eStorageBuffer,
+        vk::MemoryPropertyFlagBits::eDeviceLocal);
+    std::tie(m_visits, m_visits_memory) = gfx::util::make_buffer(
+        *core.allocator(), sizeof(uint32_t) * internal_count,
+        vk::BufferUsageFlagBits::eStorageBuffer |
+            vk::BufferUsageFlagBits::eTransferDst,
+        vk::MemoryPropertyFlagBits::eDeviceLocal);
+
+    m_set_layout =
+        vk::raii::DescriptorSetLayout(gfx::util::make_descriptor_set_layout(
+            device, {{vk::DescriptorType::eStorageBuffer, 1,
+                      vk::ShaderStageFlagBits::eCompute},
+                     {vk::DescriptorType::eStorageBuffer, 1,
+                      vk::ShaderStageFlagBits::eCompute},
+                     {vk::DescriptorType::eStorageBuffer, 1,
+                      vk::ShaderStageFlagBits::eCompute},
+                     {vk::DescriptorType::eStorageBuffer, 1,
+                      vk::ShaderStageFlagBits::eCompute},
+                     {vk::DescriptorType::eStorageBuffer, 1,
+                      vk::ShaderStageFlagBits::eCompute},
+                     {vk::DescriptorType::eStorageBuffer, 1,
+                      vk::ShaderStageFlagBits::eCompute}}));
+
+    std::vector<vk::DescriptorPoolSize> pool_sizes = {
+        {vk::DescriptorType::eStorageBuffer, 6}};
+
+    vk::DescriptorPoolCreateInfo pool_create_info(
+        vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet, 1, pool_sizes);
+    m_descriptor_pool = vk::raii::DescriptorPool(device, pool_create_info);
+
+    vk::DescriptorSetAllocateInfo set_allocate_info(*m_descriptor_pool,
+                                                    *m_set_layout);
+    m_descriptor_sets = vk::raii::DescriptorSets(device, set_allocate_info);
+
+    // the radix sort's key/value buffers double as the Morton code and star
+    // index arrays of the tree
+    gfx::util::update_storage_buffer_descriptors(
+        device, m_descriptor_sets.front(),
+        {m_bounds, m_radix_sort.keys(), m_radix_sort.values(), m_nodes,
+         m_parents, m_visits});
+
+    std::array<vk::DescriptorSetLayout, 2> set_layouts = {
+        *m_set_layout, *star_data.descriptor_set_layout()};
+    vk::PushConstantRange push_constant_range(
+        vk::ShaderStageFlagBits::eCompute, 0, sizeof(PushConstants));
+    m_pipeline_layout = vk::raii::PipelineLayout(
+        device,
+        vk::PipelineLayoutCreateInfo({}, set_layouts, push_constant_range));
+
+    m_bounds_pipeline = core.create_compute_pipeline(
+        "./shaders/barnes_hut_bounds.slang.spirv", m_pipeline_layout);
+    m_morton_pipeline = core.create_compute_pipeline(
+        "./shaders/barnes_hut_morton.slang.spirv", m_pipeline_layout);
+    m_build_pipeline = core.create_compute_pipeline(
+        "./shaders/barnes_hut_build.slang.spirv", m_pipeline_layout);
+    m_summarize_pipeline = core.create_compute_pipeline(
+        "./shaders/barnes_hut_summarize.slang.spirv", m_pipeline_layout);
+    m_force_pipeline = core.create_compute_pipeline(
+        "./shaders/barnes_hut_force.slang.spirv", m_pipeline_layout);
+}
+
+BarnesHut::~BarnesHut() {}
+
+void BarnesHut::dispatch(vk::raii::CommandBuffer const& command_buffer,
+                         vk::raii::Pipeline const& pipeline) {
+    PushConstants push_constants{
+        .star_count = m_star_data.star_count(),
+        .positions_index = m_positions_index,
+        .opening_angle = m_opening_angle,
+    };
+
+    command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute, *pipeline);
+    command_buffer.bindDescriptorSets(
+        vk::PipelineBindPoint::eCompute, *m_pipeline_layout, 0,
+        {m_descriptor_sets.front(), m_star_data.descriptor_sets().front()},
+        nullptr);
+    command_buffer.pushConstants<PushConstants>(
+        *m_pipeline_layout, vk::ShaderStageFlagBits::eCompute, 0,
+        {push_constants});
+    command_buffer.dispatch(
+        (push_constants.star_count + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, 1,
+        1);
+}
+
+void BarnesHut::record(vk::raii::CommandBuffer const& command_buffer,
+                       uint32_t positions_index) {
+    m_positions_index = positions_index;
+
+    // bounds start out as an empty box, visit counters at zero
+    command_buffer.fillBuffer(*m_bounds, 0, sizeof(uint32_t) * 3, 0xFFFFFFFF);
+    command_buffer.fillBuffer(*m_bounds, sizeof(uint32_t) * 3,
+                              sizeof(uint32_t) * 3, 0);
+    command_buffer.fillBuffer(*m_visits, 0, vk::WholeSize, 0);
+    gfx::util::compute_barrier(command_buffer);
+
+    dispatch(command_buffer, m_bounds_pipeline);
+    gfx::util::compute_barrier(command_buffer);
+    dispatch(command_buffer, m_morton_pipeline);
+    gfx::util::compute_barrier(command_buffer);
+
+    m_radix_sort.record(command_buffer, m_star_data.star_count(), 30);
+
+    dispatch(command_buffer, m_build_pipeline);
+    gfx::util::compute_barrier(command_buffer);
+    dispatch(command_buffer, m_summarize_pipeline);
+    gfx::util::compute_barrier(command_buffer);
+    dispatch(command_buffer, m_force_pipeline);
+}
+}  // namespace galaxy
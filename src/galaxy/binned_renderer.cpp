@@ -0,0 +1,177 @@
+#include "galaxy/binned_renderer.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <vulkan/vulkan_enums.hpp>
+#include <vulkan/vulkan_raii.hpp>
+#include <vulkan/vulkan_structs.hpp>
+
+#include "gfx/utils.hpp"
+
+// must match binned.slangh
+const static uint32_t TILE_SIZE = 16;
+
+namespace galaxy {
+BinnedRenderer::BinnedRenderer(
+    gfx::Core& core, GPUStarData& star_data,
+    vk::raii::DescriptorSetLayout const& draw_set_layout,
+    glm::ivec2 screen_dimensions, float threshold, uint32_t entries_per_star)
+    : m_core(core), m_star_data(star_data) {
+    vk::raii::Device& device = *core.device();
+
+    m_push_constants = PushConstants{
+        .screen_dimensions = screen_dimensions,
+        .positions_index = 0,
+        .star_count = star_data.star_count(),
+        .tiles_x = (screen_dimensions.x + TILE_SIZE - 1) / TILE_SIZE,
+        .tiles_y = (screen_dimensions.y + TILE_SIZE - 1) / TILE_SIZE,
+        .capacity = star_data.star_count() * entries_per_star,
+        .threshold = threshold,
+    };
+    uint32_t tile_count = m_push_constants.tiles_x * m_push_constants.tiles_y;
+
+    std::tie(m_tile_counts, m_tile_counts_memory) = gfx::util::make_buffer(
+        *core.allocator(), sizeof(uint32_t) * tile_count,
+        vk::BufferUsageFlagBits::eStorageBuffer |
+            vk::BufferUsageFlagBits::eTransferDst,
+        vk::MemoryPropertyFlagBits::eDeviceLocal);
+    std::tie(m_tile_offsets, m_tile_offsets_memory) = gfx::util::make_buffer(
+        *core.allocator(), sizeof(uint32_t) * tile_count,
+        vk::BufferUsageFlagBits::eStorageBuffer,
+        vk::MemoryPropertyFlagBits::eDeviceLocal);
+    std::tie(m_tile_cursors, m_tile_cursors_memory) = gfx::util::make_buffer(
+        *core.allocator(), sizeof(uint32_t) * tile_count,
+        vk::BufferUsageFlagBits::eStorageBuffer |
+            vk::BufferUsageFlagBits::eTransferDst,
+        vk::MemoryPropertyFlagBits::eDeviceLocal);
+    std::tie(m_bin_demand, m_bin_demand_memory) = gfx::util::make_buffer(
+        *core.allocator(), sizeof(uint32_t),
+        vk::BufferUsageFlagBits::eStorageBuffer,
+        vk::MemoryPropertyFlagBits::eHostVisible |
+            vk::MemoryPropertyFlagBits::eHostCoherent);
+    // the allocator keeps host visible memory mapped
+    std::memset(m_bin_demand_memory.mapped(), 0, sizeof(uint32_t));
+
+    m_set_layout =
+        vk::raii::DescriptorSetLayout(gfx::util::make_descriptor_set_layout(
+            device, {{vk::DescriptorType::eStorageBuffer, 1,
+                      vk::ShaderStageFlagBits::eCompute},
+                     {vk::DescriptorType::eStorageBuffer, 1,
+                      vk::ShaderStageFlagBits::eCompute},
+                     {vk::DescriptorType::eStorageBuffer, 1,
+                      vk::ShaderStageFlagBits::eCompute},
+                     {vk::DescriptorType::eStorageBuffer, 1,
+                      vk::ShaderStageFlagBits::eCompute},
+                     {vk::DescriptorType::eStorageBuffer, 1,
+                      vk::ShaderStageFlagBits::eCompute}}));
+
+    std::vector<vk::DescriptorPoolSize> pool_sizes = {
+        {vk::DescriptorType::eStorageBuffer, 5}};
+
+    vk::DescriptorPoolCreateInfo pool_create_info(
+        vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet, 1, pool_sizes);
+    m_descriptor_pool = vk::raii::DescriptorPool(device, pool_create_info);
+
+    vk::DescriptorSetAllocateInfo set_allocate_info(*m_descriptor_pool,
+                                                    *m_set_layout);
+    m_descriptor_sets = vk::raii::DescriptorSets(device, set_allocate_info);
+    allocate_bin_entries();
+
+    std::array<vk::DescriptorSetLayout, 3> set_layouts = {
+        *draw_set_layout, *star_data.descriptor_set_layout(), *m_set_layout};
+    vk::PushConstantRange push_constant_range(
+        vk::ShaderStageFlagBits::eCompute, 0, sizeof(PushConstants));
+    m_pipeline_layout = vk::raii::PipelineLayout(
+        device,
+        vk::PipelineLayoutCreateInfo({}, set_layouts, push_constant_range));
+
+    m_count_pipeline = core.create_compute_pipeline(
+        "./shaders/bin_count.slang.spirv", m_pipeline_layout);
+    m_scan_pipeline = core.create_compute_pipeline(
+        "./shaders/bin_scan.slang.spirv", m_pipeline_layout);
+    m_scatter_pipeline = core.create_compute_pipeline(
+        "./shaders/bin_scatter.slang.spirv", m_pipeline_layout);
+    m_draw_pipeline = core.create_compute_pipeline(
+        "./shaders/draw_binned.slang.spirv", m_pipeline_layout);
+}
+
+BinnedRenderer::~BinnedRenderer() {}
+
+void BinnedRenderer::allocate_bin_entries() {
+    std::tie(m_bin_entries, m_bin_entries_memory) = gfx::util::make_buffer(
+        *m_core.allocator(),
+        sizeof(uint32_t) * static_cast<vk::DeviceSize>(
+                               m_push_constants.capacity),
+        vk::BufferUsageFlagBits::eStorageBuffer,
+        vk::MemoryPropertyFlagBits::eDeviceLocal);
+    gfx::util::update_storage_buffer_descriptors(
+        *m_core.device(), m_descriptor_sets.front(),
+        {m_tile_counts, m_tile_offsets, m_tile_cursors, m_bin_entries,
+         m_bin_demand});
+}
+
+void BinnedRenderer::fit_bin_entries() {
+    uint32_t demand;
+    std::memcpy(&demand, m_bin_demand_memory.mapped(), sizeof(demand));
+    if (demand <= m_push_constants.capacity) {
+        return;
+    }
+    printf("binned renderer: %u tile list entries needed, %u reserved, "
+           "stars were dropped; growing the lists\n",
+           demand, m_push_constants.capacity);
+    // frames in flight still use the old lists
+    m_core.device()->waitIdle();
+    m_push_constants.capacity = std::min<uint64_t>(
+        demand + demand / 4ull, std::numeric_limits<uint32_t>::max());
+    allocate_bin_entries();
+}
+
+void BinnedRenderer::record(vk::raii::CommandBuffer const& command_buffer,
+                            vk::DescriptorSet draw_set,
+                            uint32_t positions_index) {
+    m_push_constants.positions_index = positions_index;
+
+    command_buffer.fillBuffer(*m_tile_counts, 0, vk::WholeSize, 0);
+    command_buffer.fillBuffer(*m_tile_cursors, 0, vk::WholeSize, 0);
+    gfx::util::compute_barrier(command_buffer);
+
+    command_buffer.bindDescriptorSets(
+        vk::PipelineBindPoint::eCompute, *m_pipeline_layout, 0,
+        {draw_set, m_star_data.descriptor_sets().front(),
+         m_descriptor_sets.front()},
+        nullptr);
+    command_buffer.pushConstants<PushConstants>(
+        *m_pipeline_layout, vk::ShaderStageFlagBits::eCompute, 0,
+        {m_push_constants});
+
+    command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                                *m_count_pipeline);
+    command_buffer.dispatchIndirect(*m_star_data.visible_arguments(), 0);
+    gfx::util::compute_barrier(command_buffer);
+
+    command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                                *m_scan_pipeline);
+    command_buffer.dispatch(1, 1, 1);
+    // bin_demand is read by fit_bin_entries() once the frame finished
+    vk::MemoryBarrier2 demand_barrier(vk::PipelineStageFlagBits2::eComputeShader,
+                                      vk::AccessFlagBits2::eShaderWrite,
+                                      vk::PipelineStageFlagBits2::eHost,
+                                      vk::AccessFlagBits2::eHostRead);
+    command_buffer.pipelineBarrier2(
+        vk::DependencyInfo({}, demand_barrier, {}, {}));
+    gfx::util::compute_barrier(command_buffer);
+
+    command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                                *m_scatter_pipeline);
+    command_buffer.dispatchIndirect(*m_star_data.visible_arguments(), 0);
+    gfx::util::compute_barrier(command_buffer);
+
+    command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                                *m_draw_pipeline);
+    command_buffer.dispatch(m_push_constants.tiles_x, m_push_constants.tiles_y,
+                            1);
+}
+}  // namespace galaxy
@@ -0,0 +1,159 @@
+#include "galaxy/block_timesteps.hpp"
+
+#include <array>
+#include <stdexcept>
+#include <vulkan/vulkan_enums.hpp>
+#include <vulkan/vulkan_raii.hpp>
+#include <vulkan/vulkan_structs.hpp>
+
+#include "gfx/readback.hpp"
+#include "gfx/utils.hpp"
+
+// must match numthreads of block_select.slang and block_drift.slang
+const static uint32_t WORKGROUP_SIZE = 256;
+// sim.slang's timestep
+const static float STEP_TIME = 10.0f;
+// uints of kick_arguments in block_timesteps.slangh
+const static uint32_t KICK_ARGUMENTS_SIZE = 4;
+
+namespace galaxy {
+BlockTimesteps::BlockTimesteps(gfx::Core& core, GPUStarData& star_data,
+                               uint32_t level_count, float accuracy)
+    : m_star_data(star_data) {
+    if (level_count == 0 || level_count > MAX_TIMESTEP_LEVELS) {
+        throw std::runtime_error("unsupported number of timestep levels");
+    }
+    vk::raii::Device& device = *core.device();
+    uint32_t star_count = star_data.star_count();
+
+    std::tie(m_levels, m_levels_memory) = gfx::util::make_buffer(
+        *core.allocator(), sizeof(uint32_t) * star_count,
+        vk::BufferUsageFlagBits::eStorageBuffer |
+            vk::BufferUsageFlagBits::eTransferDst,
+        vk::MemoryPropertyFlagBits::eDeviceLocal);
+    std::tie(m_active_stars, m_active_stars_memory) = gfx::util::make_buffer(
+        *core.allocator(), sizeof(uint32_t) * star_count,
+        vk::BufferUsageFlagBits::eStorageBuffer,
+        vk::MemoryPropertyFlagBits::eDeviceLocal);
+    std::tie(m_kick_arguments, m_kick_arguments_memory) =
+        gfx::util::make_buffer(
+            *core.allocator(), sizeof(uint32_t) * KICK_ARGUMENTS_SIZE,
+            vk::BufferUsageFlagBits::eStorageBuffer |
+                vk::BufferUsageFlagBits::eIndirectBuffer |
+                vk::BufferUsageFlagBits::eTransferDst,
+            vk::MemoryPropertyFlagBits::eDeviceLocal);
+    std::tie(m_kicks, m_kicks_memory) = gfx::util::make_buffer(
+        *core.allocator(), sizeof(glm::vec4) * star_count,
+        vk::BufferUsageFlagBits::eStorageBuffer,
+        vk::MemoryPropertyFlagBits::eDeviceLocal);
+    std::tie(m_scratch_positions, m_scratch_positions_memory) =
+        gfx::util::make_buffer(*core.allocator(),
+                               sizeof(PositionMass) * star_count,
+                               vk::BufferUsageFlagBits::eStorageBuffer,
+                               vk::MemoryPropertyFlagBits::eDeviceLocal);
+
+    m_set_layout =
+        vk::raii::DescriptorSetLayout(gfx::util::make_descriptor_set_layout(
+            device, {{vk::DescriptorType::eStorageBuffer, 1,
+                      vk::ShaderStageFlagBits::eCompute},
+                     {vk::DescriptorType::eStorageBuffer, 1,
+                      vk::ShaderStageFlagBits::eCompute},
+                     {vk::DescriptorType::eStorageBuffer, 1,
+                      vk::ShaderStageFlagBits::eCompute},
+                     {vk::DescriptorType::eStorageBuffer, 1,
+                      vk::ShaderStageFlagBits::eCompute},
+                     {vk::DescriptorType::eStorageBuffer, 1,
+                      vk::ShaderStageFlagBits::eCompute}}));
+
+    std::vector<vk::DescriptorPoolSize> pool_sizes = {
+        {vk::DescriptorType::eStorageBuffer, 5}};
+
+    vk::DescriptorPoolCreateInfo pool_create_info(
+        vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet, 1, pool_sizes);
+    m_descriptor_pool = vk::raii::DescriptorPool(device, pool_create_info);
+
+    vk::DescriptorSetAllocateInfo set_allocate_info(*m_descriptor_pool,
+                                                    *m_set_layout);
+    m_descriptor_sets = vk::raii::DescriptorSets(device, set_allocate_info);
+
+    gfx::util::update_storage_buffer_descriptors(
+        device, m_descriptor_sets.front(),
+        {m_levels, m_active_stars, m_kick_arguments, m_kicks,
+         m_scratch_positions});
+
+    std::array<vk::DescriptorSetLayout, 2> set_layouts = {
+        *m_set_layout, *star_data.descriptor_set_layout()};
+    vk::PushConstantRange push_constant_range(
+        vk::ShaderStageFlagBits::eCompute, 0, sizeof(PushConstants));
+    m_pipeline_layout = vk::raii::PipelineLayout(
+        device,
+        vk::PipelineLayoutCreateInfo({}, set_layouts, push_constant_range));
+
+    m_select_pipeline = core.create_compute_pipeline(
+        "./shaders/block_select.slang.spirv", m_pipeline_layout);
+    m_arguments_pipeline = core.create_compute_pipeline(
+        "./shaders/block_arguments.slang.spirv", m_pipeline_layout);
+    m_kick_pipeline = core.create_compute_pipeline(
+        "./shaders/block_kick.slang.spirv", m_pipeline_layout);
+    m_drift_pipeline = core.create_compute_pipeline(
+        "./shaders/block_drift.slang.spirv", m_pipeline_layout);
+
+    m_push_constants = PushConstants{
+        .star_count = star_count,
+        .level_count = level_count,
+        .accuracy = accuracy,
+        .step_time = STEP_TIME,
+    };
+
+    // every star starts at the coarsest level, the first substep of every
+    // step kicks all of them and picks their levels anyway
+    gfx::submit_and_wait(core, [&](vk::raii::CommandBuffer const& cmd) {
+        cmd.fillBuffer(*m_levels, 0, vk::WholeSize, 0);
+    });
+}
+
+BlockTimesteps::~BlockTimesteps() {}
+
+void BlockTimesteps::bind(vk::raii::CommandBuffer const& command_buffer,
+                          vk::raii::Pipeline const& pipeline) {
+    command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute, *pipeline);
+    command_buffer.bindDescriptorSets(
+        vk::PipelineBindPoint::eCompute, *m_pipeline_layout, 0,
+        {m_descriptor_sets.front(), m_star_data.descriptor_sets().front()},
+        nullptr);
+    command_buffer.pushConstants<PushConstants>(
+        *m_pipeline_layout, vk::ShaderStageFlagBits::eCompute, 0,
+        {m_push_constants});
+}
+
+void BlockTimesteps::record(vk::raii::CommandBuffer const& command_buffer,
+                            uint32_t positions_index) {
+    uint32_t star_groups =
+        (m_push_constants.star_count + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE;
+    uint32_t substeps = 1u << (m_push_constants.level_count - 1);
+    m_push_constants.positions_index = positions_index;
+
+    for (uint32_t substep = 0; substep < substeps; substep++) {
+        m_push_constants.substep = substep;
+        m_push_constants.first = substep == 0;
+        m_push_constants.last = substep == substeps - 1;
+        if (substep > 0) {
+            gfx::util::compute_barrier(command_buffer);
+        }
+
+        command_buffer.fillBuffer(*m_kick_arguments, 0, vk::WholeSize, 0);
+        gfx::util::compute_barrier(command_buffer);
+        bind(command_buffer, m_select_pipeline);
+        command_buffer.dispatch(star_groups, 1, 1);
+        gfx::util::compute_barrier(command_buffer);
+        bind(command_buffer, m_arguments_pipeline);
+        command_buffer.dispatch(1, 1, 1);
+        gfx::util::indirect_barrier(command_buffer);
+        bind(command_buffer, m_kick_pipeline);
+        command_buffer.dispatchIndirect(*m_kick_arguments, 0);
+        gfx::util::compute_barrier(command_buffer);
+        bind(command_buffer, m_drift_pipeline);
+        command_buffer.dispatch(star_groups, 1, 1);
+    }
+}
+}  // namespace galaxy
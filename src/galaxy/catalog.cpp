@@ -0,0 +1,468 @@
+#include "galaxy/catalog.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <future>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "galaxy/snapshot.hpp"
+
+const static double PARSEC = 3.0857e16;
+const static double SOLAR_MASS = 1.989e30;
+const static float SOLAR_ABSOLUTE_MAGNITUDE = 4.83f;
+// the colour index of a star without one, about that of the sun
+const static float DEFAULT_COLOR_INDEX = 0.65f;
+
+namespace galaxy {
+struct CatalogColumns {
+    int x = -1;
+    int y = -1;
+    int z = -1;
+    int magnitude = -1;
+    // absmag rather than mag
+    bool absolute = false;
+    int color = -1;
+    // fields per row that have to be looked at
+    int used = 0;
+    // ',' or ' ' for any whitespace
+    char delimiter = ',';
+};
+
+struct CatalogRow {
+    float x = NAN;
+    float y = NAN;
+    float z = NAN;
+    float magnitude = NAN;
+    float color = NAN;
+};
+
+// exact up to 1e22, larger powers come from pow
+const static std::array<double, 23> POWERS_OF_TEN = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+static uint64_t load_eight(char const* p) {
+    uint64_t value;
+    std::memcpy(&value, p, sizeof(value));
+    if constexpr (std::endian::native == std::endian::big) {
+        value = std::byteswap(value);
+    }
+    return value;
+}
+
+// whether all eight bytes are ASCII digits, checked at once
+static bool is_eight_digits(uint64_t value) {
+    return ((value & 0xF0F0F0F0F0F0F0F0) |
+            (((value + 0x0606060606060606) & 0xF0F0F0F0F0F0F0F0) >> 4)) ==
+           0x3333333333333333;
+}
+
+// the number eight ASCII digits spell, combining pairs, quads and then both
+// halves within the register
+static uint32_t parse_eight_digits(uint64_t value) {
+    const uint64_t mask = 0x000000FF000000FF;
+    const uint64_t mul1 = 100 + (1000000ull << 32);
+    const uint64_t mul2 = 1 + (10000ull << 32);
+    value -= 0x3030303030303030;
+    value = value * 10 + (value >> 8);
+    value = ((value & mask) * mul1 + ((value >> 16) & mask) * mul2) >> 32;
+    return static_cast<uint32_t>(value);
+}
+
+// Parses a decimal number from [begin, end) that fills the whole field. The
+// digits are gathered eight at a time into an integer mantissa, scaled once
+// by a power of ten at the end.
+static bool parse_float(char const* begin, char const* end, float& result) {
+    char const* p = begin;
+    bool negative = false;
+    if (p != end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        p++;
+    }
+
+    uint64_t mantissa = 0;
+    // digits that went into the mantissa, past 19 it would overflow
+    int digits = 0;
+    int exponent = 0;
+    bool any_digit = false;
+    auto take_digits = [&](bool fraction) {
+        while (end - p >= 8 && digits + 8 <= 19 &&
+               is_eight_digits(load_eight(p))) {
+            mantissa = mantissa * 100000000 + parse_eight_digits(load_eight(p));
+            digits += 8;
+            exponent -= fraction ? 8 : 0;
+            any_digit = true;
+            p += 8;
+        }
+        while (p != end && *p >= '0' && *p <= '9') {
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (*p - '0');
+                digits += mantissa > 0;
+                exponent -= fraction ? 1 : 0;
+            } else if (!fraction) {
+                exponent++;
+            }
+            any_digit = true;
+            p++;
+        }
+    };
+    take_digits(false);
+    if (p != end && *p == '.') {
+        p++;
+        take_digits(true);
+    }
+    if (!any_digit) {
+        return false;
+    }
+    if (p != end && (*p == 'e' || *p == 'E')) {
+        p++;
+        bool negative_exponent = false;
+        if (p != end && (*p == '-' || *p == '+')) {
+            negative_exponent = *p == '-';
+            p++;
+        }
+        int written_exponent = 0;
+        if (p == end) {
+            return false;
+        }
+        while (p != end && *p >= '0' && *p <= '9') {
+            written_exponent =
+                std::min(written_exponent * 10 + (*p - '0'), 1000);
+            p++;
+        }
+        exponent += negative_exponent ? -written_exponent : written_exponent;
+    }
+    if (p != end) {
+        return false;
+    }
+
+    double value = static_cast<double>(mantissa);
+    uint32_t magnitude = std::abs(exponent);
+    double scale = magnitude < POWERS_OF_TEN.size()
+                       ? POWERS_OF_TEN[magnitude]
+                       : std::pow(10.0, magnitude);
+    value = exponent < 0 ? value / scale : value * scale;
+    result = static_cast<float>(negative ? -value : value);
+    return true;
+}
+
+static bool is_space(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+// calls field(index, begin, end) for every field of the line, stopping after
+// the first count fields
+template <typename Field>
+static void split(char const* line, char const* end, char delimiter,
+                  int count, Field field) {
+    char const* p = line;
+    for (int index = 0; index < count; index++) {
+        if (delimiter == ' ') {
+            while (p != end && is_space(*p)) {
+                p++;
+            }
+            if (p == end) {
+                return;
+            }
+        }
+        char const* field_end =
+            delimiter == ' '
+                ? std::find_if(p, end, is_space)
+                : static_cast<char const*>(std::memchr(p, delimiter, end - p));
+        if (field_end == nullptr) {
+            field_end = end;
+        }
+
+        // quotes and padding around values are allowed
+        char const* begin = p;
+        char const* last = field_end;
+        while (begin != last && (is_space(*begin) || *begin == '"')) {
+            begin++;
+        }
+        while (last != begin && (is_space(last[-1]) || last[-1] == '"')) {
+            last--;
+        }
+        field(index, begin, last);
+        if (field_end == end) {
+            return;
+        }
+        p = field_end + 1;
+    }
+}
+
+static CatalogColumns find_columns(char const* line, char const* end) {
+    CatalogColumns columns;
+    columns.delimiter =
+        std::memchr(line, ',', end - line) != nullptr ? ',' : ' ';
+    int magnitude = -1;
+    split(line, end, columns.delimiter, INT32_MAX,
+          [&](int index, char const* begin, char const* last) {
+              std::string name(begin, last);
+              std::transform(name.begin(), name.end(), name.begin(),
+                             [](char c) { return std::tolower(c); });
+              if (name == "x") {
+                  columns.x = index;
+              } else if (name == "y") {
+                  columns.y = index;
+              } else if (name == "z") {
+                  columns.z = index;
+              } else if (name == "absmag") {
+                  columns.magnitude = index;
+                  columns.absolute = true;
+              } else if (name == "mag") {
+                  magnitude = index;
+              } else if (name == "ci" || name == "bv" || name == "b-v") {
+                  columns.color = index;
+              }
+          });
+    if (columns.magnitude < 0) {
+        columns.magnitude = magnitude;
+    }
+    columns.used = std::max({columns.x, columns.y, columns.z,
+                             columns.magnitude, columns.color}) +
+                   1;
+    return columns;
+}
+
+// main sequence mass-luminosity relation L ~ M^3.5, kept between a red dwarf
+// and the heaviest stars
+static float mass_from_magnitude(float absolute_magnitude) {
+    if (std::isnan(absolute_magnitude)) {
+        return SOLAR_MASS;
+    }
+    double luminosity =
+        std::pow(10.0, 0.4 * (SOLAR_ABSOLUTE_MAGNITUDE - absolute_magnitude));
+    return static_cast<float>(
+        std::clamp(std::pow(luminosity, 1.0 / 3.5), 0.08, 100.0) * SOLAR_MASS);
+}
+
+// Blackbody colour of the temperature the B-V index implies (Ballesteros
+// 2012), with Helland's fit of the blackbody curve to RGB
+static glm::vec3 tint_from_color_index(float color_index) {
+    if (std::isnan(color_index)) {
+        color_index = DEFAULT_COLOR_INDEX;
+    }
+    float bv = std::clamp(color_index, -0.4f, 2.0f);
+    // hundreds of kelvin
+    float t =
+        46.0f * (1.0f / (0.92f * bv + 1.7f) + 1.0f / (0.92f * bv + 0.62f));
+    glm::vec3 tint;
+    if (t <= 66.0f) {
+        tint.r = 1.0f;
+        tint.g = 0.3901f * std::log(t) - 0.6318f;
+        tint.b = t <= 19.0f ? 0.0f : 0.5432f * std::log(t - 10.0f) - 1.1963f;
+    } else {
+        tint.r = 1.2930f * std::pow(t - 60.0f, -0.1332f);
+        tint.g = 1.1299f * std::pow(t - 60.0f, -0.0755f);
+        tint.b = 1.0f;
+    }
+    return glm::clamp(tint, 0.0f, 1.0f);
+}
+
+// Parses the rows of [begin, end) into star_data from first on and returns
+// how many had a position.
+static uint32_t parse_rows(char const* begin, char const* end,
+                           CatalogColumns const& columns,
+                           StarData& star_data, uint32_t first) {
+    std::span<PositionMass> positions = star_data.positions();
+    std::span<PackedTint> tints = star_data.tints();
+
+    uint32_t count = 0;
+    for (char const* line = begin; line < end;) {
+        char const* line_end =
+            static_cast<char const*>(std::memchr(line, '\n', end - line));
+        if (line_end == nullptr) {
+            line_end = end;
+        }
+
+        CatalogRow row;
+        split(line, line_end, columns.delimiter, columns.used,
+              [&](int index, char const* field, char const* field_end) {
+                  float* value = index == columns.x           ? &row.x
+                                 : index == columns.y         ? &row.y
+                                 : index == columns.z         ? &row.z
+                                 : index == columns.magnitude ? &row.magnitude
+                                 : index == columns.color     ? &row.color
+                                                              : nullptr;
+                  if (value != nullptr &&
+                      !parse_float(field, field_end, *value)) {
+                      *value = NAN;
+                  }
+              });
+        line = line_end + 1;
+        if (std::isnan(row.x) || std::isnan(row.y) || std::isnan(row.z)) {
+            continue;
+        }
+
+        glm::vec3 position(row.x, row.y, row.z);
+        float magnitude = row.magnitude;
+        if (!columns.absolute) {
+            float distance = glm::length(position);
+            magnitude = distance > 0.0f
+                            ? magnitude - 5.0f * std::log10(distance / 10.0f)
+                            : NAN;
+        }
+
+        uint32_t i = first + count;
+        glm::vec3 meters(glm::dvec3(position) * PARSEC);
+        positions[i] = PositionMass{meters, mass_from_magnitude(magnitude)};
+        tints[i] = pack_tint(tint_from_color_index(row.color));
+        count++;
+    }
+    return count;
+}
+
+StarData parse_catalog(std::string const& path) {
+    int file = open(path.c_str(), O_RDONLY);
+    if (file < 0) {
+        throw std::runtime_error("could not open catalog " + path);
+    }
+    struct stat file_stat;
+    if (fstat(file, &file_stat) != 0 || file_stat.st_size == 0) {
+        close(file);
+        throw std::runtime_error(path + " is empty");
+    }
+    size_t file_size = file_stat.st_size;
+    void* mapped = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+    if (mapped == MAP_FAILED) {
+        throw std::runtime_error("could not map catalog " + path);
+    }
+    // every thread reads its chunk front to back
+    madvise(mapped, file_size, MADV_WILLNEED);
+    std::unique_ptr<void, std::function<void(void*)>> unmap(
+        mapped, [file_size](void* pointer) { munmap(pointer, file_size); });
+    char const* data = static_cast<char const*>(mapped);
+    char const* end = data + file_size;
+
+    // comments may come before the column names
+    char const* header = data;
+    while (header < end && *header == '#') {
+        char const* line_end =
+            static_cast<char const*>(std::memchr(header, '\n', end - header));
+        header = line_end == nullptr ? end : line_end + 1;
+    }
+    char const* header_end =
+        static_cast<char const*>(std::memchr(header, '\n', end - header));
+    if (header_end == nullptr) {
+        header_end = end;
+    }
+    CatalogColumns columns = find_columns(header, header_end);
+    if (columns.x < 0 || columns.y < 0 || columns.z < 0) {
+        throw std::runtime_error(path + " has no x, y and z columns");
+    }
+    char const* body = std::min(header_end + 1, end);
+
+    // chunks start after a line break so no row is split between threads
+    uint32_t thread_count =
+        std::max(1u, std::min(std::thread::hardware_concurrency(),
+                              static_cast<uint32_t>((end - body) >> 16) + 1));
+    std::vector<char const*> bounds(thread_count + 1, end);
+    bounds[0] = body;
+    for (uint32_t i = 1; i < thread_count; i++) {
+        char const* start = body + (end - body) * i / thread_count;
+        start = std::max(start, bounds[i - 1]);
+        char const* line_end =
+            static_cast<char const*>(std::memchr(start, '\n', end - start));
+        bounds[i] = line_end == nullptr ? end : line_end + 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    // every line is at most one star, so counting them gives each chunk its
+    // range of star_data to write into without synchronizing
+    std::vector<std::future<uint32_t>> counts;
+    for (uint32_t i = 0; i < thread_count; i++) {
+        counts.push_back(std::async(std::launch::async, [&bounds, i]() {
+            char const* chunk_end = bounds[i + 1];
+            uint32_t lines = static_cast<uint32_t>(
+                std::count(bounds[i], chunk_end, '\n'));
+            bool unterminated = bounds[i] != chunk_end && chunk_end[-1] != '\n';
+            return lines + unterminated;
+        }));
+    }
+    std::vector<uint32_t> firsts(thread_count + 1, 0);
+    for (uint32_t i = 0; i < thread_count; i++) {
+        firsts[i + 1] = firsts[i] + counts[i].get();
+    }
+
+    StarData star_data;
+    star_data.resize(firsts.back());
+    std::vector<std::future<uint32_t>> parsed;
+    for (uint32_t i = 0; i < thread_count; i++) {
+        parsed.push_back(std::async(
+            std::launch::async, parse_rows, bounds[i], bounds[i + 1],
+            std::cref(columns), std::ref(star_data), firsts[i]));
+    }
+
+    // close the gaps skipped rows left
+    uint32_t star_count = 0;
+    for (uint32_t i = 0; i < thread_count; i++) {
+        uint32_t count = parsed[i].get();
+        if (star_count != firsts[i]) {
+            auto move = [&](auto span) {
+                std::copy_n(span.begin() + firsts[i], count,
+                            span.begin() + star_count);
+            };
+            move(star_data.positions());
+            move(star_data.tints());
+        }
+        star_count += count;
+    }
+    star_data.resize(star_count);
+    if (star_count == 0) {
+        throw std::runtime_error(path + " has no stars");
+    }
+
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+    printf("parsed %u stars from %s on %u threads in %.2f s (%.1f MiB/s), "
+           "skipped %u rows\n",
+           star_count, path.c_str(), thread_count, seconds,
+           file_size / (1024.0 * 1024.0) / seconds,
+           firsts.back() - star_count);
+    return star_data;
+}
+
+std::shared_ptr<GPUStarData> load_catalog(gfx::Core& core,
+                                          std::string const& path) {
+    std::string cache_path = path + ".gsnap";
+    std::error_code error;
+    auto catalog_time = std::filesystem::last_write_time(path, error);
+    if (error) {
+        throw std::runtime_error("could not open catalog " + path);
+    }
+    auto cache_time = std::filesystem::last_write_time(cache_path, error);
+    if (!error && cache_time >= catalog_time) {
+        try {
+            uint64_t step;
+            return load_snapshot(core, cache_path, step);
+        } catch (std::runtime_error& err) {
+            printf("ignoring the catalog cache: %s\n", err.what());
+        }
+    }
+
+    StarData star_data = parse_catalog(path);
+    if (write_snapshot(star_data, cache_path)) {
+        printf("cached %s in %s\n", path.c_str(), cache_path.c_str());
+    } else {
+        printf("warning: could not write the catalog cache %s\n",
+               cache_path.c_str());
+    }
+    return std::make_shared<GPUStarData>(core, star_data);
+}
+}  // namespace galaxy
@@ -0,0 +1,494 @@
+#include "galaxy/cpu_engine.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define GALAXY_X86 1
+#endif
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <format>
+#include <future>
+#include <limits>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <vulkan/vulkan_enums.hpp>
+#include <vulkan/vulkan_structs.hpp>
+
+#include "galaxy/catalog.hpp"
+#include "galaxy/initial_conditions.hpp"
+#include "galaxy/snapshot.hpp"
+#include "gfx/readback.hpp"
+#include "gfx/utils.hpp"
+#include "push_constants.hpp"
+
+// G and EPSILON_SQ of gravity.slangh
+const static float G = 6.67e-11f;
+const static float EPSILON_SQ = 1.0e-5f;
+// the timestep of sim.slang, velocities and positions advance by 10 times
+// the acceleration and the velocity
+const static float STEP = 10.0f;
+// stars per SIMD register of the widest kernel, every thread's range is a
+// multiple of it
+const static uint32_t LANES = 16;
+// Stars whose pull is summed before moving on to the next block. Their
+// positions and masses take 32 KiB, so they stay in the L1 or L2 cache while
+// a thread sweeps its whole range over them.
+const static uint32_t BLOCK_SIZE = 2048;
+// must match numthreads of sim.slang
+const static uint32_t SIM_WORKGROUP_SIZE = 32;
+// steps check_cpu_engine compares, few enough that close encounters don't
+// blow rounding differences up
+const static uint32_t CHECK_STEPS = 4;
+// largest difference of the velocity changes, relative to the largest
+// velocity change on the GPU
+const static double CHECK_TOLERANCE = 1.0e-3;
+
+namespace galaxy {
+// the SoA arrays of a CpuEngine the kernels work on
+struct Bodies {
+    float const* x;
+    float const* y;
+    float const* z;
+    float const* gm;
+    float* ax;
+    float* ay;
+    float* az;
+};
+
+// Adds the pull of stars [j_begin, j_end) to the accelerations of stars
+// [begin, end), begin and end being multiples of LANES. A star's pull on
+// itself vanishes since its direction is zero, so the loops don't branch.
+using PairKernel = void (*)(Bodies const& bodies, uint32_t begin, uint32_t end,
+                            uint32_t j_begin, uint32_t j_end);
+
+static void pairs_scalar(Bodies const& bodies, uint32_t begin, uint32_t end,
+                         uint32_t j_begin, uint32_t j_end) {
+    for (uint32_t i = begin; i < end; i++) {
+        float ax = 0.0f;
+        float ay = 0.0f;
+        float az = 0.0f;
+        for (uint32_t j = j_begin; j < j_end; j++) {
+            float dx = bodies.x[j] - bodies.x[i];
+            float dy = bodies.y[j] - bodies.y[i];
+            float dz = bodies.z[j] - bodies.z[i];
+            float d = dx * dx + dy * dy + dz * dz + EPSILON_SQ;
+            float s = bodies.gm[j] / (d * std::sqrt(d));
+            ax += s * dx;
+            ay += s * dy;
+            az += s * dz;
+        }
+        bodies.ax[i] += ax;
+        bodies.ay[i] += ay;
+        bodies.az[i] += az;
+    }
+}
+
+#ifdef GALAXY_X86
+// 8 stars per register. The inverse square root is estimated to 12 bits and
+// refined by a Newton-Raphson step, which is far cheaper than a square root
+// and a division and leaves a few ulp of error.
+__attribute__((target("avx2,fma"))) static void pairs_avx2(
+    Bodies const& bodies, uint32_t begin, uint32_t end, uint32_t j_begin,
+    uint32_t j_end) {
+    __m256 epsilon_sq = _mm256_set1_ps(EPSILON_SQ);
+    __m256 half = _mm256_set1_ps(0.5f);
+    __m256 three_halves = _mm256_set1_ps(1.5f);
+    for (uint32_t i = begin; i < end; i += 8) {
+        __m256 x = _mm256_loadu_ps(bodies.x + i);
+        __m256 y = _mm256_loadu_ps(bodies.y + i);
+        __m256 z = _mm256_loadu_ps(bodies.z + i);
+        __m256 ax = _mm256_setzero_ps();
+        __m256 ay = _mm256_setzero_ps();
+        __m256 az = _mm256_setzero_ps();
+        for (uint32_t j = j_begin; j < j_end; j++) {
+            __m256 dx = _mm256_sub_ps(_mm256_set1_ps(bodies.x[j]), x);
+            __m256 dy = _mm256_sub_ps(_mm256_set1_ps(bodies.y[j]), y);
+            __m256 dz = _mm256_sub_ps(_mm256_set1_ps(bodies.z[j]), z);
+            __m256 d = _mm256_fmadd_ps(
+                dx, dx,
+                _mm256_fmadd_ps(dy, dy, _mm256_fmadd_ps(dz, dz, epsilon_sq)));
+            __m256 r = _mm256_rsqrt_ps(d);
+            r = _mm256_mul_ps(
+                r, _mm256_fnmadd_ps(_mm256_mul_ps(half, d),
+                                    _mm256_mul_ps(r, r), three_halves));
+            __m256 s = _mm256_mul_ps(_mm256_set1_ps(bodies.gm[j]),
+                                     _mm256_mul_ps(r, _mm256_mul_ps(r, r)));
+            ax = _mm256_fmadd_ps(s, dx, ax);
+            ay = _mm256_fmadd_ps(s, dy, ay);
+            az = _mm256_fmadd_ps(s, dz, az);
+        }
+        _mm256_storeu_ps(bodies.ax + i,
+                         _mm256_add_ps(_mm256_loadu_ps(bodies.ax + i), ax));
+        _mm256_storeu_ps(bodies.ay + i,
+                         _mm256_add_ps(_mm256_loadu_ps(bodies.ay + i), ay));
+        _mm256_storeu_ps(bodies.az + i,
+                         _mm256_add_ps(_mm256_loadu_ps(bodies.az + i), az));
+    }
+}
+
+// 16 stars per register, the estimate is good to 14 bits before the
+// Newton-Raphson step
+__attribute__((target("avx512f"))) static void pairs_avx512(
+    Bodies const& bodies, uint32_t begin, uint32_t end, uint32_t j_begin,
+    uint32_t j_end) {
+    __m512 epsilon_sq = _mm512_set1_ps(EPSILON_SQ);
+    __m512 half = _mm512_set1_ps(0.5f);
+    __m512 three_halves = _mm512_set1_ps(1.5f);
+    for (uint32_t i = begin; i < end; i += 16) {
+        __m512 x = _mm512_loadu_ps(bodies.x + i);
+        __m512 y = _mm512_loadu_ps(bodies.y + i);
+        __m512 z = _mm512_loadu_ps(bodies.z + i);
+        __m512 ax = _mm512_setzero_ps();
+        __m512 ay = _mm512_setzero_ps();
+        __m512 az = _mm512_setzero_ps();
+        for (uint32_t j = j_begin; j < j_end; j++) {
+            __m512 dx = _mm512_sub_ps(_mm512_set1_ps(bodies.x[j]), x);
+            __m512 dy = _mm512_sub_ps(_mm512_set1_ps(bodies.y[j]), y);
+            __m512 dz = _mm512_sub_ps(_mm512_set1_ps(bodies.z[j]), z);
+            __m512 d = _mm512_fmadd_ps(
+                dx, dx,
+                _mm512_fmadd_ps(dy, dy, _mm512_fmadd_ps(dz, dz, epsilon_sq)));
+            __m512 r = _mm512_rsqrt14_ps(d);
+            r = _mm512_mul_ps(
+                r, _mm512_fnmadd_ps(_mm512_mul_ps(half, d),
+                                    _mm512_mul_ps(r, r), three_halves));
+            __m512 s = _mm512_mul_ps(_mm512_set1_ps(bodies.gm[j]),
+                                     _mm512_mul_ps(r, _mm512_mul_ps(r, r)));
+            ax = _mm512_fmadd_ps(s, dx, ax);
+            ay = _mm512_fmadd_ps(s, dy, ay);
+            az = _mm512_fmadd_ps(s, dz, az);
+        }
+        _mm512_storeu_ps(bodies.ax + i,
+                         _mm512_add_ps(_mm512_loadu_ps(bodies.ax + i), ax));
+        _mm512_storeu_ps(bodies.ay + i,
+                         _mm512_add_ps(_mm512_loadu_ps(bodies.ay + i), ay));
+        _mm512_storeu_ps(bodies.az + i,
+                         _mm512_add_ps(_mm512_loadu_ps(bodies.az + i), az));
+    }
+}
+#endif
+
+static PairKernel pair_kernel(CpuKernel kernel) {
+    switch (kernel) {
+#ifdef GALAXY_X86
+        case CpuKernel::eAvx2:
+            return pairs_avx2;
+        case CpuKernel::eAvx512:
+            return pairs_avx512;
+#endif
+        default:
+            return pairs_scalar;
+    }
+}
+
+bool cpu_kernel_supported(CpuKernel kernel) {
+    switch (kernel) {
+        case CpuKernel::eScalar:
+            return true;
+#ifdef GALAXY_X86
+        case CpuKernel::eAvx2:
+            return __builtin_cpu_supports("avx2") &&
+                   __builtin_cpu_supports("fma");
+        case CpuKernel::eAvx512:
+            return __builtin_cpu_supports("avx512f");
+#endif
+        default:
+            return false;
+    }
+}
+
+CpuKernel best_cpu_kernel() {
+    for (CpuKernel kernel : {CpuKernel::eAvx512, CpuKernel::eAvx2}) {
+        if (cpu_kernel_supported(kernel)) {
+            return kernel;
+        }
+    }
+    return CpuKernel::eScalar;
+}
+
+char const* cpu_kernel_name(CpuKernel kernel) {
+    switch (kernel) {
+        case CpuKernel::eAvx2:
+            return "avx2";
+        case CpuKernel::eAvx512:
+            return "avx512";
+        default:
+            return "scalar";
+    }
+}
+
+CpuEngine::CpuEngine(StarData& star_data,
+                     std::span<glm::vec4 const> velocities, CpuKernel kernel,
+                     uint32_t thread_count)
+    : m_star_data(star_data), m_kernel(kernel) {
+    if (!cpu_kernel_supported(kernel)) {
+        throw std::runtime_error(
+            std::format("the {} kernel isn't supported by this CPU",
+                        cpu_kernel_name(kernel)));
+    }
+    uint32_t star_count = star_data.size();
+    if (!velocities.empty() && velocities.size() != star_count) {
+        throw std::runtime_error("need one velocity per star");
+    }
+
+    m_padded_count = (star_count + LANES - 1) / LANES * LANES;
+    for (std::vector<float>* array :
+         {&m_x, &m_y, &m_z, &m_gm, &m_ax, &m_ay, &m_az}) {
+        array->assign(m_padded_count, 0.0f);
+    }
+    m_velocities.assign(velocities.begin(), velocities.end());
+    m_velocities.resize(star_count, glm::vec4(0.0f));
+
+    if (thread_count == 0) {
+        thread_count = std::thread::hardware_concurrency();
+    }
+    // every thread needs at least one register of stars
+    m_thread_count =
+        std::max(1u, std::min(thread_count, m_padded_count / LANES));
+}
+
+CpuEngine::~CpuEngine() {}
+
+void CpuEngine::accelerate(uint32_t begin, uint32_t end) {
+    Bodies bodies{
+        .x = m_x.data(),
+        .y = m_y.data(),
+        .z = m_z.data(),
+        .gm = m_gm.data(),
+        .ax = m_ax.data(),
+        .ay = m_ay.data(),
+        .az = m_az.data(),
+    };
+    std::fill(m_ax.begin() + begin, m_ax.begin() + end, 0.0f);
+    std::fill(m_ay.begin() + begin, m_ay.begin() + end, 0.0f);
+    std::fill(m_az.begin() + begin, m_az.begin() + end, 0.0f);
+
+    PairKernel pairs = pair_kernel(m_kernel);
+    uint32_t star_count = m_star_data.size();
+    for (uint32_t j = 0; j < star_count; j += BLOCK_SIZE) {
+        pairs(bodies, begin, end, j, std::min(j + BLOCK_SIZE, star_count));
+    }
+
+    // the stars are only read from the arrays above, so every thread can
+    // move its own stars right away
+    std::span<PositionMass> positions = m_star_data.positions();
+    for (uint32_t i = begin; i < std::min(end, star_count); i++) {
+        glm::vec3 velocity = glm::vec3(m_velocities[i]) +
+                             glm::vec3(m_ax[i], m_ay[i], m_az[i]) * STEP;
+        m_velocities[i] = glm::vec4(velocity, 0.0f);
+        positions[i].position += velocity * STEP;
+    }
+}
+
+void CpuEngine::step() {
+    std::span<PositionMass const> positions = m_star_data.positions();
+    for (uint32_t i = 0; i < positions.size(); i++) {
+        m_x[i] = positions[i].position.x;
+        m_y[i] = positions[i].position.y;
+        m_z[i] = positions[i].position.z;
+        m_gm[i] = G * positions[i].mass;
+    }
+
+    uint32_t groups = m_padded_count / LANES;
+    std::vector<std::future<void>> ranges;
+    for (uint32_t t = 1; t < m_thread_count; t++) {
+        ranges.push_back(std::async(
+            std::launch::async, &CpuEngine::accelerate, this,
+            groups * t / m_thread_count * LANES,
+            groups * (t + 1) / m_thread_count * LANES));
+    }
+    // the first range on this thread
+    accelerate(0, groups / m_thread_count * LANES);
+    for (std::future<void>& range : ranges) {
+        range.get();
+    }
+}
+
+// the cube model of initial_conditions.slang, from a different RNG
+static StarData generate_cube(uint32_t star_count, uint64_t seed,
+                              float radius) {
+    std::mt19937_64 rng(seed);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    StarData star_data;
+    star_data.reserve(star_count);
+    for (uint32_t i = 0; i < star_count; i++) {
+        glm::vec3 position(unit(rng), unit(rng), unit(rng));
+        glm::vec3 tint(unit(rng), unit(rng), unit(rng));
+        star_data.push(Star{
+            .position = (2.0f * position - 1.0f) * 3.0f * radius,
+            .tint = tint,
+            .weight = std::lerp(std::pow(18.0f, 8.0f), 2.0e20f, unit(rng)),
+        });
+    }
+    return star_data;
+}
+
+bool run_cpu(Settings const& settings) {
+    StarData star_data;
+    if (!settings.catalog_path.empty()) {
+        star_data = parse_catalog(settings.catalog_path);
+    } else if (settings.initial_model == InitialModel::eCube) {
+        star_data = generate_cube(settings.star_count, settings.seed,
+                                  settings.model_radius);
+    } else {
+        printf("error: the CPU engine only generates the cube model\n");
+        return false;
+    }
+
+    CpuEngine engine(star_data, {},
+                     settings.cpu_kernel.value_or(best_cpu_kernel()));
+    printf("simulating %u stars on %u threads with the %s kernel\n",
+           star_data.size(), engine.thread_count(),
+           cpu_kernel_name(engine.kernel()));
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t step = 0; step < settings.cpu_steps; step++) {
+        engine.step();
+    }
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+    double interactions = static_cast<double>(star_data.size()) *
+                          star_data.size() * settings.cpu_steps;
+    printf("%llu steps in %.2f s: %.1f steps/s, %.2f G interactions/s\n",
+           static_cast<unsigned long long>(settings.cpu_steps), seconds,
+           settings.cpu_steps / seconds, interactions / seconds * 1.0e-9);
+
+    if (settings.snapshot_prefix.empty()) {
+        return true;
+    }
+    std::string path = std::format("{}-{:010}.gsnap", settings.snapshot_prefix,
+                                   settings.cpu_steps);
+    if (!write_snapshot(star_data, path, engine.velocities(),
+                        settings.cpu_steps)) {
+        printf("error: could not write snapshot %s\n", path.c_str());
+        return false;
+    }
+    printf("wrote snapshot %s\n", path.c_str());
+    return true;
+}
+
+bool check_cpu_engine(gfx::Core& core, uint32_t star_count) {
+    vk::raii::Device& device = *core.device();
+    GPUStarData star_data(core, star_count);
+    InitialConditions initial_conditions(core, star_data);
+    gfx::submit_and_wait(core, [&](vk::raii::CommandBuffer const& cmd) {
+        initial_conditions.record(cmd, InitialModel::ePlummer, 1, 1.0e10f,
+                                  1.0e20f);
+    });
+    std::vector<PositionMass> initial_positions = gfx::read_back<PositionMass>(
+        core, *star_data.positions()[0], star_count);
+    std::vector<glm::vec4> initial_velocities =
+        gfx::read_back<glm::vec4>(core, *star_data.velocities(), star_count);
+
+    // sim.slang only uses the star set, set 1, so set 0 is left empty
+    vk::raii::DescriptorSetLayout empty_set_layout =
+        gfx::util::make_descriptor_set_layout(device, {});
+    std::array<vk::DescriptorSetLayout, 2> set_layouts = {
+        *empty_set_layout, *star_data.descriptor_set_layout()};
+    PushConstants push_constants{};
+    push_constants.star_count = star_count;
+    vk::PushConstantRange push_constant_range =
+        push_constants.push_constant_range();
+    vk::raii::PipelineLayout pipeline_layout(
+        device,
+        vk::PipelineLayoutCreateInfo({}, set_layouts, push_constant_range));
+    vk::raii::Pipeline pipeline = core.create_compute_pipeline(
+        "./shaders/sim.slang.spirv", pipeline_layout);
+
+    auto start = std::chrono::steady_clock::now();
+    gfx::submit_and_wait(core, [&](vk::raii::CommandBuffer const& cmd) {
+        cmd.bindPipeline(vk::PipelineBindPoint::eCompute, *pipeline);
+        cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute,
+                               *pipeline_layout, 1,
+                               {*star_data.descriptor_sets().front()}, nullptr);
+        for (uint32_t step = 0; step < CHECK_STEPS; step++) {
+            if (step > 0) {
+                gfx::util::compute_barrier(cmd);
+            }
+            push_constants.positions_index = step % 2;
+            cmd.pushConstants<PushConstants>(
+                *pipeline_layout, vk::ShaderStageFlagBits::eCompute, 0,
+                {push_constants});
+            cmd.dispatch(
+                (star_count + SIM_WORKGROUP_SIZE - 1) / SIM_WORKGROUP_SIZE, 1,
+                1);
+        }
+    });
+    double gpu_seconds = std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+    std::vector<PositionMass> gpu_positions = gfx::read_back<PositionMass>(
+        core, *star_data.positions()[CHECK_STEPS % 2], star_count);
+    std::vector<glm::vec4> gpu_velocities =
+        gfx::read_back<glm::vec4>(core, *star_data.velocities(), star_count);
+
+    // The positions barely move in a few steps compared to their rounding,
+    // so the forces are compared through the change of the velocities.
+    double largest_change = 0.0;
+    glm::vec3 bounds_min(std::numeric_limits<float>::max());
+    glm::vec3 bounds_max(std::numeric_limits<float>::lowest());
+    for (uint32_t i = 0; i < star_count; i++) {
+        largest_change = std::max<double>(
+            largest_change,
+            glm::length(gpu_velocities[i] - initial_velocities[i]));
+        bounds_min = glm::min(bounds_min, gpu_positions[i].position);
+        bounds_max = glm::max(bounds_max, gpu_positions[i].position);
+    }
+    double extent = glm::length(bounds_max - bounds_min);
+    double interactions =
+        static_cast<double>(star_count) * star_count * CHECK_STEPS;
+    printf("gpu: %.2f ms per step including the submission\n",
+           gpu_seconds / CHECK_STEPS * 1.0e3);
+
+    bool passed = true;
+    for (CpuKernel kernel :
+         {CpuKernel::eScalar, CpuKernel::eAvx2, CpuKernel::eAvx512}) {
+        if (!cpu_kernel_supported(kernel)) {
+            printf("%s: not supported by this CPU\n", cpu_kernel_name(kernel));
+            continue;
+        }
+        StarData cpu_stars;
+        cpu_stars.resize(star_count);
+        std::copy(initial_positions.begin(), initial_positions.end(),
+                  cpu_stars.positions().begin());
+        CpuEngine engine(cpu_stars, initial_velocities, kernel);
+
+        start = std::chrono::steady_clock::now();
+        for (uint32_t step = 0; step < CHECK_STEPS; step++) {
+            engine.step();
+        }
+        double seconds = std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+
+        double velocity_error = 0.0;
+        double position_error = 0.0;
+        for (uint32_t i = 0; i < star_count; i++) {
+            velocity_error = std::max<double>(
+                velocity_error,
+                glm::length(engine.velocities()[i] - gpu_velocities[i]));
+            position_error = std::max<double>(
+                position_error, glm::length(cpu_stars.positions()[i].position -
+                                            gpu_positions[i].position));
+        }
+        velocity_error /= std::max(largest_change, 1.0e-30);
+        position_error /= std::max(extent, 1.0e-30);
+        bool kernel_passed = velocity_error <= CHECK_TOLERANCE &&
+                             position_error <= CHECK_TOLERANCE;
+        printf("%s: %.2f ms per step on %u threads (%.2f G interactions/s), "
+               "velocity change error %.2e, position error %.2e: %s\n",
+               cpu_kernel_name(kernel), seconds / CHECK_STEPS * 1.0e3,
+               engine.thread_count(), interactions / seconds * 1.0e-9,
+               velocity_error, position_error,
+               kernel_passed ? "passed" : "FAILED");
+        passed = passed && kernel_passed;
+    }
+    return passed;
+}
+}  // namespace galaxy
@@ -0,0 +1,208 @@
+#include "galaxy/diagnostics.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vulkan/vulkan_enums.hpp>
+#include <vulkan/vulkan_structs.hpp>
+
+#include "gfx/utils.hpp"
+
+// must match REDUCTION_GROUP_SIZE of reduction.slangh
+const static uint32_t WORKGROUP_SIZE = 256;
+// float4 partials each workgroup of diagnostics_stars leaves, must match
+// PARTIAL_STRIDE of diagnostics.slangh
+const static uint32_t PARTIAL_STRIDE = 3;
+
+namespace galaxy {
+Diagnostics::Diagnostics(gfx::Core& core, GPUStarData& star_data,
+                         uint32_t slots)
+    : m_core(core), m_star_data(star_data), m_slots(slots) {
+    vk::raii::Device& device = *core.device();
+    m_group_count =
+        (star_data.star_count() + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE;
+
+    std::tie(m_partials, m_partials_memory) = gfx::util::make_buffer(
+        *core.allocator(),
+        sizeof(glm::vec4) * PARTIAL_STRIDE * m_group_count,
+        vk::BufferUsageFlagBits::eStorageBuffer,
+        vk::MemoryPropertyFlagBits::eDeviceLocal);
+    std::tie(m_result, m_result_memory) = gfx::util::make_buffer(
+        *core.allocator(), sizeof(DiagnosticsResult),
+        vk::BufferUsageFlagBits::eStorageBuffer |
+            vk::BufferUsageFlagBits::eTransferSrc,
+        vk::MemoryPropertyFlagBits::eDeviceLocal);
+
+    m_set_layout =
+        vk::raii::DescriptorSetLayout(gfx::util::make_descriptor_set_layout(
+            device, {{vk::DescriptorType::eStorageBuffer, 1,
+                      vk::ShaderStageFlagBits::eCompute},
+                     {vk::DescriptorType::eStorageBuffer, 1,
+                      vk::ShaderStageFlagBits::eCompute}}));
+
+    std::vector<vk::DescriptorPoolSize> pool_sizes = {
+        {vk::DescriptorType::eStorageBuffer, 2}};
+
+    vk::DescriptorPoolCreateInfo pool_create_info(
+        vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet, 1, pool_sizes);
+    m_descriptor_pool = vk::raii::DescriptorPool(device, pool_create_info);
+
+    vk::DescriptorSetAllocateInfo set_allocate_info(*m_descriptor_pool,
+                                                    *m_set_layout);
+    m_descriptor_sets = vk::raii::DescriptorSets(device, set_allocate_info);
+
+    gfx::util::update_storage_buffer_descriptors(
+        device, m_descriptor_sets.front(), {m_partials, m_result});
+
+    std::array<vk::DescriptorSetLayout, 2> set_layouts = {
+        *m_set_layout, *star_data.descriptor_set_layout()};
+    vk::PushConstantRange push_constant_range(
+        vk::ShaderStageFlagBits::eCompute, 0, sizeof(PushConstants));
+    m_pipeline_layout = vk::raii::PipelineLayout(
+        device,
+        vk::PipelineLayoutCreateInfo({}, set_layouts, push_constant_range));
+
+    m_stars_pipeline = core.create_compute_pipeline(
+        "./shaders/diagnostics_stars.slang.spirv", m_pipeline_layout);
+    m_combine_pipeline = core.create_compute_pipeline(
+        "./shaders/diagnostics_combine.slang.spirv", m_pipeline_layout);
+    m_radius_pipeline = core.create_compute_pipeline(
+        "./shaders/diagnostics_radius.slang.spirv", m_pipeline_layout);
+}
+
+Diagnostics::~Diagnostics() {}
+
+void Diagnostics::dispatch(vk::raii::CommandBuffer const& command_buffer,
+                           vk::raii::Pipeline const& pipeline,
+                           PushConstants const& push_constants,
+                           uint32_t group_count) {
+    command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute, *pipeline);
+    command_buffer.bindDescriptorSets(
+        vk::PipelineBindPoint::eCompute, *m_pipeline_layout, 0,
+        {m_descriptor_sets.front(), m_star_data.descriptor_sets().front()},
+        nullptr);
+    command_buffer.pushConstants<PushConstants>(
+        *m_pipeline_layout, vk::ShaderStageFlagBits::eCompute, 0,
+        {push_constants});
+    command_buffer.dispatch(group_count, 1, 1);
+}
+
+bool Diagnostics::record(vk::raii::CommandBuffer const& command_buffer,
+                         uint32_t positions_index, uint64_t step,
+                         vk::Fence frame_fence) {
+    auto slot = std::find_if(m_slots.begin(), m_slots.end(),
+                             [](Slot const& slot) { return !slot.busy; });
+    if (slot == m_slots.end()) {
+        return false;
+    }
+    if (!*slot->buffer) {
+        std::tie(slot->buffer, slot->memory) =
+            m_core.allocator()->create_buffer(
+                vk::BufferCreateInfo({}, sizeof(DiagnosticsResult),
+                                     vk::BufferUsageFlagBits::eTransferDst),
+                vk::MemoryPropertyFlagBits::eHostVisible |
+                    vk::MemoryPropertyFlagBits::eHostCoherent,
+                vk::MemoryPropertyFlagBits::eHostCached);
+    }
+
+    // the steps before wrote the stars, and the last diagnostics may still
+    // be copying the result
+    vk::MemoryBarrier2 before(
+        vk::PipelineStageFlagBits2::eAllCommands,
+        vk::AccessFlagBits2::eMemoryWrite | vk::AccessFlagBits2::eMemoryRead,
+        vk::PipelineStageFlagBits2::eComputeShader,
+        vk::AccessFlagBits2::eShaderRead | vk::AccessFlagBits2::eShaderWrite);
+    command_buffer.pipelineBarrier2(vk::DependencyInfo({}, before, {}, {}));
+
+    PushConstants push_constants{
+        .star_count = m_star_data.star_count(),
+        .positions_index = positions_index,
+        .group_count = m_group_count,
+    };
+    dispatch(command_buffer, m_stars_pipeline, push_constants, m_group_count);
+    gfx::util::compute_barrier(command_buffer);
+    dispatch(command_buffer, m_combine_pipeline, push_constants, 1);
+    gfx::util::compute_barrier(command_buffer);
+    dispatch(command_buffer, m_radius_pipeline, push_constants, m_group_count);
+
+    vk::MemoryBarrier2 before_copy(vk::PipelineStageFlagBits2::eComputeShader,
+                                   vk::AccessFlagBits2::eShaderWrite,
+                                   vk::PipelineStageFlagBits2::eTransfer,
+                                   vk::AccessFlagBits2::eTransferRead);
+    command_buffer.pipelineBarrier2(vk::DependencyInfo({}, before_copy, {}, {}));
+    command_buffer.copyBuffer(*m_result, *slot->buffer,
+                              vk::BufferCopy(0, 0, sizeof(DiagnosticsResult)));
+    vk::MemoryBarrier2 after_copy(vk::PipelineStageFlagBits2::eTransfer,
+                                  vk::AccessFlagBits2::eTransferWrite,
+                                  vk::PipelineStageFlagBits2::eHost,
+                                  vk::AccessFlagBits2::eHostRead);
+    command_buffer.pipelineBarrier2(vk::DependencyInfo({}, after_copy, {}, {}));
+
+    slot->busy = true;
+    slot->fence = frame_fence;
+    slot->step = step;
+    return true;
+}
+
+std::vector<DiagnosticsSample> Diagnostics::poll() {
+    // in step order, stopping at the first frame that isn't done so a later
+    // one can't overtake it
+    std::vector<Slot*> busy;
+    for (Slot& slot : m_slots) {
+        if (slot.busy) {
+            busy.push_back(&slot);
+        }
+    }
+    std::sort(busy.begin(), busy.end(),
+              [](Slot* a, Slot* b) { return a->step < b->step; });
+    std::vector<Slot*> finished;
+    for (Slot* slot : busy) {
+        if (m_core.device()->waitForFences({slot->fence}, vk::True, 0) !=
+            vk::Result::eSuccess) {
+            break;
+        }
+        finished.push_back(slot);
+    }
+
+    std::vector<DiagnosticsSample> samples;
+    for (Slot* slot : finished) {
+        DiagnosticsResult result;
+        std::memcpy(&result, slot->memory.mapped(), sizeof(result));
+        slot->busy = false;
+
+        // the kernels weigh every star in units of mass_unit kg, the masses
+        // inside the potential are in kg already
+        double unit = result.mass_unit;
+        DiagnosticsSample sample{
+            .step = slot->step,
+            .kinetic_energy = result.kinetic_energy * unit,
+            .potential_energy = result.potential_energy * unit,
+            .momentum = glm::dvec3(result.momentum) * unit,
+            .mass = result.mass * unit,
+            .center_of_mass = result.center_of_mass,
+            .bounding_radius = result.bounding_radius,
+        };
+        sample.total_energy = sample.kinetic_energy + sample.potential_energy;
+        if (!m_initial_energy) {
+            m_initial_energy = sample.total_energy;
+        }
+        sample.energy_drift =
+            *m_initial_energy != 0.0
+                ? (sample.total_energy - *m_initial_energy) /
+                      std::abs(*m_initial_energy)
+                : 0.0;
+        samples.push_back(sample);
+    }
+    return samples;
+}
+
+void print_diagnostics(DiagnosticsSample const& sample) {
+    printf("step %llu: kinetic %.6e J, potential %.6e J, total %.6e J "
+           "(drift %+.3e), momentum %.3e kg m/s, radius %.3e m\n",
+           static_cast<unsigned long long>(sample.step), sample.kinetic_energy,
+           sample.potential_energy, sample.total_energy, sample.energy_drift,
+           glm::length(sample.momentum), sample.bounding_radius);
+}
+}  // namespace galaxy
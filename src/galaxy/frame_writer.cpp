@@ -0,0 +1,50 @@
+#include "galaxy/frame_writer.hpp"
+
+#include <stdexcept>
+
+namespace galaxy {
+FrameWriter::FrameWriter(std::string const& path, OutputFormat format,
+                         uint32_t width, uint32_t height, uint32_t fps)
+    : m_format(format), m_width(width), m_height(height) {
+    m_file = std::fopen(path.c_str(), "wb");
+    if (m_file == nullptr) {
+        throw std::runtime_error("could not open " + path + " for writing");
+    }
+
+    if (m_format == OutputFormat::eY4m) {
+        // full chroma resolution, the stars are single pixels
+        std::fprintf(m_file, "YUV4MPEG2 W%u H%u F%u:1 Ip A1:1 C444\n", width,
+                     height, fps);
+        m_planes.resize(3 * width * height);
+    }
+}
+
+FrameWriter::~FrameWriter() {
+    if (m_file != nullptr) {
+        std::fclose(m_file);
+    }
+}
+
+void FrameWriter::write(uint8_t const* rgba) {
+    size_t pixel_count = m_width * m_height;
+    if (m_format == OutputFormat::eRaw) {
+        std::fwrite(rgba, 4, pixel_count, m_file);
+        return;
+    }
+
+    // BT.601 limited range, the y4m default
+    uint8_t* y_plane = m_planes.data();
+    uint8_t* cb_plane = y_plane + pixel_count;
+    uint8_t* cr_plane = cb_plane + pixel_count;
+    for (size_t i = 0; i < pixel_count; i++) {
+        int r = rgba[4 * i];
+        int g = rgba[4 * i + 1];
+        int b = rgba[4 * i + 2];
+        y_plane[i] = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+        cb_plane[i] = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+        cr_plane[i] = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+    }
+    std::fputs("FRAME\n", m_file);
+    std::fwrite(m_planes.data(), 1, m_planes.size(), m_file);
+}
+}  // namespace galaxy
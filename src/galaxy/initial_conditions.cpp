@@ -0,0 +1,51 @@
+#include "galaxy/initial_conditions.hpp"
+
+#include <vulkan/vulkan_enums.hpp>
+#include <vulkan/vulkan_raii.hpp>
+#include <vulkan/vulkan_structs.hpp>
+
+// must match numthreads of initial_conditions.slang
+const static uint32_t WORKGROUP_SIZE = 256;
+
+namespace galaxy {
+InitialConditions::InitialConditions(gfx::Core& core, GPUStarData& star_data)
+    : m_star_data(star_data) {
+    vk::raii::Device& device = *core.device();
+
+    vk::DescriptorSetLayout set_layout = *star_data.descriptor_set_layout();
+    vk::PushConstantRange push_constant_range(
+        vk::ShaderStageFlagBits::eCompute, 0, sizeof(PushConstants));
+    m_pipeline_layout = vk::raii::PipelineLayout(
+        device,
+        vk::PipelineLayoutCreateInfo({}, set_layout, push_constant_range));
+
+    m_pipeline = core.create_compute_pipeline(
+        "./shaders/initial_conditions.slang.spirv", m_pipeline_layout);
+}
+
+InitialConditions::~InitialConditions() {}
+
+void InitialConditions::record(vk::raii::CommandBuffer const& command_buffer,
+                               InitialModel model, uint64_t seed, float radius,
+                               float star_mass) {
+    PushConstants push_constants{
+        .star_count = m_star_data.star_count(),
+        .model = static_cast<uint32_t>(model),
+        .seed_low = static_cast<uint32_t>(seed),
+        .seed_high = static_cast<uint32_t>(seed >> 32),
+        .radius = radius,
+        .star_mass = star_mass,
+    };
+
+    command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute, *m_pipeline);
+    command_buffer.bindDescriptorSets(
+        vk::PipelineBindPoint::eCompute, *m_pipeline_layout, 0,
+        {m_star_data.descriptor_sets().front()}, nullptr);
+    command_buffer.pushConstants<PushConstants>(
+        *m_pipeline_layout, vk::ShaderStageFlagBits::eCompute, 0,
+        {push_constants});
+    command_buffer.dispatch(
+        (push_constants.star_count + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, 1,
+        1);
+}
+}  // namespace galaxy
@@ -0,0 +1,219 @@
+#include "galaxy/particle_mesh.hpp"
+
+#include <array>
+#include <bit>
+#include <stdexcept>
+#include <vector>
+#include <vulkan/vulkan_enums.hpp>
+#include <vulkan/vulkan_raii.hpp>
+#include <vulkan/vulkan_structs.hpp>
+
+#include "gfx/readback.hpp"
+#include "gfx/utils.hpp"
+
+// must match numthreads of the per-star particle_mesh_*.slang kernels and
+// REDUCTION_GROUP_SIZE of reduction.slangh
+const static uint32_t WORKGROUP_SIZE = 256;
+// numthreads of the kernels that run over the FFT grid
+const static uint32_t GRID_WORKGROUP_X = 8;
+const static uint32_t GRID_WORKGROUP_Y = 8;
+const static uint32_t GRID_WORKGROUP_Z = 4;
+// sizeof(ParticleMeshParams) in particle_mesh.slangh under std430
+const static vk::DeviceSize PARAMS_SIZE = 32;
+// a line of the FFT grid has to fit MAX_FFT_SIZE of particle_mesh.slangh
+const static uint32_t MIN_GRID_SIZE = 16;
+const static uint32_t MAX_GRID_SIZE = 256;
+
+namespace galaxy {
+ParticleMesh::ParticleMesh(gfx::Core& core, GPUStarData& star_data,
+                           uint32_t grid_size)
+    : m_star_data(star_data), m_grid_size(grid_size) {
+    if (!std::has_single_bit(grid_size) || grid_size < MIN_GRID_SIZE ||
+        grid_size > MAX_GRID_SIZE) {
+        throw std::runtime_error(
+            "the particle-mesh grid size must be a power of two from 16 to "
+            "256");
+    }
+    vk::raii::Device& device = *core.device();
+
+    m_fft_size = 2 * grid_size;
+    m_group_count =
+        (star_data.star_count() + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE;
+    vk::DeviceSize grid_nodes =
+        static_cast<vk::DeviceSize>(grid_size) * grid_size * grid_size;
+    vk::DeviceSize fft_nodes =
+        static_cast<vk::DeviceSize>(m_fft_size) * m_fft_size * m_fft_size;
+
+    std::tie(m_bounds, m_bounds_memory) = gfx::util::make_buffer(
+        *core.allocator(), sizeof(uint32_t) * 6,
+        vk::BufferUsageFlagBits::eStorageBuffer |
+            vk::BufferUsageFlagBits::eTransferDst,
+        vk::MemoryPropertyFlagBits::eDeviceLocal);
+    std::tie(m_partials, m_partials_memory) = gfx::util::make_buffer(
+        *core.allocator(), sizeof(float) * m_group_count,
+        vk::BufferUsageFlagBits::eStorageBuffer,
+        vk::MemoryPropertyFlagBits::eDeviceLocal);
+    std::tie(m_params, m_params_memory) = gfx::util::make_buffer(
+        *core.allocator(), PARAMS_SIZE,
+        vk::BufferUsageFlagBits::eStorageBuffer,
+        vk::MemoryPropertyFlagBits::eDeviceLocal);
+    std::tie(m_mass_grid, m_mass_grid_memory) = gfx::util::make_buffer(
+        *core.allocator(), sizeof(uint32_t) * 2 * grid_nodes,
+        vk::BufferUsageFlagBits::eStorageBuffer |
+            vk::BufferUsageFlagBits::eTransferDst,
+        vk::MemoryPropertyFlagBits::eDeviceLocal);
+    std::tie(m_fft_grid, m_fft_grid_memory) = gfx::util::make_buffer(
+        *core.allocator(), sizeof(glm::vec2) * fft_nodes,
+        vk::BufferUsageFlagBits::eStorageBuffer,
+        vk::MemoryPropertyFlagBits::eDeviceLocal);
+    // the kernel is computed once on the graphics queue below and read every
+    // step by the solver, which may run on the compute queue
+    vk::BufferCreateInfo kernel_create_info(
+        {}, sizeof(float) * fft_nodes,
+        vk::BufferUsageFlagBits::eStorageBuffer);
+    std::vector<uint32_t> queue_family_indices = core.queue_family_indices();
+    if (queue_family_indices.size() > 1) {
+        kernel_create_info.setSharingMode(vk::SharingMode::eConcurrent)
+            .setQueueFamilyIndices(queue_family_indices);
+    }
+    std::tie(m_kernel, m_kernel_memory) = core.allocator()->create_buffer(
+        kernel_create_info, vk::MemoryPropertyFlagBits::eDeviceLocal);
+
+    m_set_layout =
+        vk::raii::DescriptorSetLayout(gfx::util::make_descriptor_set_layout(
+            device, {{vk::DescriptorType::eStorageBuffer, 1,
+                      vk::ShaderStageFlagBits::eCompute},
+                     {vk::DescriptorType::eStorageBuffer, 1,
+                      vk::ShaderStageFlagBits::eCompute},
+                     {vk::DescriptorType::eStorageBuffer, 1,
+                      vk::ShaderStageFlagBits::eCompute},
+                     {vk::DescriptorType::eStorageBuffer, 1,
+                      vk::ShaderStageFlagBits::eCompute},
+                     {vk::DescriptorType::eStorageBuffer, 1,
+                      vk::ShaderStageFlagBits::eCompute},
+                     {vk::DescriptorType::eStorageBuffer, 1,
+                      vk::ShaderStageFlagBits::eCompute}}));
+
+    std::vector<vk::DescriptorPoolSize> pool_sizes = {
+        {vk::DescriptorType::eStorageBuffer, 6}};
+
+    vk::DescriptorPoolCreateInfo pool_create_info(
+        vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet, 1, pool_sizes);
+    m_descriptor_pool = vk::raii::DescriptorPool(device, pool_create_info);
+
+    vk::DescriptorSetAllocateInfo set_allocate_info(*m_descriptor_pool,
+                                                    *m_set_layout);
+    m_descriptor_sets = vk::raii::DescriptorSets(device, set_allocate_info);
+
+    gfx::util::update_storage_buffer_descriptors(
+        device, m_descriptor_sets.front(),
+        {m_bounds, m_partials, m_params, m_mass_grid, m_fft_grid, m_kernel});
+
+    std::array<vk::DescriptorSetLayout, 2> set_layouts = {
+        *m_set_layout, *star_data.descriptor_set_layout()};
+    vk::PushConstantRange push_constant_range(
+        vk::ShaderStageFlagBits::eCompute, 0, sizeof(PushConstants));
+    m_pipeline_layout = vk::raii::PipelineLayout(
+        device,
+        vk::PipelineLayoutCreateInfo({}, set_layouts, push_constant_range));
+
+    m_bounds_pipeline = core.create_compute_pipeline(
+        "./shaders/particle_mesh_bounds.slang.spirv", m_pipeline_layout);
+    m_setup_pipeline = core.create_compute_pipeline(
+        "./shaders/particle_mesh_setup.slang.spirv", m_pipeline_layout);
+    m_deposit_pipeline = core.create_compute_pipeline(
+        "./shaders/particle_mesh_deposit.slang.spirv", m_pipeline_layout);
+    m_load_pipeline = core.create_compute_pipeline(
+        "./shaders/particle_mesh_load.slang.spirv", m_pipeline_layout);
+    m_fft_pipeline = core.create_compute_pipeline(
+        "./shaders/particle_mesh_fft.slang.spirv", m_pipeline_layout);
+    m_convolve_pipeline = core.create_compute_pipeline(
+        "./shaders/particle_mesh_convolve.slang.spirv", m_pipeline_layout);
+    m_force_pipeline = core.create_compute_pipeline(
+        "./shaders/particle_mesh_force.slang.spirv", m_pipeline_layout);
+
+    m_push_constants = PushConstants{
+        .star_count = star_data.star_count(),
+        .grid_size = m_grid_size,
+        .fft_size = m_fft_size,
+        .log2_fft_size = static_cast<uint32_t>(std::countr_zero(m_fft_size)),
+        .group_count = m_group_count,
+    };
+
+    // the kernel only depends on the grid size, the cell size is applied to
+    // the potential instead
+    vk::raii::Pipeline kernel_pipeline = core.create_compute_pipeline(
+        "./shaders/particle_mesh_kernel.slang.spirv", m_pipeline_layout);
+    vk::raii::Pipeline kernel_store_pipeline = core.create_compute_pipeline(
+        "./shaders/particle_mesh_kernel_store.slang.spirv", m_pipeline_layout);
+    gfx::submit_and_wait(core, [&](vk::raii::CommandBuffer const& cmd) {
+        dispatch_fft_grid(cmd, kernel_pipeline);
+        gfx::util::compute_barrier(cmd);
+        record_fft(cmd, false);
+        dispatch_fft_grid(cmd, kernel_store_pipeline);
+    });
+}
+
+ParticleMesh::~ParticleMesh() {}
+
+void ParticleMesh::dispatch(vk::raii::CommandBuffer const& command_buffer,
+                            vk::raii::Pipeline const& pipeline,
+                            uint32_t group_count_x, uint32_t group_count_y,
+                            uint32_t group_count_z) {
+    command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute, *pipeline);
+    command_buffer.bindDescriptorSets(
+        vk::PipelineBindPoint::eCompute, *m_pipeline_layout, 0,
+        {m_descriptor_sets.front(), m_star_data.descriptor_sets().front()},
+        nullptr);
+    command_buffer.pushConstants<PushConstants>(
+        *m_pipeline_layout, vk::ShaderStageFlagBits::eCompute, 0,
+        {m_push_constants});
+    command_buffer.dispatch(group_count_x, group_count_y, group_count_z);
+}
+
+void ParticleMesh::dispatch_fft_grid(
+    vk::raii::CommandBuffer const& command_buffer,
+    vk::raii::Pipeline const& pipeline) {
+    dispatch(command_buffer, pipeline, m_fft_size / GRID_WORKGROUP_X,
+             m_fft_size / GRID_WORKGROUP_Y, m_fft_size / GRID_WORKGROUP_Z);
+}
+
+void ParticleMesh::record_fft(vk::raii::CommandBuffer const& command_buffer,
+                              bool inverse) {
+    m_push_constants.inverse = inverse;
+    for (uint32_t axis = 0; axis < 3; axis++) {
+        m_push_constants.axis = axis;
+        dispatch(command_buffer, m_fft_pipeline, m_fft_size, m_fft_size);
+        gfx::util::compute_barrier(command_buffer);
+    }
+}
+
+void ParticleMesh::record(vk::raii::CommandBuffer const& command_buffer,
+                          uint32_t positions_index) {
+    m_push_constants.positions_index = positions_index;
+    uint32_t star_groups = m_group_count;
+
+    // bounds start out as an empty box, the grid without mass
+    command_buffer.fillBuffer(*m_bounds, 0, sizeof(uint32_t) * 3, 0xFFFFFFFF);
+    command_buffer.fillBuffer(*m_bounds, sizeof(uint32_t) * 3,
+                              sizeof(uint32_t) * 3, 0);
+    command_buffer.fillBuffer(*m_mass_grid, 0, vk::WholeSize, 0);
+    gfx::util::compute_barrier(command_buffer);
+
+    dispatch(command_buffer, m_bounds_pipeline, star_groups);
+    gfx::util::compute_barrier(command_buffer);
+    dispatch(command_buffer, m_setup_pipeline, 1);
+    gfx::util::compute_barrier(command_buffer);
+    dispatch(command_buffer, m_deposit_pipeline, star_groups);
+    gfx::util::compute_barrier(command_buffer);
+    dispatch_fft_grid(command_buffer, m_load_pipeline);
+    gfx::util::compute_barrier(command_buffer);
+
+    record_fft(command_buffer, false);
+    dispatch_fft_grid(command_buffer, m_convolve_pipeline);
+    gfx::util::compute_barrier(command_buffer);
+    record_fft(command_buffer, true);
+
+    dispatch(command_buffer, m_force_pipeline, star_groups);
+}
+}  // namespace galaxy
@@ -0,0 +1,130 @@
+#include "galaxy/radix_sort.hpp"
+
+#include <cassert>
+#include <vulkan/vulkan_enums.hpp>
+#include <vulkan/vulkan_raii.hpp>
+#include <vulkan/vulkan_structs.hpp>
+
+#include "gfx/utils.hpp"
+
+// elements handled by one workgroup, must match the shaders' numthreads
+const static uint32_t BLOCK_SIZE = 256;
+const static uint32_t RADIX_BITS = 4;
+const static uint32_t RADIX = 1 << RADIX_BITS;
+
+namespace galaxy {
+RadixSort::RadixSort(gfx::Core& core, uint32_t capacity)
+    : m_capacity(capacity) {
+    vk::raii::Device& device = *core.device();
+
+    uint32_t max_block_count = (capacity + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+    for (auto i = 0; i < 2; i++) {
+        // the keys can be copied out to check the result
+        auto [keys, keys_memory] = gfx::util::make_buffer(
+            *core.allocator(), sizeof(uint32_t) * capacity,
+            vk::BufferUsageFlagBits::eStorageBuffer |
+                vk::BufferUsageFlagBits::eTransferSrc,
+            vk::MemoryPropertyFlagBits::eDeviceLocal);
+        m_keys.push_back(std::move(keys));
+        m_keys_memories.push_back(std::move(keys_memory));
+
+        auto [values, values_memory] = gfx::util::make_buffer(
+            *core.allocator(), sizeof(uint32_t) * capacity,
+            vk::BufferUsageFlagBits::eStorageBuffer,
+            vk::MemoryPropertyFlagBits::eDeviceLocal);
+        m_values.push_back(std::move(values));
+        m_values_memories.push_back(std::move(values_memory));
+    }
+
+    std::tie(m_histograms, m_histograms_memory) = gfx::util::make_buffer(
+        *core.allocator(), sizeof(uint32_t) * RADIX * max_block_count,
+        vk::BufferUsageFlagBits::eStorageBuffer,
+        vk::MemoryPropertyFlagBits::eDeviceLocal);
+
+    m_set_layout =
+        vk::raii::DescriptorSetLayout(gfx::util::make_descriptor_set_layout(
+            device, {{vk::DescriptorType::eStorageBuffer, 1,
+                      vk::ShaderStageFlagBits::eCompute},
+                     {vk::DescriptorType::eStorageBuffer, 1,
+                      vk::ShaderStageFlagBits::eCompute},
+                     {vk::DescriptorType::eStorageBuffer, 1,
+                      vk::ShaderStageFlagBits::eCompute},
+                     {vk::DescriptorType::eStorageBuffer, 1,
+                      vk::ShaderStageFlagBits::eCompute},
+                     {vk::DescriptorType::eStorageBuffer, 1,
+                      vk::ShaderStageFlagBits::eCompute}}));
+
+    std::vector<vk::DescriptorPoolSize> pool_sizes = {
+        {vk::DescriptorType::eStorageBuffer, 5}};
+
+    vk::DescriptorPoolCreateInfo pool_create_info(
+        vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet, 1, pool_sizes);
+    m_descriptor_pool = vk::raii::DescriptorPool(device, pool_create_info);
+
+    vk::DescriptorSetAllocateInfo set_allocate_info(*m_descriptor_pool,
+                                                    *m_set_layout);
+    m_descriptor_sets = vk::raii::DescriptorSets(device, set_allocate_info);
+
+    gfx::util::update_storage_buffer_descriptors(
+        device, m_descriptor_sets.front(),
+        {m_keys[0], m_values[0], m_keys[1], m_values[1], m_histograms});
+
+    vk::PushConstantRange push_constant_range(
+        vk::ShaderStageFlagBits::eCompute, 0, sizeof(PushConstants));
+    vk::DescriptorSetLayout set_layout = *m_set_layout;
+    m_pipeline_layout = vk::raii::PipelineLayout(
+        device,
+        vk::PipelineLayoutCreateInfo({}, set_layout, push_constant_range));
+
+    m_histogram_pipeline = core.create_compute_pipeline(
+        "./shaders/radix_sort_histogram.slang.spirv", m_pipeline_layout);
+    m_scan_pipeline = core.create_compute_pipeline(
+        "./shaders/radix_sort_scan.slang.spirv", m_pipeline_layout);
+    m_scatter_pipeline = core.create_compute_pipeline(
+        "./shaders/radix_sort_scatter.slang.spirv", m_pipeline_layout);
+}
+
+RadixSort::~RadixSort() {}
+
+void RadixSort::record(vk::raii::CommandBuffer const& command_buffer,
+                       uint32_t count, uint32_t key_bits) {
+    assert(count <= m_capacity);
+
+    uint32_t block_count = (count + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    // an even number of passes leaves the result in keys() and values()
+    uint32_t pass_count = (key_bits + RADIX_BITS - 1) / RADIX_BITS;
+    pass_count += pass_count % 2;
+
+    command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute,
+                                      *m_pipeline_layout, 0,
+                                      {m_descriptor_sets.front()}, nullptr);
+
+    for (uint32_t pass = 0; pass < pass_count; pass++) {
+        PushConstants push_constants{
+            .count = count,
+            .shift = pass * RADIX_BITS,
+            .block_count = block_count,
+            .flip = pass % 2,
+        };
+        command_buffer.pushConstants<PushConstants>(
+            *m_pipeline_layout, vk::ShaderStageFlagBits::eCompute, 0,
+            {push_constants});
+
+        command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                                    *m_histogram_pipeline);
+        command_buffer.dispatch(block_count, 1, 1);
+        gfx::util::compute_barrier(command_buffer);
+
+        command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                                    *m_scan_pipeline);
+        command_buffer.dispatch(1, 1, 1);
+        gfx::util::compute_barrier(command_buffer);
+
+        command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                                    *m_scatter_pipeline);
+        command_buffer.dispatch(block_count, 1, 1);
+        gfx::util::compute_barrier(command_buffer);
+    }
+}
+}  // namespace galaxy
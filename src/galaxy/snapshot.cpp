@@ -0,0 +1,334 @@
+#include "galaxy/snapshot.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <limits>
+#include <span>
+#include <stdexcept>
+#include <vulkan/vulkan_enums.hpp>
+#include <vulkan/vulkan_structs.hpp>
+
+#include "gfx/staging.hpp"
+
+// loads stream through staging arenas of this size, small enough to be
+// suballocated from the allocator's blocks
+const static uint64_t LOAD_CHUNK_SIZE = 16ull << 20;
+const static uint32_t LOAD_CHUNKS_IN_FLIGHT = 4;
+
+namespace galaxy {
+static uint64_t align_up(uint64_t value, uint64_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+SnapshotHeader make_snapshot_header(uint32_t star_count, uint64_t step) {
+    SnapshotHeader header{};
+    std::memcpy(header.magic, "GLXSNAP", sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.star_count = star_count;
+    header.step = step;
+    header.positions_offset = SNAPSHOT_ALIGNMENT;
+    header.velocities_offset =
+        align_up(header.positions_offset + sizeof(PositionMass) * star_count,
+                 SNAPSHOT_ALIGNMENT);
+    header.tints_offset =
+        align_up(header.velocities_offset + sizeof(glm::vec4) * star_count,
+                 SNAPSHOT_ALIGNMENT);
+    header.file_size = header.tints_offset + sizeof(PackedTint) * star_count;
+    return header;
+}
+
+std::shared_ptr<GPUStarData> load_snapshot(gfx::Core& core,
+                                           std::string const& path,
+                                           uint64_t& step) {
+    auto start = std::chrono::steady_clock::now();
+
+    int file = open(path.c_str(), O_RDONLY);
+    if (file < 0) {
+        throw std::runtime_error("could not open snapshot " + path);
+    }
+    struct stat file_stat;
+    if (fstat(file, &file_stat) != 0 ||
+        file_stat.st_size < static_cast<off_t>(sizeof(SnapshotHeader))) {
+        close(file);
+        throw std::runtime_error(path + " is not a snapshot");
+    }
+    size_t file_size = file_stat.st_size;
+    void* mapped = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+    if (mapped == MAP_FAILED) {
+        throw std::runtime_error("could not map snapshot " + path);
+    }
+    // the file is read front to back exactly once
+    madvise(mapped, file_size, MADV_SEQUENTIAL);
+    std::unique_ptr<void, std::function<void(void*)>> unmap(
+        mapped, [file_size](void* pointer) { munmap(pointer, file_size); });
+    uint8_t const* data = static_cast<uint8_t const*>(mapped);
+
+    SnapshotHeader header;
+    std::memcpy(&header, data, sizeof(header));
+    SnapshotHeader expected =
+        make_snapshot_header(header.star_count, header.step);
+    if (std::memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0) {
+        throw std::runtime_error(path + " is not a snapshot");
+    }
+    if (header.version != SNAPSHOT_VERSION) {
+        throw std::runtime_error(
+            path + " is a snapshot of version " +
+            std::to_string(header.version) + ", expected " +
+            std::to_string(SNAPSHOT_VERSION));
+    }
+    if (header.star_count == 0 ||
+        std::memcmp(&header, &expected, sizeof(header)) != 0 ||
+        header.file_size > file_size) {
+        throw std::runtime_error(path + " is a damaged snapshot");
+    }
+
+    auto star_data = std::make_shared<GPUStarData>(core, header.star_count);
+
+    struct Section {
+        uint64_t offset;
+        uint64_t size;
+        std::vector<vk::Buffer> destinations;
+    };
+    uint64_t star_count = header.star_count;
+    std::vector<Section> sections = {
+        // both position buffers start from the same data
+        {header.positions_offset,
+         sizeof(PositionMass) * star_count,
+         {*star_data->positions()[0], *star_data->positions()[1]}},
+        {header.velocities_offset,
+         sizeof(glm::vec4) * star_count,
+         {*star_data->velocities()}},
+        {header.tints_offset,
+         sizeof(PackedTint) * star_count,
+         {*star_data->tints()}},
+    };
+
+    // reading the next chunk from the file overlaps with copying the ones
+    // before
+    std::deque<gfx::Upload> uploads;
+    for (Section const& section : sections) {
+        for (uint64_t offset = 0; offset < section.size;
+             offset += LOAD_CHUNK_SIZE) {
+            uint64_t size = std::min(LOAD_CHUNK_SIZE, section.size - offset);
+            if (uploads.size() == LOAD_CHUNKS_IN_FLIGHT) {
+                uploads.front().wait();
+                uploads.pop_front();
+            }
+
+            gfx::StagingArena arena(core, gfx::StagingArena::aligned(size));
+            std::span<uint8_t> staged = arena.allocate<uint8_t>(size);
+            std::memcpy(staged.data(), data + section.offset + offset, size);
+            for (vk::Buffer destination : section.destinations) {
+                arena.copy<uint8_t>(staged, destination, offset);
+            }
+            uploads.push_back(arena.submit());
+        }
+    }
+    for (gfx::Upload& upload : uploads) {
+        upload.wait();
+    }
+
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+    printf("restored %u stars at step %llu from %s (%.1f MiB/s)\n",
+           header.star_count, static_cast<unsigned long long>(header.step),
+           path.c_str(), header.file_size / (1024.0 * 1024.0) / seconds);
+    step = header.step;
+    return star_data;
+}
+
+SnapshotWriter::SnapshotWriter(gfx::Core& core, GPUStarData& star_data,
+                               uint32_t slots)
+    : m_core(core), m_star_data(star_data), m_slots(slots) {}
+
+SnapshotWriter::~SnapshotWriter() { finish(); }
+
+bool SnapshotWriter::record(vk::raii::CommandBuffer const& command_buffer,
+                            uint32_t positions_index, uint64_t step,
+                            std::string const& path, vk::Fence frame_fence) {
+    auto slot = std::find_if(m_slots.begin(), m_slots.end(), [](Slot& slot) {
+        return slot.state == SlotState::eIdle;
+    });
+    if (slot == m_slots.end()) {
+        return false;
+    }
+
+    uint32_t star_count = m_star_data.star_count();
+    SnapshotHeader header = make_snapshot_header(star_count, step);
+    if (!*slot->buffer) {
+        // cached memory makes reading it back on the host fast
+        std::tie(slot->buffer, slot->memory) =
+            m_core.allocator()->create_buffer(
+                vk::BufferCreateInfo({}, header.file_size,
+                                     vk::BufferUsageFlagBits::eTransferDst),
+                vk::MemoryPropertyFlagBits::eHostVisible |
+                    vk::MemoryPropertyFlagBits::eHostCoherent,
+                vk::MemoryPropertyFlagBits::eHostCached);
+    }
+    // the copies below leave the header alone
+    std::memcpy(slot->memory.mapped(), &header, sizeof(header));
+
+    vk::MemoryBarrier2 before_copy(vk::PipelineStageFlagBits2::eAllCommands,
+                                   vk::AccessFlagBits2::eMemoryWrite,
+                                   vk::PipelineStageFlagBits2::eTransfer,
+                                   vk::AccessFlagBits2::eTransferRead);
+    command_buffer.pipelineBarrier2(vk::DependencyInfo({}, before_copy, {}, {}));
+
+    command_buffer.copyBuffer(
+        *m_star_data.positions()[positions_index], *slot->buffer,
+        vk::BufferCopy(0, header.positions_offset,
+                       sizeof(PositionMass) * star_count));
+    command_buffer.copyBuffer(
+        *m_star_data.velocities(), *slot->buffer,
+        vk::BufferCopy(0, header.velocities_offset,
+                       sizeof(glm::vec4) * star_count));
+    command_buffer.copyBuffer(
+        *m_star_data.tints(), *slot->buffer,
+        vk::BufferCopy(0, header.tints_offset,
+                       sizeof(PackedTint) * star_count));
+
+    vk::MemoryBarrier2 after_copy(vk::PipelineStageFlagBits2::eTransfer,
+                                  vk::AccessFlagBits2::eTransferWrite,
+                                  vk::PipelineStageFlagBits2::eHost,
+                                  vk::AccessFlagBits2::eHostRead);
+    command_buffer.pipelineBarrier2(vk::DependencyInfo({}, after_copy, {}, {}));
+
+    slot->state = SlotState::eCopying;
+    slot->fence = frame_fence;
+    slot->path = path;
+    return true;
+}
+
+// written next to the final file and renamed, so a crash never leaves a half
+// written snapshot behind
+static bool write_file(std::string const& path,
+                       std::function<bool(std::FILE*)> const& write) {
+    std::string temporary_path = path + ".tmp";
+    std::FILE* file = std::fopen(temporary_path.c_str(), "wb");
+    if (file == nullptr) {
+        return false;
+    }
+    bool written = write(file);
+    written = std::fclose(file) == 0 && written;
+    std::error_code error;
+    if (written) {
+        std::filesystem::rename(temporary_path, path, error);
+    }
+    if (!written || error) {
+        std::filesystem::remove(temporary_path, error);
+        return false;
+    }
+    return true;
+}
+
+static bool write_snapshot_file(uint8_t const* data, size_t size,
+                                std::string const& path) {
+    return write_file(path, [data, size](std::FILE* file) {
+        return std::fwrite(data, 1, size, file) == size;
+    });
+}
+
+bool write_snapshot(StarData const& star_data, std::string const& path,
+                    std::span<glm::vec4 const> velocities, uint64_t step) {
+    SnapshotHeader header = make_snapshot_header(star_data.size(), step);
+    auto write_at = [](std::FILE* file, uint64_t offset, void const* data,
+                       size_t size) {
+        return fseeko(file, offset, SEEK_SET) == 0 &&
+               std::fwrite(data, 1, size, file) == size;
+    };
+    // without velocities they are left as a hole, which reads back as zeros
+    return write_file(path, [&](std::FILE* file) {
+        return write_at(file, 0, &header, sizeof(header)) &&
+               write_at(file, header.positions_offset,
+                        star_data.positions().data(),
+                        star_data.positions().size_bytes()) &&
+               (velocities.empty() ||
+                write_at(file, header.velocities_offset, velocities.data(),
+                         velocities.size_bytes())) &&
+               write_at(file, header.tints_offset, star_data.tints().data(),
+                        star_data.tints().size_bytes());
+    });
+}
+
+void SnapshotWriter::start_writing(Slot& slot) {
+    slot.state = SlotState::eWriting;
+    slot.written = std::async(
+        std::launch::async, write_snapshot_file,
+        static_cast<uint8_t const*>(slot.memory.mapped()),
+        make_snapshot_header(m_star_data.star_count(), 0).file_size, slot.path);
+}
+
+void SnapshotWriter::poll() {
+    for (Slot& slot : m_slots) {
+        if (slot.state == SlotState::eCopying &&
+            m_core.device()->waitForFences({slot.fence}, vk::True, 0) ==
+                vk::Result::eSuccess) {
+            start_writing(slot);
+        }
+        if (slot.state == SlotState::eWriting &&
+            slot.written.wait_for(std::chrono::seconds(0)) ==
+                std::future_status::ready) {
+            if (slot.written.get()) {
+                printf("wrote snapshot %s\n", slot.path.c_str());
+            } else {
+                printf("error: could not write snapshot %s\n",
+                       slot.path.c_str());
+            }
+            slot.state = SlotState::eIdle;
+        }
+    }
+}
+
+void SnapshotWriter::save(uint32_t positions_index, uint64_t step,
+                          std::string const& path) {
+    // frees a slot if all of them are taken
+    finish();
+
+    vk::raii::Device& device = *m_core.device();
+    vk::raii::CommandBuffers command_buffers(
+        device,
+        vk::CommandBufferAllocateInfo(*m_core.command_pool(),
+                                      vk::CommandBufferLevel::ePrimary, 1));
+    vk::raii::CommandBuffer& command_buffer = command_buffers.front();
+    vk::raii::Fence fence(device, vk::FenceCreateInfo());
+
+    command_buffer.begin(vk::CommandBufferBeginInfo(
+        vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+    record(command_buffer, positions_index, step, path, *fence);
+    command_buffer.end();
+    m_core.graphics_queue()->submit(vk::SubmitInfo({}, {}, *command_buffer),
+                                    *fence);
+    // the fence has to outlive the wait in finish()
+    finish();
+}
+
+void SnapshotWriter::finish() {
+    for (Slot& slot : m_slots) {
+        if (slot.state == SlotState::eCopying) {
+            while (m_core.device()->waitForFences(
+                       {slot.fence}, vk::True,
+                       std::numeric_limits<uint64_t>::max()) ==
+                   vk::Result::eTimeout);
+            start_writing(slot);
+        }
+    }
+    for (Slot& slot : m_slots) {
+        if (slot.state == SlotState::eWriting) {
+            slot.written.wait();
+        }
+    }
+    poll();
+}
+}  // namespace galaxy
@@ -0,0 +1,197 @@
+#include "galaxy/sprite_renderer.hpp"
+
+#include <array>
+#include <vulkan/vulkan_enums.hpp>
+#include <vulkan/vulkan_raii.hpp>
+#include <vulkan/vulkan_structs.hpp>
+
+#include "gfx/utils.hpp"
+
+// blending into 16 bit floats is supported everywhere, unlike 32 bit
+const static vk::Format HDR_FORMAT = vk::Format::eR16G16B16A16Sfloat;
+// must match numthreads of sprite_resolve.slang
+const static uint32_t RESOLVE_WORKGROUP_SIZE = 8;
+// sizeof(VkDrawIndirectCommand)
+const static vk::DeviceSize DRAW_ARGUMENTS_SIZE = sizeof(uint32_t) * 4;
+
+namespace galaxy {
+SpriteRenderer::SpriteRenderer(
+    gfx::Core& core, GPUStarData& star_data,
+    vk::raii::DescriptorSetLayout const& draw_set_layout,
+    glm::ivec2 screen_dimensions, float threshold)
+    : m_star_data(star_data) {
+    vk::raii::Device& device = *core.device();
+
+    m_push_constants = PushConstants{
+        .screen_dimensions = screen_dimensions,
+        .positions_index = 0,
+        .threshold = threshold,
+    };
+
+    std::tie(m_draw_arguments, m_draw_arguments_memory) =
+        gfx::util::make_buffer(*core.allocator(), DRAW_ARGUMENTS_SIZE,
+                               vk::BufferUsageFlagBits::eStorageBuffer |
+                                   vk::BufferUsageFlagBits::eIndirectBuffer,
+                               vk::MemoryPropertyFlagBits::eDeviceLocal);
+
+    vk::ImageCreateInfo image_ci(
+        {}, vk::ImageType::e2D, HDR_FORMAT,
+        vk::Extent3D(screen_dimensions.x, screen_dimensions.y, 1), 1, 1,
+        vk::SampleCountFlagBits::e1, vk::ImageTiling::eOptimal,
+        vk::ImageUsageFlagBits::eColorAttachment |
+            vk::ImageUsageFlagBits::eStorage);
+    std::tie(m_hdr_image, m_hdr_image_memory) = core.allocator()->create_image(
+        image_ci, vk::MemoryPropertyFlagBits::eDeviceLocal);
+    m_hdr_image_view = vk::raii::ImageView(
+        device,
+        vk::ImageViewCreateInfo(
+            {}, *m_hdr_image, vk::ImageViewType::e2D, HDR_FORMAT, {},
+            vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1,
+                                      0, 1)));
+
+    m_set_layout =
+        vk::raii::DescriptorSetLayout(gfx::util::make_descriptor_set_layout(
+            device, {{vk::DescriptorType::eStorageBuffer, 1,
+                      vk::ShaderStageFlagBits::eCompute},
+                     {vk::DescriptorType::eStorageImage, 1,
+                      vk::ShaderStageFlagBits::eCompute}}));
+
+    std::vector<vk::DescriptorPoolSize> pool_sizes = {
+        {vk::DescriptorType::eStorageBuffer, 1},
+        {vk::DescriptorType::eStorageImage, 1}};
+
+    vk::DescriptorPoolCreateInfo pool_create_info(
+        vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet, 1, pool_sizes);
+    m_descriptor_pool = vk::raii::DescriptorPool(device, pool_create_info);
+
+    vk::DescriptorSetAllocateInfo set_allocate_info(*m_descriptor_pool,
+                                                    *m_set_layout);
+    m_descriptor_sets = vk::raii::DescriptorSets(device, set_allocate_info);
+
+    vk::DescriptorBufferInfo draw_arguments_info(*m_draw_arguments, 0,
+                                                 vk::WholeSize);
+    vk::DescriptorImageInfo hdr_image_info(nullptr, *m_hdr_image_view,
+                                           vk::ImageLayout::eGeneral);
+    device.updateDescriptorSets(
+        {vk::WriteDescriptorSet(m_descriptor_sets.front(), 0, 0,
+                                vk::DescriptorType::eStorageBuffer, nullptr,
+                                draw_arguments_info),
+         vk::WriteDescriptorSet(m_descriptor_sets.front(), 1, 0,
+                                vk::DescriptorType::eStorageImage,
+                                hdr_image_info, nullptr)},
+        nullptr);
+
+    std::array<vk::DescriptorSetLayout, 3> set_layouts = {
+        *draw_set_layout, *star_data.descriptor_set_layout(), *m_set_layout};
+    vk::PushConstantRange push_constant_range(
+        vk::ShaderStageFlagBits::eCompute | vk::ShaderStageFlagBits::eVertex,
+        0, sizeof(PushConstants));
+    m_pipeline_layout = vk::raii::PipelineLayout(
+        device,
+        vk::PipelineLayoutCreateInfo({}, set_layouts, push_constant_range));
+
+    m_arguments_pipeline = core.create_compute_pipeline(
+        "./shaders/sprite_arguments.slang.spirv", m_pipeline_layout);
+    m_resolve_pipeline = core.create_compute_pipeline(
+        "./shaders/sprite_resolve.slang.spirv", m_pipeline_layout);
+
+    // dst += src for every channel
+    vk::PipelineColorBlendAttachmentState additive_blend(
+        true, vk::BlendFactor::eOne, vk::BlendFactor::eOne,
+        vk::BlendOp::eAdd, vk::BlendFactor::eOne, vk::BlendFactor::eOne,
+        vk::BlendOp::eAdd,
+        vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG |
+            vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA);
+    m_sprite_pipeline = core.create_graphics_pipeline(
+        "./shaders/sprite_vertex.slang.spirv",
+        "./shaders/sprite_fragment.slang.spirv", m_pipeline_layout,
+        HDR_FORMAT, additive_blend);
+}
+
+SpriteRenderer::~SpriteRenderer() {}
+
+void SpriteRenderer::bind(vk::raii::CommandBuffer const& command_buffer,
+                          vk::PipelineBindPoint bind_point,
+                          vk::DescriptorSet draw_set) {
+    command_buffer.bindDescriptorSets(
+        bind_point, *m_pipeline_layout, 0,
+        {draw_set, m_star_data.descriptor_sets().front(),
+         m_descriptor_sets.front()},
+        nullptr);
+}
+
+void SpriteRenderer::record(vk::raii::CommandBuffer const& command_buffer,
+                            vk::DescriptorSet draw_set,
+                            uint32_t positions_index) {
+    m_push_constants.positions_index = positions_index;
+    glm::ivec2 screen = m_push_constants.screen_dimensions;
+    vk::ImageSubresourceRange color_range(vk::ImageAspectFlagBits::eColor, 0,
+                                          1, 0, 1);
+
+    bind(command_buffer, vk::PipelineBindPoint::eCompute, draw_set);
+    command_buffer.pushConstants<PushConstants>(
+        *m_pipeline_layout,
+        vk::ShaderStageFlagBits::eCompute | vk::ShaderStageFlagBits::eVertex,
+        0, {m_push_constants});
+    command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                                *m_arguments_pipeline);
+    command_buffer.dispatch(1, 1, 1);
+
+    // The draw arguments, and the star buffers the simulation, the sort and
+    // the culling wrote, for the vertex shader. The previous frame's resolve
+    // has to be done reading the attachment, which is cleared anyway.
+    vk::MemoryBarrier2 compute_to_vertex_barrier(
+        vk::PipelineStageFlagBits2::eComputeShader |
+            vk::PipelineStageFlagBits2::eTransfer,
+        vk::AccessFlagBits2::eShaderWrite | vk::AccessFlagBits2::eTransferWrite,
+        vk::PipelineStageFlagBits2::eDrawIndirect |
+            vk::PipelineStageFlagBits2::eVertexShader,
+        vk::AccessFlagBits2::eIndirectCommandRead |
+            vk::AccessFlagBits2::eShaderStorageRead);
+    vk::ImageMemoryBarrier2 resolve_to_attachment_barrier(
+        vk::PipelineStageFlagBits2::eComputeShader, {},
+        vk::PipelineStageFlagBits2::eColorAttachmentOutput,
+        vk::AccessFlagBits2::eColorAttachmentWrite |
+            vk::AccessFlagBits2::eColorAttachmentRead,
+        vk::ImageLayout::eUndefined, vk::ImageLayout::eColorAttachmentOptimal,
+        VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, *m_hdr_image,
+        color_range);
+    command_buffer.pipelineBarrier2(vk::DependencyInfo(
+        {}, compute_to_vertex_barrier, {}, resolve_to_attachment_barrier));
+
+    vk::Rect2D render_area({0, 0}, {static_cast<uint32_t>(screen.x),
+                                    static_cast<uint32_t>(screen.y)});
+    vk::RenderingAttachmentInfo color_attachment(
+        *m_hdr_image_view, vk::ImageLayout::eColorAttachmentOptimal, {}, {},
+        {}, vk::AttachmentLoadOp::eClear, vk::AttachmentStoreOp::eStore,
+        vk::ClearColorValue(0.0f, 0.0f, 0.0f, 0.0f));
+    command_buffer.beginRendering(
+        vk::RenderingInfo({}, render_area, 1, 0, color_attachment));
+    command_buffer.setViewport(
+        0, vk::Viewport(0.0f, 0.0f, static_cast<float>(screen.x),
+                        static_cast<float>(screen.y), 0.0f, 1.0f));
+    command_buffer.setScissor(0, render_area);
+    bind(command_buffer, vk::PipelineBindPoint::eGraphics, draw_set);
+    command_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics,
+                                *m_sprite_pipeline);
+    command_buffer.drawIndirect(*m_draw_arguments, 0, 1, DRAW_ARGUMENTS_SIZE);
+    command_buffer.endRendering();
+
+    vk::ImageMemoryBarrier2 attachment_to_resolve_barrier(
+        vk::PipelineStageFlagBits2::eColorAttachmentOutput,
+        vk::AccessFlagBits2::eColorAttachmentWrite,
+        vk::PipelineStageFlagBits2::eComputeShader,
+        vk::AccessFlagBits2::eShaderStorageRead,
+        vk::ImageLayout::eColorAttachmentOptimal, vk::ImageLayout::eGeneral,
+        VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, *m_hdr_image,
+        color_range);
+    command_buffer.pipelineBarrier2(
+        vk::DependencyInfo({}, {}, {}, attachment_to_resolve_barrier));
+
+    command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                                *m_resolve_pipeline);
+    command_buffer.dispatch(
+        (screen.x + RESOLVE_WORKGROUP_SIZE - 1) / RESOLVE_WORKGROUP_SIZE,
+        (screen.y + RESOLVE_WORKGROUP_SIZE - 1) / RESOLVE_WORKGROUP_SIZE, 1);
+}
+}  // namespace galaxy
@@ -0,0 +1,343 @@
+#include "galaxy/star_sort.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <numeric>
+#include <span>
+#include <vector>
+#include <vulkan/vulkan_enums.hpp>
+#include <vulkan/vulkan_raii.hpp>
+#include <vulkan/vulkan_structs.hpp>
+
+#include "galaxy/barnes_hut.hpp"
+#include "galaxy/initial_conditions.hpp"
+#include "gfx/readback.hpp"
+#include "gfx/staging.hpp"
+#include "gfx/utils.hpp"
+
+// must match numthreads of the star_sort_*.slang kernels
+const static uint32_t WORKGROUP_SIZE = 256;
+// bits of the codes morton_code() in morton.slangh computes
+const static uint32_t MORTON_BITS = 30;
+// sorts (or steps) recorded into one submission per benchmark measurement
+const static uint32_t BENCHMARK_REPETITIONS = 8;
+
+namespace galaxy {
+StarSort::StarSort(gfx::Core& core, GPUStarData& star_data)
+    : m_star_data(star_data), m_radix_sort(core, star_data.star_count()) {
+    vk::raii::Device& device = *core.device();
+    uint32_t star_count = star_data.star_count();
+    vk::DeviceSize uint_size = sizeof(uint32_t) * star_count;
+
+    std::tie(m_bounds, m_bounds_memory) = gfx::util::make_buffer(
+        *core.allocator(), sizeof(uint32_t) * 6,
+        vk::BufferUsageFlagBits::eStorageBuffer |
+            vk::BufferUsageFlagBits::eTransferDst,
+        vk::MemoryPropertyFlagBits::eDeviceLocal);
+    auto make_scratch = [&](vk::DeviceSize size) {
+        return gfx::util::make_buffer(*core.allocator(), size,
+                                      vk::BufferUsageFlagBits::eStorageBuffer,
+                                      vk::MemoryPropertyFlagBits::eDeviceLocal);
+    };
+    std::tie(m_scratch_positions, m_scratch_positions_memory) =
+        make_scratch(sizeof(PositionMass) * star_count);
+    std::tie(m_scratch_velocities, m_scratch_velocities_memory) =
+        make_scratch(sizeof(glm::vec4) * star_count);
+    std::tie(m_scratch_tints, m_scratch_tints_memory) =
+        make_scratch(sizeof(PackedTint) * star_count);
+    std::tie(m_scratch_ids, m_scratch_ids_memory) = make_scratch(uint_size);
+
+    // the ids are uploaded, and read back by the trajectory writer on the
+    // graphics queue while the sort may run on the compute queue
+    vk::BufferCreateInfo ids_create_info(
+        {}, uint_size,
+        vk::BufferUsageFlagBits::eStorageBuffer |
+            vk::BufferUsageFlagBits::eTransferDst |
+            vk::BufferUsageFlagBits::eTransferSrc);
+    std::vector<uint32_t> queue_family_indices = core.upload_family_indices();
+    if (queue_family_indices.size() > 1) {
+        ids_create_info.setSharingMode(vk::SharingMode::eConcurrent)
+            .setQueueFamilyIndices(queue_family_indices);
+    }
+    std::tie(m_star_ids, m_star_ids_memory) = core.allocator()->create_buffer(
+        ids_create_info, vk::MemoryPropertyFlagBits::eDeviceLocal);
+    gfx::StagingArena arena(core, gfx::StagingArena::aligned(uint_size));
+    std::span<uint32_t> ids = arena.stage<uint32_t>(*m_star_ids, star_count);
+    std::iota(ids.begin(), ids.end(), 0u);
+    arena.submit().wait();
+
+    m_set_layout =
+        vk::raii::DescriptorSetLayout(gfx::util::make_descriptor_set_layout(
+            device, {{vk::DescriptorType::eStorageBuffer, 1,
+                      vk::ShaderStageFlagBits::eCompute},
+                     {vk::DescriptorType::eStorageBuffer, 1,
+                      vk::ShaderStageFlagBits::eCompute},
+                     {vk::DescriptorType::eStorageBuffer, 1,
+                      vk::ShaderStageFlagBits::eCompute},
+                     {vk::DescriptorType::eStorageBuffer, 1,
+                      vk::ShaderStageFlagBits::eCompute},
+                     {vk::DescriptorType::eStorageBuffer, 1,
+                      vk::ShaderStageFlagBits::eCompute},
+                     {vk::DescriptorType::eStorageBuffer, 1,
+                      vk::ShaderStageFlagBits::eCompute},
+                     {vk::DescriptorType::eStorageBuffer, 1,
+                      vk::ShaderStageFlagBits::eCompute},
+                     {vk::DescriptorType::eStorageBuffer, 1,
+                      vk::ShaderStageFlagBits::eCompute}}));
+
+    std::vector<vk::DescriptorPoolSize> pool_sizes = {
+        {vk::DescriptorType::eStorageBuffer, 8}};
+
+    vk::DescriptorPoolCreateInfo pool_create_info(
+        vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet, 1, pool_sizes);
+    m_descriptor_pool = vk::raii::DescriptorPool(device, pool_create_info);
+
+    vk::DescriptorSetAllocateInfo set_allocate_info(*m_descriptor_pool,
+                                                    *m_set_layout);
+    m_descriptor_sets = vk::raii::DescriptorSets(device, set_allocate_info);
+
+    // the radix sort's key/value buffers hold the Morton codes and the star
+    // each sorted slot is gathered from
+    gfx::util::update_storage_buffer_descriptors(
+        device, m_descriptor_sets.front(),
+        {m_bounds, m_radix_sort.keys(), m_radix_sort.values(),
+         m_scratch_positions, m_scratch_velocities, m_scratch_tints,
+         m_star_ids, m_scratch_ids});
+
+    std::array<vk::DescriptorSetLayout, 2> set_layouts = {
+        *m_set_layout, *star_data.descriptor_set_layout()};
+    vk::PushConstantRange push_constant_range(
+        vk::ShaderStageFlagBits::eCompute, 0, sizeof(PushConstants));
+    m_pipeline_layout = vk::raii::PipelineLayout(
+        device,
+        vk::PipelineLayoutCreateInfo({}, set_layouts, push_constant_range));
+
+    m_bounds_pipeline = core.create_compute_pipeline(
+        "./shaders/star_sort_bounds.slang.spirv", m_pipeline_layout);
+    m_morton_pipeline = core.create_compute_pipeline(
+        "./shaders/star_sort_morton.slang.spirv", m_pipeline_layout);
+    m_gather_pipeline = core.create_compute_pipeline(
+        "./shaders/star_sort_gather.slang.spirv", m_pipeline_layout);
+}
+
+StarSort::~StarSort() {}
+
+void StarSort::dispatch(vk::raii::CommandBuffer const& command_buffer,
+                        vk::raii::Pipeline const& pipeline,
+                        uint32_t positions_index) {
+    PushConstants push_constants{
+        .star_count = m_star_data.star_count(),
+        .positions_index = positions_index,
+    };
+
+    command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute, *pipeline);
+    command_buffer.bindDescriptorSets(
+        vk::PipelineBindPoint::eCompute, *m_pipeline_layout, 0,
+        {m_descriptor_sets.front(), m_star_data.descriptor_sets().front()},
+        nullptr);
+    command_buffer.pushConstants<PushConstants>(
+        *m_pipeline_layout, vk::ShaderStageFlagBits::eCompute, 0,
+        {push_constants});
+    command_buffer.dispatch(
+        (push_constants.star_count + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, 1,
+        1);
+}
+
+void StarSort::record(vk::raii::CommandBuffer const& command_buffer,
+                      uint32_t positions_index) {
+    // the last sort's Morton pass may still be reading the bounds
+    vk::MemoryBarrier2 before_reset(vk::PipelineStageFlagBits2::eComputeShader,
+                                    vk::AccessFlagBits2::eShaderRead,
+                                    vk::PipelineStageFlagBits2::eTransfer,
+                                    vk::AccessFlagBits2::eTransferWrite);
+    command_buffer.pipelineBarrier2(
+        vk::DependencyInfo({}, before_reset, {}, {}));
+    // bounds start out as an empty box
+    command_buffer.fillBuffer(*m_bounds, 0, sizeof(uint32_t) * 3, 0xFFFFFFFF);
+    command_buffer.fillBuffer(*m_bounds, sizeof(uint32_t) * 3,
+                              sizeof(uint32_t) * 3, 0);
+    gfx::util::compute_barrier(command_buffer);
+
+    dispatch(command_buffer, m_bounds_pipeline, positions_index);
+    gfx::util::compute_barrier(command_buffer);
+    dispatch(command_buffer, m_morton_pipeline, positions_index);
+    gfx::util::compute_barrier(command_buffer);
+
+    m_radix_sort.record(command_buffer, m_star_data.star_count(), MORTON_BITS);
+
+    dispatch(command_buffer, m_gather_pipeline, positions_index);
+}
+
+// what morton_code() in morton.slangh computes
+static uint32_t morton_code(glm::vec3 position, glm::vec3 bounds_min,
+                            glm::vec3 bounds_max) {
+    auto expand_bits = [](uint32_t v) {
+        v = (v * 0x00010001u) & 0xFF0000FFu;
+        v = (v * 0x00000101u) & 0x0F00F00Fu;
+        v = (v * 0x00000011u) & 0xC30C30C3u;
+        v = (v * 0x00000005u) & 0x49249249u;
+        return v;
+    };
+    glm::vec3 extent = glm::max(bounds_max - bounds_min, glm::vec3(1.0f));
+    glm::vec3 normalized =
+        glm::clamp((position - bounds_min) / extent, 0.0f, 1.0f);
+    glm::uvec3 cell =
+        glm::min(glm::uvec3(normalized * 1024.0f), glm::uvec3(1023));
+    return (expand_bits(cell.x) << 2) | (expand_bits(cell.y) << 1) |
+           expand_bits(cell.z);
+}
+
+// the stars in the buffers of star_data
+struct StarBuffers {
+    std::vector<PositionMass> positions;
+    std::vector<glm::vec4> velocities;
+    std::vector<PackedTint> tints;
+};
+
+static StarBuffers read_stars(gfx::Core& core, GPUStarData& star_data) {
+    uint32_t star_count = star_data.star_count();
+    return StarBuffers{
+        .positions = gfx::read_back<PositionMass>(
+            core, *star_data.positions()[0], star_count),
+        .velocities = gfx::read_back<glm::vec4>(
+            core, *star_data.velocities(), star_count),
+        .tints = gfx::read_back<PackedTint>(core, *star_data.tints(),
+                                            star_count),
+    };
+}
+
+// generated stars in random order, clustered like a real galaxy
+static void generate_stars(gfx::Core& core, GPUStarData& star_data) {
+    InitialConditions initial_conditions(core, star_data);
+    gfx::submit_and_wait(core, [&](vk::raii::CommandBuffer const& cmd) {
+        initial_conditions.record(cmd, InitialModel::ePlummer, 1, 1.0e10f,
+                                  1.0e20f);
+    });
+}
+
+bool check_star_sort(gfx::Core& core, uint32_t star_count) {
+    GPUStarData star_data(core, star_count);
+    generate_stars(core, star_data);
+    StarSort star_sort(core, star_data);
+    StarBuffers original = read_stars(core, star_data);
+
+    glm::vec3 bounds_min(std::numeric_limits<float>::max());
+    glm::vec3 bounds_max(std::numeric_limits<float>::lowest());
+    for (PositionMass const& position : original.positions) {
+        bounds_min = glm::min(bounds_min, position.position);
+        bounds_max = glm::max(bounds_max, position.position);
+    }
+
+    bool passed = true;
+    // the second round sorts stars that are sorted already, and checks that
+    // the ids still lead back to the original stars
+    for (uint32_t round = 0; round < 2; round++) {
+        gfx::submit_and_wait(core, [&](vk::raii::CommandBuffer const& cmd) {
+            star_sort.record(cmd, 0);
+        });
+        StarBuffers sorted = read_stars(core, star_data);
+        std::vector<uint32_t> ids =
+            gfx::read_back<uint32_t>(core, *star_sort.star_ids(), star_count);
+        std::vector<uint32_t> keys =
+            gfx::read_back<uint32_t>(core, *star_sort.keys(), star_count);
+
+        uint32_t bad_ids = 0;
+        uint32_t bad_stars = 0;
+        uint32_t unordered = 0;
+        uint32_t bad_keys = 0;
+        std::vector<bool> seen(star_count, false);
+        for (uint32_t i = 0; i < star_count; i++) {
+            uint32_t id = ids[i];
+            if (id >= star_count || seen[id]) {
+                bad_ids++;
+                continue;
+            }
+            seen[id] = true;
+            // the stars have to be moved bit for bit
+            bool moved =
+                std::memcmp(&sorted.positions[i], &original.positions[id],
+                            sizeof(PositionMass)) == 0 &&
+                std::memcmp(&sorted.velocities[i], &original.velocities[id],
+                            sizeof(glm::vec4)) == 0 &&
+                std::memcmp(&sorted.tints[i], &original.tints[id],
+                            sizeof(PackedTint)) == 0;
+            bad_stars += !moved;
+            unordered += i > 0 && keys[i - 1] > keys[i];
+            bad_keys += keys[i] != morton_code(sorted.positions[i].position,
+                                               bounds_min, bounds_max);
+        }
+
+        // the GPU may round a division differently and put a star right on a
+        // cell boundary into the neighbouring cell
+        bool round_passed = bad_ids == 0 && bad_stars == 0 && unordered == 0 &&
+                            bad_keys <= star_count / 1000;
+        printf("star sort round %u: %u bad ids, %u misplaced stars, %u keys "
+               "out of order, %u keys differing from the host: %s\n",
+               round + 1, bad_ids, bad_stars, unordered, bad_keys,
+               round_passed ? "passed" : "FAILED");
+        passed = passed && round_passed;
+    }
+    return passed;
+}
+
+// seconds BENCHMARK_REPETITIONS recordings take on the GPU, after a warm-up
+static double time_repetitions(
+    gfx::Core& core,
+    std::function<void(vk::raii::CommandBuffer const&)> const& record) {
+    auto repeat = [&](vk::raii::CommandBuffer const& command_buffer) {
+        for (uint32_t i = 0; i < BENCHMARK_REPETITIONS; i++) {
+            record(command_buffer);
+            gfx::util::compute_barrier(command_buffer);
+        }
+    };
+    gfx::submit_and_wait(core, repeat);
+    auto start = std::chrono::steady_clock::now();
+    gfx::submit_and_wait(core, repeat);
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         start)
+        .count();
+}
+
+void benchmark_star_sort(gfx::Core& core) {
+    // the stars, the sort and the Barnes-Hut tree take a little under 256
+    // bytes per star, a quarter of the free memory leaves room for the rest
+    uint32_t max_star_count = static_cast<uint32_t>(std::min<vk::DeviceSize>(
+        1u << 22, core.allocator()->device_local_available() / 4 / 256));
+
+    printf("star sort benchmark, %u repetitions per size\n",
+           BENCHMARK_REPETITIONS);
+    printf("%10s %10s %14s %18s %16s\n", "stars", "sort ms", "Mstars/s",
+           "unsorted step ms", "sorted step ms");
+    for (uint32_t star_count = 1u << 16; star_count <= max_star_count;
+         star_count *= 4) {
+        GPUStarData star_data(core, star_count);
+        generate_stars(core, star_data);
+        StarSort star_sort(core, star_data);
+        BarnesHut barnes_hut(core, star_data, 0.5f);
+
+        // every step reads the same position buffer, so all repetitions see
+        // the same order
+        auto step = [&](vk::raii::CommandBuffer const& command_buffer) {
+            barnes_hut.record(command_buffer, 0);
+        };
+        double unsorted_seconds = time_repetitions(core, step);
+        double sort_seconds =
+            time_repetitions(core, [&](vk::raii::CommandBuffer const& cmd) {
+                star_sort.record(cmd, 0);
+            });
+        double sorted_seconds = time_repetitions(core, step);
+
+        double milliseconds = 1000.0 / BENCHMARK_REPETITIONS;
+        printf("%10u %10.3f %14.1f %18.3f %16.3f\n", star_count,
+               sort_seconds * milliseconds,
+               BENCHMARK_REPETITIONS * star_count / sort_seconds / 1.0e6,
+               unsorted_seconds * milliseconds,
+               sorted_seconds * milliseconds);
+    }
+}
+}  // namespace galaxy
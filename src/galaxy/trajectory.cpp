@@ -0,0 +1,483 @@
+#include "galaxy/trajectory.hpp"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <vulkan/vulkan_enums.hpp>
+#include <vulkan/vulkan_structs.hpp>
+
+// chunks are cut once they would exceed this many bytes before compression,
+// which bounds the cost of seeking to a frame in the middle of one
+const static uint64_t CHUNK_TARGET_SIZE = 32ull << 20;
+const static uint32_t MAX_FRAMES_PER_CHUNK = 64;
+
+namespace galaxy {
+// bytes one encoded frame takes before compression
+static uint64_t frame_size(uint32_t star_count) {
+    return 3ull * sizeof(uint16_t) * star_count;
+}
+
+// maps small differences of either sign to small unsigned values
+static uint16_t zigzag(uint16_t difference) {
+    int16_t value = static_cast<int16_t>(difference);
+    return static_cast<uint16_t>((value << 1) ^ (value >> 15));
+}
+
+static uint16_t unzigzag(uint16_t value) {
+    return static_cast<uint16_t>((value >> 1) ^ -(value & 1));
+}
+
+TrajectoryWriter::TrajectoryWriter(gfx::Core& core, GPUStarData& star_data,
+                                   std::string const& path, uint32_t slots,
+                                   vk::Buffer star_ids)
+    : m_core(core),
+      m_star_data(star_data),
+      m_star_ids(star_ids),
+      m_path(path),
+      m_slots(slots) {
+    uint32_t star_count = star_data.star_count();
+    m_frames_per_chunk = static_cast<uint32_t>(std::clamp<uint64_t>(
+        CHUNK_TARGET_SIZE / frame_size(star_count), 1, MAX_FRAMES_PER_CHUNK));
+
+    m_file = std::fopen(path.c_str(), "wb");
+    if (m_file == nullptr) {
+        throw std::runtime_error("could not create trajectory " + path);
+    }
+    // rewritten with the counts and the index offset by finish()
+    TrajectoryHeader header{};
+    if (!write(&header, sizeof(header))) {
+        std::fclose(m_file);
+        throw std::runtime_error("could not write trajectory " + path);
+    }
+
+    if (m_star_ids) {
+        m_ordered.resize(star_count);
+    }
+    m_previous.resize(3ull * star_count);
+    m_current.resize(3ull * star_count);
+    m_worker = std::thread(&TrajectoryWriter::work, this);
+}
+
+TrajectoryWriter::~TrajectoryWriter() { finish(); }
+
+bool TrajectoryWriter::record(vk::raii::CommandBuffer const& command_buffer,
+                              uint32_t positions_index, uint64_t step,
+                              vk::Fence frame_fence) {
+    auto slot = std::find_if(m_slots.begin(), m_slots.end(), [](Slot& slot) {
+        return slot.state.load(std::memory_order_acquire) == SlotState::eIdle;
+    });
+    if (slot == m_slots.end() || !m_worker.joinable()) {
+        return false;
+    }
+
+    uint32_t star_count = m_star_data.star_count();
+    vk::DeviceSize size = sizeof(PositionMass) * star_count;
+    vk::DeviceSize ids_size = m_star_ids ? sizeof(uint32_t) * star_count : 0;
+    if (!*slot->buffer) {
+        // cached memory makes reading it back on the host fast
+        std::tie(slot->buffer, slot->memory) =
+            m_core.allocator()->create_buffer(
+                vk::BufferCreateInfo({}, size + ids_size,
+                                     vk::BufferUsageFlagBits::eTransferDst),
+                vk::MemoryPropertyFlagBits::eHostVisible |
+                    vk::MemoryPropertyFlagBits::eHostCoherent,
+                vk::MemoryPropertyFlagBits::eHostCached);
+    }
+
+    vk::MemoryBarrier2 before_copy(vk::PipelineStageFlagBits2::eAllCommands,
+                                   vk::AccessFlagBits2::eMemoryWrite,
+                                   vk::PipelineStageFlagBits2::eTransfer,
+                                   vk::AccessFlagBits2::eTransferRead);
+    command_buffer.pipelineBarrier2(vk::DependencyInfo({}, before_copy, {}, {}));
+    command_buffer.copyBuffer(*m_star_data.positions()[positions_index],
+                              *slot->buffer, vk::BufferCopy(0, 0, size));
+    if (m_star_ids) {
+        command_buffer.copyBuffer(m_star_ids, *slot->buffer,
+                                  vk::BufferCopy(0, size, ids_size));
+    }
+    vk::MemoryBarrier2 after_copy(vk::PipelineStageFlagBits2::eTransfer,
+                                  vk::AccessFlagBits2::eTransferWrite,
+                                  vk::PipelineStageFlagBits2::eHost,
+                                  vk::AccessFlagBits2::eHostRead);
+    command_buffer.pipelineBarrier2(vk::DependencyInfo({}, after_copy, {}, {}));
+
+    slot->state.store(SlotState::eCopying, std::memory_order_relaxed);
+    slot->fence = frame_fence;
+    slot->step = step;
+    return true;
+}
+
+void TrajectoryWriter::queue(Slot& slot) {
+    slot.state.store(SlotState::eEncoding, std::memory_order_relaxed);
+    {
+        std::lock_guard lock(m_mutex);
+        m_queue.push_back(&slot);
+    }
+    m_wake.notify_one();
+}
+
+void TrajectoryWriter::poll() {
+    // Frames are encoded in step order, which the ring order of the slots
+    // isn't. A later frame's fence may already be checked as signaled when
+    // an earlier one's wasn't yet, so it has to wait for the next poll.
+    std::vector<Slot*> copying;
+    for (Slot& slot : m_slots) {
+        if (slot.state.load(std::memory_order_relaxed) == SlotState::eCopying) {
+            copying.push_back(&slot);
+        }
+    }
+    std::sort(copying.begin(), copying.end(),
+              [](Slot* a, Slot* b) { return a->step < b->step; });
+    for (Slot* slot : copying) {
+        if (m_core.device()->waitForFences({slot->fence}, vk::True, 0) !=
+            vk::Result::eSuccess) {
+            break;
+        }
+        queue(*slot);
+    }
+}
+
+void TrajectoryWriter::work() {
+    while (true) {
+        Slot* slot;
+        {
+            std::unique_lock lock(m_mutex);
+            m_wake.wait(lock, [this] { return m_stopping || !m_queue.empty(); });
+            if (m_queue.empty()) {
+                break;
+            }
+            slot = m_queue.front();
+            m_queue.pop_front();
+        }
+        if (!m_failed) {
+            encode(*slot);
+        }
+        slot->state.store(SlotState::eIdle, std::memory_order_release);
+    }
+    if (!m_failed && !m_chunk.empty()) {
+        write_chunk();
+    }
+}
+
+void TrajectoryWriter::encode(Slot& slot) {
+    uint32_t star_count = m_star_data.star_count();
+    PositionMass const* positions =
+        static_cast<PositionMass const*>(slot.memory.mapped());
+    if (m_star_ids) {
+        // the ids follow the positions
+        uint32_t const* ids =
+            reinterpret_cast<uint32_t const*>(positions + star_count);
+        for (uint32_t i = 0; i < star_count; i++) {
+            m_ordered[ids[i]] = positions[i];
+        }
+        positions = m_ordered.data();
+    }
+
+    // stars that were flung to infinity or NaN must not stretch the box
+    glm::vec3 min(std::numeric_limits<float>::max());
+    glm::vec3 max(std::numeric_limits<float>::lowest());
+    for (uint32_t i = 0; i < star_count; i++) {
+        glm::vec3 position = positions[i].position;
+        if (std::isfinite(position.x) && std::isfinite(position.y) &&
+            std::isfinite(position.z)) {
+            min = glm::min(min, position);
+            max = glm::max(max, position);
+        }
+    }
+    if (min.x > max.x) {
+        min = max = glm::vec3(0.0f);
+    }
+    glm::vec3 extent = max - min;
+
+    for (uint32_t axis = 0; axis < 3; axis++) {
+        float scale = extent[axis] > 0.0f ? TRAJECTORY_LEVELS / extent[axis]
+                                          : 0.0f;
+        uint16_t* quantized = m_current.data() + axis * star_count;
+        for (uint32_t i = 0; i < star_count; i++) {
+            float value = (positions[i].position[axis] - min[axis]) * scale;
+            // also catches NaN
+            if (!(value >= 0.0f)) {
+                value = 0.0f;
+            }
+            quantized[i] = static_cast<uint16_t>(
+                std::min(value, static_cast<float>(TRAJECTORY_LEVELS)) + 0.5f);
+        }
+    }
+
+    // the first frame of a chunk is stored as is, the others as the
+    // difference to the frame before
+    bool key_frame = m_chunk.empty();
+    size_t offset = m_chunk.size();
+    m_chunk.resize(offset + frame_size(star_count));
+    for (uint32_t axis = 0; axis < 3; axis++) {
+        uint16_t const* current = m_current.data() + axis * star_count;
+        uint16_t const* previous = m_previous.data() + axis * star_count;
+        uint8_t* low = m_chunk.data() + offset + 2ull * axis * star_count;
+        uint8_t* high = low + star_count;
+        for (uint32_t i = 0; i < star_count; i++) {
+            uint16_t value =
+                key_frame ? current[i]
+                          : zigzag(static_cast<uint16_t>(current[i] -
+                                                         previous[i]));
+            low[i] = static_cast<uint8_t>(value);
+            high[i] = static_cast<uint8_t>(value >> 8);
+        }
+    }
+    std::swap(m_current, m_previous);
+
+    TrajectoryFrame frame{};
+    frame.step = slot.step;
+    for (uint32_t axis = 0; axis < 3; axis++) {
+        frame.min[axis] = min[axis];
+        frame.max[axis] = max[axis];
+    }
+    m_frames.push_back(frame);
+
+    if (m_chunk.size() >= m_frames_per_chunk * frame_size(star_count)) {
+        write_chunk();
+    }
+}
+
+void TrajectoryWriter::write_chunk() {
+    uLongf compressed_size = compressBound(m_chunk.size());
+    m_compressed.resize(compressed_size);
+    // the fastest level already gets most of the gain on the byte planes
+    if (compress2(m_compressed.data(), &compressed_size, m_chunk.data(),
+                  m_chunk.size(), Z_BEST_SPEED) != Z_OK) {
+        printf("error: could not compress trajectory %s\n", m_path.c_str());
+        m_failed = true;
+        return;
+    }
+
+    TrajectoryChunk chunk{};
+    chunk.offset = m_file_offset;
+    chunk.compressed_size = compressed_size;
+    chunk.frame_count = static_cast<uint32_t>(
+        m_chunk.size() / frame_size(m_star_data.star_count()));
+    chunk.first_frame = static_cast<uint32_t>(m_frames.size()) -
+                        chunk.frame_count;
+    if (!write(m_compressed.data(), compressed_size)) {
+        printf("error: could not write trajectory %s\n", m_path.c_str());
+        m_failed = true;
+        return;
+    }
+    m_chunks.push_back(chunk);
+    m_chunk.clear();
+}
+
+bool TrajectoryWriter::write(void const* data, size_t size) {
+    if (std::fwrite(data, 1, size, m_file) != size) {
+        return false;
+    }
+    m_file_offset += size;
+    return true;
+}
+
+void TrajectoryWriter::finish() {
+    if (!m_worker.joinable()) {
+        return;
+    }
+    for (Slot& slot : m_slots) {
+        if (slot.state.load(std::memory_order_relaxed) == SlotState::eCopying) {
+            while (m_core.device()->waitForFences(
+                       {slot.fence}, vk::True,
+                       std::numeric_limits<uint64_t>::max()) ==
+                   vk::Result::eTimeout);
+        }
+    }
+    poll();
+    {
+        std::lock_guard lock(m_mutex);
+        m_stopping = true;
+    }
+    m_wake.notify_one();
+    m_worker.join();
+
+    TrajectoryHeader header{};
+    std::memcpy(header.magic, "GLXTRAJ", sizeof(header.magic));
+    header.version = TRAJECTORY_VERSION;
+    header.star_count = m_star_data.star_count();
+    header.frames_per_chunk = m_frames_per_chunk;
+    header.frame_count = static_cast<uint32_t>(m_frames.size());
+    header.chunk_count = static_cast<uint32_t>(m_chunks.size());
+    header.index_offset = m_file_offset;
+    bool written =
+        !m_failed &&
+        write(m_chunks.data(), m_chunks.size() * sizeof(TrajectoryChunk)) &&
+        write(m_frames.data(), m_frames.size() * sizeof(TrajectoryFrame)) &&
+        std::fseek(m_file, 0, SEEK_SET) == 0 &&
+        std::fwrite(&header, sizeof(header), 1, m_file) == 1;
+    written = std::fclose(m_file) == 0 && written;
+    m_file = nullptr;
+    if (!written) {
+        printf("error: could not write trajectory %s\n", m_path.c_str());
+        return;
+    }
+
+    uint64_t raw_size =
+        sizeof(glm::vec3) * header.star_count * m_frames.size();
+    printf("wrote %u trajectory frames to %s (%.1f MiB, %.1fx smaller than "
+           "float positions)\n",
+           header.frame_count, m_path.c_str(),
+           m_file_offset / (1024.0 * 1024.0),
+           static_cast<double>(raw_size) / m_file_offset);
+}
+
+TrajectoryReader::TrajectoryReader(std::string const& path) {
+    m_file = std::fopen(path.c_str(), "rb");
+    if (m_file == nullptr) {
+        throw std::runtime_error("could not open trajectory " + path);
+    }
+    if (std::fread(&m_header, sizeof(m_header), 1, m_file) != 1 ||
+        std::memcmp(m_header.magic, "GLXTRAJ", sizeof(m_header.magic)) != 0) {
+        std::fclose(m_file);
+        throw std::runtime_error(path + " is not a trajectory");
+    }
+    if (m_header.version != TRAJECTORY_VERSION) {
+        std::fclose(m_file);
+        throw std::runtime_error(
+            path + " is a trajectory of version " +
+            std::to_string(m_header.version) + ", expected " +
+            std::to_string(TRAJECTORY_VERSION));
+    }
+    if (m_header.index_offset == 0) {
+        std::fclose(m_file);
+        throw std::runtime_error(path + " was not finished");
+    }
+
+    m_chunks.resize(m_header.chunk_count);
+    m_frames.resize(m_header.frame_count);
+    bool valid =
+        m_header.star_count > 0 && m_header.frames_per_chunk > 0 &&
+        fseeko(m_file, m_header.index_offset, SEEK_SET) == 0 &&
+        std::fread(m_chunks.data(), sizeof(TrajectoryChunk), m_chunks.size(),
+                   m_file) == m_chunks.size() &&
+        std::fread(m_frames.data(), sizeof(TrajectoryFrame), m_frames.size(),
+                   m_file) == m_frames.size();
+    // every frame has to be found at frame / frames_per_chunk
+    for (uint32_t i = 0; valid && i < m_chunks.size(); i++) {
+        TrajectoryChunk const& chunk = m_chunks[i];
+        valid = chunk.first_frame == i * m_header.frames_per_chunk &&
+                chunk.frame_count > 0 &&
+                chunk.frame_count <= m_header.frames_per_chunk &&
+                chunk.first_frame + chunk.frame_count <= m_frames.size() &&
+                chunk.offset + chunk.compressed_size <= m_header.index_offset;
+    }
+    valid = valid &&
+            (m_chunks.empty() ? m_frames.empty()
+                              : m_chunks.back().first_frame +
+                                        m_chunks.back().frame_count ==
+                                    m_frames.size());
+    if (!valid) {
+        std::fclose(m_file);
+        throw std::runtime_error(path + " is a damaged trajectory");
+    }
+    m_quantized.resize(3ull * m_header.star_count);
+}
+
+TrajectoryReader::~TrajectoryReader() { std::fclose(m_file); }
+
+void TrajectoryReader::load_chunk(uint32_t index) {
+    TrajectoryChunk const& chunk = m_chunks[index];
+    m_compressed.resize(chunk.compressed_size);
+    m_chunk.resize(chunk.frame_count * frame_size(m_header.star_count));
+    uLongf size = m_chunk.size();
+    if (fseeko(m_file, chunk.offset, SEEK_SET) != 0 ||
+        std::fread(m_compressed.data(), 1, m_compressed.size(), m_file) !=
+            m_compressed.size() ||
+        uncompress(m_chunk.data(), &size, m_compressed.data(),
+                   m_compressed.size()) != Z_OK ||
+        size != m_chunk.size()) {
+        m_loaded_chunk = UINT32_MAX;
+        throw std::runtime_error("damaged trajectory chunk " +
+                                 std::to_string(index));
+    }
+    m_loaded_chunk = index;
+    m_decoded_frame = UINT32_MAX;
+}
+
+void TrajectoryReader::read(uint32_t index, std::span<glm::vec3> positions) {
+    if (index >= m_frames.size()) {
+        throw std::runtime_error("trajectory frame " + std::to_string(index) +
+                                 " is out of range");
+    }
+    uint32_t star_count = m_header.star_count;
+    if (positions.size() < star_count) {
+        throw std::runtime_error("too little room for a trajectory frame");
+    }
+
+    uint32_t chunk_index = index / m_header.frames_per_chunk;
+    if (chunk_index != m_loaded_chunk) {
+        load_chunk(chunk_index);
+    }
+    uint32_t first_frame = m_chunks[chunk_index].first_frame;
+    uint32_t frame = m_decoded_frame != UINT32_MAX && m_decoded_frame <= index
+                         ? m_decoded_frame + 1
+                         : first_frame;
+    for (; frame <= index; frame++) {
+        bool key_frame = frame == first_frame;
+        uint8_t const* data =
+            m_chunk.data() + (frame - first_frame) * frame_size(star_count);
+        for (uint32_t axis = 0; axis < 3; axis++) {
+            uint16_t* quantized = m_quantized.data() + axis * star_count;
+            uint8_t const* low = data + 2ull * axis * star_count;
+            uint8_t const* high = low + star_count;
+            for (uint32_t i = 0; i < star_count; i++) {
+                uint16_t value = static_cast<uint16_t>(low[i] | high[i] << 8);
+                quantized[i] =
+                    key_frame ? value
+                              : static_cast<uint16_t>(quantized[i] +
+                                                      unzigzag(value));
+            }
+        }
+        m_decoded_frame = frame;
+    }
+
+    TrajectoryFrame const& bounds = m_frames[index];
+    for (uint32_t axis = 0; axis < 3; axis++) {
+        float scale = (bounds.max[axis] - bounds.min[axis]) / TRAJECTORY_LEVELS;
+        uint16_t const* quantized = m_quantized.data() + axis * star_count;
+        for (uint32_t i = 0; i < star_count; i++) {
+            positions[i][axis] = bounds.min[axis] + quantized[i] * scale;
+        }
+    }
+}
+
+void inspect_trajectory(std::string const& path) {
+    TrajectoryReader reader(path);
+    uint64_t compressed_size = 0;
+    for (TrajectoryChunk const& chunk : reader.chunks()) {
+        compressed_size += chunk.compressed_size;
+    }
+    printf("%s: %u stars, %u frames in %zu chunks, %.1f MiB compressed\n",
+           path.c_str(), reader.star_count(), reader.frame_count(),
+           reader.chunks().size(), compressed_size / (1024.0 * 1024.0));
+    if (reader.frame_count() == 0) {
+        return;
+    }
+
+    std::vector<glm::vec3> positions(reader.star_count());
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < reader.frame_count(); i++) {
+        reader.read(i, positions);
+    }
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+
+    for (uint32_t i : {0u, reader.frame_count() - 1}) {
+        TrajectoryFrame const& frame = reader.frame(i);
+        printf("frame %u: step %llu, bounds (%g, %g, %g) to (%g, %g, %g)\n", i,
+               static_cast<unsigned long long>(frame.step), frame.min[0],
+               frame.min[1], frame.min[2], frame.max[0], frame.max[1],
+               frame.max[2]);
+    }
+    printf("decoded every frame in %.2f s (%.1f frames/s)\n", seconds,
+           reader.frame_count() / seconds);
+}
+}  // namespace galaxy
@@ -3,10 +3,17 @@
 #include <glfwpp/glfwpp.h>
 #include <vulkan/vulkan_core.h>
 
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
 #include <exception>
+#include <filesystem>
 #include <format>
+#include <fstream>
 #include <iostream>
 #include <memory>
+#include <random>
 #include <system_error>
 #include <vulkan/vulkan.hpp>
 #include <vulkan/vulkan_enums.hpp>
@@ -19,16 +26,54 @@
 #include "glfwpp/window.h"
 
 namespace gfx {
-Core::Core()
-    : m_context(std::make_shared<vk::raii::Context>(vk::raii::Context())) {
+static std::filesystem::path pipeline_cache_directory() {
+    if (const char* cache_home = std::getenv("XDG_CACHE_HOME")) {
+        return std::filesystem::path(cache_home) / "galaxy";
+    }
+    if (const char* home = std::getenv("HOME")) {
+        return std::filesystem::path(home) / ".cache" / "galaxy";
+    }
+    return ".";
+}
+
+// the driver rejects foreign data itself, but only checking up front tells a
+// warm start from a cold one
+static bool pipeline_cache_header_matches(
+    std::vector<char> const& data, vk::PhysicalDeviceProperties const& properties) {
+    VkPipelineCacheHeaderVersionOne header;
+    if (data.size() < sizeof(header)) {
+        return false;
+    }
+    std::memcpy(&header, data.data(), sizeof(header));
+    return header.headerSize >= sizeof(header) &&
+           header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+           header.vendorID == properties.vendorID &&
+           header.deviceID == properties.deviceID &&
+           std::memcmp(header.pipelineCacheUUID,
+                       properties.pipelineCacheUUID.data(), VK_UUID_SIZE) == 0;
+}
+
+Core::Core(bool headless)
+    : m_context(std::make_shared<vk::raii::Context>(vk::raii::Context())),
+      m_headless(headless) {
     try {
         vk::ApplicationInfo application_info("Penis", 1, "Penis2", 1,
                                              VK_API_VERSION_1_4);
         vk::InstanceCreateInfo instance_ci({}, &application_info);
-        std::vector<const char*> enabled_layer_names = {
-            "VK_LAYER_KHRONOS_validation"};
-        std::vector<const char*> enabled_extension_names = {
-            "VK_KHR_wayland_surface", "VK_KHR_surface", "VK_KHR_xcb_surface"};
+        // containers and render nodes often come without the layer
+        std::vector<const char*> enabled_layer_names;
+        for (auto const& layer :
+             m_context->enumerateInstanceLayerProperties()) {
+            if (std::string(layer.layerName.data()) ==
+                "VK_LAYER_KHRONOS_validation") {
+                enabled_layer_names.push_back("VK_LAYER_KHRONOS_validation");
+            }
+        }
+        std::vector<const char*> enabled_extension_names;
+        if (!m_headless) {
+            enabled_extension_names = {"VK_KHR_wayland_surface",
+                                       "VK_KHR_surface", "VK_KHR_xcb_surface"};
+        }
         instance_ci.setEnabledLayerCount(enabled_layer_names.size())
             .setPpEnabledLayerNames(enabled_layer_names.data())
             .setEnabledExtensionCount(enabled_extension_names.size())
@@ -37,87 +82,93 @@ Core::Core()
         m_instance = std::make_shared<vk::raii::Instance>(
             vk::raii::Instance(*this->m_context, instance_ci));
 
-        VkSurfaceKHR _surface;
-
-        glfw::WindowHints{.clientApi = glfw::ClientApi::None}.apply();
-        m_window = glfw::Window(640, 480, "Galaxy");
-        VkResult result =
-            m_window.createSurface(**m_instance.get(), nullptr, &_surface);
-        switch (result) {
-            case VK_SUCCESS: {
-                break;
-            }
-            default: {
-                throw vk::SystemError(
-                    std::error_code(),
-                    std::format("VkResult: %i", static_cast<int>(result)));
-            }
+        if (m_headless) {
+            init_headless_device();
+        } else {
+            init_windowed_device();
         }
-
-        m_surface =
-            std::make_shared<vk::raii::SurfaceKHR>(*m_instance, _surface);
-
-        vk::raii::PhysicalDevices physical_devices(*this->m_instance);
-        m_physical_device = std::make_shared<vk::raii::PhysicalDevice>(
-            physical_devices.front());
-
-        m_graphics_family_index = util::find_graphics_queue_family_index(
-            m_physical_device->getQueueFamilyProperties());
         float queue_priority = 0.0;
 
         std::vector<vk::QueueFamilyProperties> queue_family_properties =
             m_physical_device->getQueueFamilyProperties();
 
-        m_present_family_index = m_physical_device->getSurfaceSupportKHR(
-                                     m_graphics_family_index, *m_surface)
-                                     ? m_graphics_family_index
-                                     : queue_family_properties.size();
-
-        if (m_present_family_index == queue_family_properties.size()) {
-            // the graphicsQueueFamilyIndex doesn't support present -> look for
-            // an other family index that supports both graphics and present
-            for (size_t i = 0; i < queue_family_properties.size(); i++) {
-                if ((queue_family_properties[i].queueFlags &
-                     vk::QueueFlagBits::eGraphics) &&
-                    m_physical_device->getSurfaceSupportKHR((i), *m_surface)) {
-                    m_graphics_family_index = (i);
-                    m_present_family_index = m_graphics_family_index;
-                    break;
-                }
-            }
-            if (m_present_family_index == queue_family_properties.size()) {
-                // there's nothing like a single family index that supports both
-                // graphics and present -> look for an other family index that
-                // supports present
-                for (size_t i = 0; i < queue_family_properties.size(); i++) {
-                    if (m_physical_device->getSurfaceSupportKHR((i),
-                                                                *m_surface)) {
-                        m_present_family_index = (i);
-                        break;
-                    }
-                }
-            }
+        std::vector<const char*> device_extension_names;
+        if (!m_headless) {
+            device_extension_names.push_back("VK_KHR_swapchain");
         }
-        if ((m_graphics_family_index == queue_family_properties.size()) ||
-            (m_present_family_index == queue_family_properties.size())) {
-            throw std::runtime_error(
-                "Could not find a queue for graphics or present -> "
-                "terminating");
+        // lets the allocator report what the driver grants the process
+        bool memory_budget = false;
+        for (auto const& extension :
+             m_physical_device->enumerateDeviceExtensionProperties()) {
+            if (std::string(extension.extensionName.data()) ==
+                VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) {
+                memory_budget = true;
+                device_extension_names.push_back(
+                    VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+            }
         }
 
-        std::vector<const char*> device_extension_names = {"VK_KHR_swapchain"};
-
         std::vector<const char*> device_feature_names = {
             "VK_KHR_synchronization2"};
 
+        // lets the profiler reset its queries from the CPU, whichever queue
+        // wrote them
+        vk::PhysicalDeviceHostQueryResetFeatures host_query_reset_feature(true);
+        vk::PhysicalDeviceTimelineSemaphoreFeatures timeline_feature(true);
+        timeline_feature.pNext = &host_query_reset_feature;
+        // optional, the sprite renderer draws without render pass objects
+        auto supported_features = m_physical_device->getFeatures2<
+            vk::PhysicalDeviceFeatures2,
+            vk::PhysicalDeviceDynamicRenderingFeatures>();
+        vk::PhysicalDeviceDynamicRenderingFeatures dynamic_rendering_feature(
+            supported_features
+                .get<vk::PhysicalDeviceDynamicRenderingFeatures>()
+                .dynamicRendering);
+        host_query_reset_feature.pNext = &dynamic_rendering_feature;
+        m_rasterization =
+            dynamic_rendering_feature.dynamicRendering &&
+            (queue_family_properties[m_graphics_family_index].queueFlags &
+             vk::QueueFlagBits::eGraphics);
         vk::PhysicalDeviceSynchronization2Features sync2feature = {true};
         sync2feature.sType =
             vk::StructureType::ePhysicalDeviceSynchronization2Features;
+        sync2feature.pNext = &timeline_feature;
         vk::PhysicalDeviceFeatures2 features({}, &sync2feature);
-
-        vk::DeviceQueueCreateInfo device_queue_ci({}, m_graphics_family_index,
-                                                  1, &queue_priority);
-        vk::DeviceCreateInfo device_ci({}, device_queue_ci);
+        // optional, the profiler only collects invocation counts with it
+        m_pipeline_statistics =
+            m_physical_device->getFeatures().pipelineStatisticsQuery;
+        features.features.pipelineStatisticsQuery = m_pipeline_statistics;
+
+        m_compute_family_index =
+            util::find_compute_queue_family_index(queue_family_properties);
+        // a headless device without graphics may already run everything on
+        // its compute family
+        bool async_compute =
+            m_compute_family_index != queue_family_properties.size() &&
+            m_compute_family_index != m_graphics_family_index;
+
+        std::vector<vk::DeviceQueueCreateInfo> device_queue_cis = {
+            vk::DeviceQueueCreateInfo({}, m_graphics_family_index, 1,
+                                      &queue_priority)};
+        if (async_compute) {
+            device_queue_cis.emplace_back(
+                vk::DeviceQueueCreateFlags(), m_compute_family_index, 1,
+                &queue_priority);
+        } else {
+            m_compute_family_index = m_graphics_family_index;
+        }
+        m_transfer_family_index =
+            util::find_transfer_queue_family_index(queue_family_properties);
+        bool transfer_queue =
+            m_transfer_family_index != queue_family_properties.size();
+        if (transfer_queue) {
+            device_queue_cis.emplace_back(vk::DeviceQueueCreateFlags(),
+                                          m_transfer_family_index, 1,
+                                          &queue_priority);
+        } else {
+            m_transfer_family_index = m_graphics_family_index;
+        }
+        vk::DeviceCreateInfo device_ci({}, device_queue_cis);
         device_ci.setPpEnabledExtensionNames(device_extension_names.data())
             .setEnabledExtensionCount(device_extension_names.size());
         device_ci.setPNext(&features);
@@ -125,90 +176,16 @@ Core::Core()
         m_device =
             std::make_shared<vk::raii::Device>(*m_physical_device, device_ci);
 
-        // get the supported VkFormats
-        std::vector<vk::SurfaceFormatKHR> formats =
-            m_physical_device->getSurfaceFormatsKHR(*m_surface);
-        assert(!formats.empty());
-        m_format = (formats[0].format == vk::Format::eUndefined)
-                       ? vk::Format::eB8G8R8A8Unorm
-                       : formats[0].format;
-
-        vk::SurfaceCapabilitiesKHR surface_capabilities =
-            m_physical_device->getSurfaceCapabilitiesKHR(*m_surface);
-        vk::Extent2D swapchain_extent;
-        if (surface_capabilities.currentExtent.width ==
-            (std::numeric_limits<uint32_t>::max)()) {
-            // If the surface size is undefined, the size is set to the size of
-            // the images requested.
-            swapchain_extent.width = glm::clamp(
-                static_cast<uint32_t>(std::get<0>(m_window.getSize())),
-                surface_capabilities.minImageExtent.width,
-                surface_capabilities.maxImageExtent.width);
-            swapchain_extent.height = glm::clamp(
-                static_cast<uint32_t>(std::get<1>(m_window.getSize())),
-                surface_capabilities.minImageExtent.height,
-                surface_capabilities.maxImageExtent.height);
-        } else {
-            // If the surface size is defined, the swap chain size must match
-            swapchain_extent = surface_capabilities.currentExtent;
-        }
+        m_allocator = std::make_shared<Allocator>(*m_device, *m_physical_device,
+                                                  memory_budget);
 
-        // The FIFO present mode is guaranteed by the spec to be supported
-        vk::PresentModeKHR swapchain_present_mode = vk::PresentModeKHR::eFifo;
-
-        vk::SurfaceTransformFlagBitsKHR pre_transform =
-            (surface_capabilities.supportedTransforms &
-             vk::SurfaceTransformFlagBitsKHR::eIdentity)
-                ? vk::SurfaceTransformFlagBitsKHR::eIdentity
-                : surface_capabilities.currentTransform;
-
-        vk::CompositeAlphaFlagBitsKHR composite_alpha =
-            (surface_capabilities.supportedCompositeAlpha &
-             vk::CompositeAlphaFlagBitsKHR::ePreMultiplied)
-                ? vk::CompositeAlphaFlagBitsKHR::ePreMultiplied
-            : (surface_capabilities.supportedCompositeAlpha &
-               vk::CompositeAlphaFlagBitsKHR::ePostMultiplied)
-                ? vk::CompositeAlphaFlagBitsKHR::ePostMultiplied
-            : (surface_capabilities.supportedCompositeAlpha &
-               vk::CompositeAlphaFlagBitsKHR::eInherit)
-                ? vk::CompositeAlphaFlagBitsKHR::eInherit
-                : vk::CompositeAlphaFlagBitsKHR::eOpaque;
-
-        vk::SwapchainCreateInfoKHR swapchain_create_info(
-            vk::SwapchainCreateFlagsKHR(), *m_surface,
-            gfx::util::clamp_surface_image_count(
-                3u, surface_capabilities.minImageCount,
-                surface_capabilities.maxImageCount),
-            m_format, vk::ColorSpaceKHR::eSrgbNonlinear, swapchain_extent, 1,
-            vk::ImageUsageFlagBits::eColorAttachment |
-                vk::ImageUsageFlagBits::eTransferSrc |
-                vk::ImageUsageFlagBits::eTransferDst,
-            vk::SharingMode::eExclusive, {}, pre_transform, composite_alpha,
-            swapchain_present_mode, true, nullptr);
-
-        std::array<uint32_t, 2> queue_family_indices = {m_graphics_family_index,
-                                                        m_present_family_index};
-        if (m_graphics_family_index != m_present_family_index) {
-            swapchain_create_info.imageSharingMode =
-                vk::SharingMode::eConcurrent;
-            swapchain_create_info.queueFamilyIndexCount =
-                static_cast<uint32_t>(queue_family_indices.size());
-            swapchain_create_info.pQueueFamilyIndices =
-                queue_family_indices.data();
-        }
+        init_pipeline_cache();
 
-        m_swapchain = std::make_shared<vk::raii::SwapchainKHR>(
-            *m_device, swapchain_create_info);
-        m_swapchain_images = m_swapchain->getImages();
-
-        m_swapchain_image_views.reserve(m_swapchain_images.size());
-        vk::ImageViewCreateInfo image_view_create_info(
-            {}, {}, vk::ImageViewType::e2D, m_format, {},
-            {vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1});
-        for (auto i = 0; i < m_swapchain_images.size(); i++) {
-            image_view_create_info.image = m_swapchain_images[i];
-            m_swapchain_image_views.push_back(
-                {*m_device, image_view_create_info});
+        if (m_headless) {
+            // matches the intermediate image the frames are drawn into
+            m_format = vk::Format::eR8G8B8A8Unorm;
+        } else {
+            init_swapchain();
         }
 
         vk::CommandPoolCreateInfo command_pool_create_info(
@@ -229,23 +206,35 @@ Core::Core()
         m_present_queue = std::make_shared<vk::raii::Queue>(
             *m_device, m_present_family_index, 0);
 
+        if (async_compute) {
+            m_compute_queue = std::make_shared<vk::raii::Queue>(
+                *m_device, m_compute_family_index, 0);
+            m_compute_command_pool = std::make_shared<vk::raii::CommandPool>(
+                *m_device,
+                vk::CommandPoolCreateInfo(
+                    vk::CommandPoolCreateFlagBits::eResetCommandBuffer,
+                    m_compute_family_index));
+            std::cout << "Using async compute queue family "
+                      << m_compute_family_index << "\n";
+        }
+        if (transfer_queue) {
+            m_transfer_queue = std::make_shared<vk::raii::Queue>(
+                *m_device, m_transfer_family_index, 0);
+            m_transfer_command_pool = std::make_shared<vk::raii::CommandPool>(
+                *m_device,
+                vk::CommandPoolCreateInfo(
+                    vk::CommandPoolCreateFlagBits::eTransient,
+                    m_transfer_family_index));
+            std::cout << "Using transfer queue family "
+                      << m_transfer_family_index << "\n";
+        }
+
         vk::BufferCreateInfo buffer_create_info(
             {}, sizeof(glm::mat4x4), vk::BufferUsageFlagBits::eUniformBuffer);
-        m_uniform_buffer = vk::raii::Buffer(*m_device, buffer_create_info);
-        vk::MemoryRequirements memory_requirements =
-            m_uniform_buffer.getMemoryRequirements();
-
-        uint32_t type_index = util::find_memory_type(
-            m_physical_device->getMemoryProperties(),
-            memory_requirements.memoryTypeBits,
-            vk::MemoryPropertyFlagBits::eHostVisible |
-                vk::MemoryPropertyFlagBits::eHostCoherent);
-        vk::MemoryAllocateInfo memory_allocate_info(memory_requirements.size,
-                                                    type_index);
-        m_uniform_buffer_memory =
-            vk::raii::DeviceMemory(*m_device, memory_allocate_info);
-
-        m_uniform_buffer.bindMemory(m_uniform_buffer_memory, 0);
+        std::tie(m_uniform_buffer, m_uniform_buffer_memory) =
+            m_allocator->create_buffer(
+                buffer_create_info, vk::MemoryPropertyFlagBits::eHostVisible |
+                                        vk::MemoryPropertyFlagBits::eHostCoherent);
 
         std::cout << "Set everything up\n";
 
@@ -261,14 +250,298 @@ Core::Core()
     }
 }
 Core::~Core() {
+    save_pipeline_cache();
     if (m_swapchain.use_count() != 0) {
         m_swapchain->clear();
     }
 }
 
-void Core::update() { glfw::pollEvents(); }
+void Core::init_windowed_device() {
+    m_glfw = std::shared_ptr<glfw::GlfwLibrary>(
+        new glfw::GlfwLibrary(glfw::init()));
+
+    VkSurfaceKHR _surface;
+
+    glfw::WindowHints{.clientApi = glfw::ClientApi::None}.apply();
+    m_window = glfw::Window(640, 480, "Galaxy");
+    VkResult result =
+        m_window.createSurface(**m_instance.get(), nullptr, &_surface);
+    switch (result) {
+        case VK_SUCCESS: {
+            break;
+        }
+        default: {
+            throw vk::SystemError(
+                std::error_code(),
+                std::format("VkResult: %i", static_cast<int>(result)));
+        }
+    }
+
+    m_surface = std::make_shared<vk::raii::SurfaceKHR>(*m_instance, _surface);
+
+    vk::raii::PhysicalDevices physical_devices(*this->m_instance);
+    m_physical_device =
+        std::make_shared<vk::raii::PhysicalDevice>(physical_devices.front());
+
+    m_graphics_family_index = util::find_graphics_queue_family_index(
+        m_physical_device->getQueueFamilyProperties());
+
+    std::vector<vk::QueueFamilyProperties> queue_family_properties =
+        m_physical_device->getQueueFamilyProperties();
+
+    m_present_family_index = m_physical_device->getSurfaceSupportKHR(
+                                 m_graphics_family_index, *m_surface)
+                                 ? m_graphics_family_index
+                                 : queue_family_properties.size();
+
+    if (m_present_family_index == queue_family_properties.size()) {
+        // the graphicsQueueFamilyIndex doesn't support present -> look for
+        // an other family index that supports both graphics and present
+        for (size_t i = 0; i < queue_family_properties.size(); i++) {
+            if ((queue_family_properties[i].queueFlags &
+                 vk::QueueFlagBits::eGraphics) &&
+                m_physical_device->getSurfaceSupportKHR((i), *m_surface)) {
+                m_graphics_family_index = (i);
+                m_present_family_index = m_graphics_family_index;
+                break;
+            }
+        }
+        if (m_present_family_index == queue_family_properties.size()) {
+            // there's nothing like a single family index that supports both
+            // graphics and present -> look for an other family index that
+            // supports present
+            for (size_t i = 0; i < queue_family_properties.size(); i++) {
+                if (m_physical_device->getSurfaceSupportKHR((i),
+                                                            *m_surface)) {
+                    m_present_family_index = (i);
+                    break;
+                }
+            }
+        }
+    }
+    if ((m_graphics_family_index == queue_family_properties.size()) ||
+        (m_present_family_index == queue_family_properties.size())) {
+        throw std::runtime_error(
+            "Could not find a queue for graphics or present -> "
+            "terminating");
+    }
+}
+
+void Core::init_headless_device() {
+    // the star pipelines are compute only, so any device with a compute
+    // queue will do
+    vk::raii::PhysicalDevices physical_devices(*this->m_instance);
+    for (auto& physical_device : physical_devices) {
+        std::vector<vk::QueueFamilyProperties> queue_family_properties =
+            physical_device.getQueueFamilyProperties();
+        uint32_t family_index = util::find_compute_capable_queue_family_index(
+            queue_family_properties);
+        if (family_index != queue_family_properties.size()) {
+            m_physical_device =
+                std::make_shared<vk::raii::PhysicalDevice>(physical_device);
+            m_graphics_family_index = family_index;
+            m_present_family_index = family_index;
+            std::cout << "Running headless on "
+                      << m_physical_device->getProperties().deviceName.data()
+                      << "\n";
+            return;
+        }
+    }
+    throw std::runtime_error("Could not find a device with a compute queue");
+}
+
+void Core::init_swapchain() {
+    // get the supported VkFormats
+    std::vector<vk::SurfaceFormatKHR> formats =
+        m_physical_device->getSurfaceFormatsKHR(*m_surface);
+    assert(!formats.empty());
+    m_format = (formats[0].format == vk::Format::eUndefined)
+                   ? vk::Format::eB8G8R8A8Unorm
+                   : formats[0].format;
+
+    vk::SurfaceCapabilitiesKHR surface_capabilities =
+        m_physical_device->getSurfaceCapabilitiesKHR(*m_surface);
+    vk::Extent2D swapchain_extent;
+    if (surface_capabilities.currentExtent.width ==
+        (std::numeric_limits<uint32_t>::max)()) {
+        // If the surface size is undefined, the size is set to the size of
+        // the images requested.
+        swapchain_extent.width = glm::clamp(
+            static_cast<uint32_t>(std::get<0>(m_window.getSize())),
+            surface_capabilities.minImageExtent.width,
+            surface_capabilities.maxImageExtent.width);
+        swapchain_extent.height = glm::clamp(
+            static_cast<uint32_t>(std::get<1>(m_window.getSize())),
+            surface_capabilities.minImageExtent.height,
+            surface_capabilities.maxImageExtent.height);
+    } else {
+        // If the surface size is defined, the swap chain size must match
+        swapchain_extent = surface_capabilities.currentExtent;
+    }
+
+    // The FIFO present mode is guaranteed by the spec to be supported
+    vk::PresentModeKHR swapchain_present_mode = vk::PresentModeKHR::eFifo;
+
+    vk::SurfaceTransformFlagBitsKHR pre_transform =
+        (surface_capabilities.supportedTransforms &
+         vk::SurfaceTransformFlagBitsKHR::eIdentity)
+            ? vk::SurfaceTransformFlagBitsKHR::eIdentity
+            : surface_capabilities.currentTransform;
+
+    vk::CompositeAlphaFlagBitsKHR composite_alpha =
+        (surface_capabilities.supportedCompositeAlpha &
+         vk::CompositeAlphaFlagBitsKHR::ePreMultiplied)
+            ? vk::CompositeAlphaFlagBitsKHR::ePreMultiplied
+        : (surface_capabilities.supportedCompositeAlpha &
+           vk::CompositeAlphaFlagBitsKHR::ePostMultiplied)
+            ? vk::CompositeAlphaFlagBitsKHR::ePostMultiplied
+        : (surface_capabilities.supportedCompositeAlpha &
+           vk::CompositeAlphaFlagBitsKHR::eInherit)
+            ? vk::CompositeAlphaFlagBitsKHR::eInherit
+            : vk::CompositeAlphaFlagBitsKHR::eOpaque;
+
+    vk::SwapchainCreateInfoKHR swapchain_create_info(
+        vk::SwapchainCreateFlagsKHR(), *m_surface,
+        gfx::util::clamp_surface_image_count(
+            3u, surface_capabilities.minImageCount,
+            surface_capabilities.maxImageCount),
+        m_format, vk::ColorSpaceKHR::eSrgbNonlinear, swapchain_extent, 1,
+        vk::ImageUsageFlagBits::eColorAttachment |
+            vk::ImageUsageFlagBits::eTransferSrc |
+            vk::ImageUsageFlagBits::eTransferDst,
+        vk::SharingMode::eExclusive, {}, pre_transform, composite_alpha,
+        swapchain_present_mode, true, nullptr);
+
+    std::array<uint32_t, 2> queue_family_indices = {m_graphics_family_index,
+                                                    m_present_family_index};
+    if (m_graphics_family_index != m_present_family_index) {
+        swapchain_create_info.imageSharingMode =
+            vk::SharingMode::eConcurrent;
+        swapchain_create_info.queueFamilyIndexCount =
+            static_cast<uint32_t>(queue_family_indices.size());
+        swapchain_create_info.pQueueFamilyIndices =
+            queue_family_indices.data();
+    }
+
+    m_swapchain = std::make_shared<vk::raii::SwapchainKHR>(
+        *m_device, swapchain_create_info);
+    m_swapchain_images = m_swapchain->getImages();
+
+    m_swapchain_image_views.reserve(m_swapchain_images.size());
+    vk::ImageViewCreateInfo image_view_create_info(
+        {}, {}, vk::ImageViewType::e2D, m_format, {},
+        {vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1});
+    for (auto i = 0; i < m_swapchain_images.size(); i++) {
+        image_view_create_info.image = m_swapchain_images[i];
+        m_swapchain_image_views.push_back(
+            {*m_device, image_view_create_info});
+    }
+}
+
+void Core::init_pipeline_cache() {
+    auto properties = m_physical_device->getProperties2<
+        vk::PhysicalDeviceProperties2, vk::PhysicalDeviceIDProperties>();
+    vk::PhysicalDeviceProperties const& device_properties =
+        properties.get<vk::PhysicalDeviceProperties2>().properties;
+    vk::PhysicalDeviceIDProperties const& id_properties =
+        properties.get<vk::PhysicalDeviceIDProperties>();
+
+    // one file per device and driver version, so switching either doesn't
+    // throw away the cache of the other
+    std::string key;
+    for (uint8_t byte : id_properties.deviceUUID) {
+        key += std::format("{:02x}", byte);
+    }
+    key += std::format("-{:08x}", device_properties.driverVersion);
+    m_pipeline_cache_path =
+        (pipeline_cache_directory() / ("pipelines-" + key + ".bin")).string();
+
+    std::vector<char> data;
+    std::ifstream file(m_pipeline_cache_path, std::ios::binary);
+    if (file) {
+        data.assign(std::istreambuf_iterator<char>(file),
+                    std::istreambuf_iterator<char>());
+    }
+    if (!data.empty() &&
+        !pipeline_cache_header_matches(data, device_properties)) {
+        std::cout << "Ignoring stale pipeline cache " << m_pipeline_cache_path
+                  << "\n";
+        data.clear();
+    }
+    m_pipeline_cache_loaded = !data.empty();
+
+    m_pipeline_cache = vk::raii::PipelineCache(
+        *m_device, vk::PipelineCacheCreateInfo({}, data.size(), data.data()));
+}
+
+void Core::save_pipeline_cache() {
+    if (!*m_pipeline_cache || m_pipeline_cache_path.empty()) {
+        return;
+    }
+    std::vector<uint8_t> data = m_pipeline_cache.getData();
+
+    // written next to the final file and renamed, so concurrent runs never
+    // read a half written cache
+    std::error_code error;
+    std::filesystem::path path(m_pipeline_cache_path);
+    std::filesystem::create_directories(path.parent_path(), error);
+    std::filesystem::path temporary_path = path;
+    temporary_path += std::format(".{:08x}.tmp", std::random_device()());
+    {
+        std::ofstream file(temporary_path, std::ios::binary);
+        if (!file) {
+            std::cout << "Could not write pipeline cache " << temporary_path
+                      << "\n";
+            return;
+        }
+        file.write(reinterpret_cast<char const*>(data.data()), data.size());
+    }
+    std::filesystem::rename(temporary_path, path, error);
+    if (error) {
+        std::filesystem::remove(temporary_path, error);
+    }
+}
+
+void Core::report_pipeline_creation() {
+    std::cout << std::format(
+        "Created {} pipelines in {:.1f} ms ({} start, {} cache hits, {} "
+        "misses, {})\n",
+        m_pipeline_count, m_pipeline_creation_ms,
+        m_pipeline_cache_loaded ? "warm" : "cold", m_pipeline_cache_hits,
+        m_pipeline_cache_misses, m_pipeline_cache_path);
+}
+
+void Core::update() {
+    if (!m_headless) {
+        glfw::pollEvents();
+    }
+}
+
+std::vector<uint32_t> Core::queue_family_indices() {
+    if (m_compute_family_index != m_graphics_family_index) {
+        return {m_graphics_family_index, m_compute_family_index};
+    }
+    return {m_graphics_family_index};
+}
+
+std::vector<uint32_t> Core::upload_family_indices() {
+    std::vector<uint32_t> indices = queue_family_indices();
+    if (has_transfer_queue()) {
+        indices.push_back(m_transfer_family_index);
+    }
+    return indices;
+}
+
+bool Core::should_close() { return !m_headless && m_window.shouldClose(); }
 
-bool Core::should_close() { return m_window.shouldClose(); }
+vk::Extent2D Core::extent() {
+    if (m_headless) {
+        return vk::Extent2D(640, 480);
+    }
+    auto [width, height] = m_window.getSize();
+    return vk::Extent2D(static_cast<uint32_t>(width),
+                        static_cast<uint32_t>(height));
+}
 
 template <typename T>
 void Core::upload_uniform_buffer(const T& data) {
@@ -276,13 +549,8 @@ void Core::upload_uniform_buffer(const T& data) {
         throw std::runtime_error("UBO data size mismatch!");
     }
 
-    // Map, copy, and unmap only.
-    uint8_t* p_data =
-        static_cast<uint8_t*>(m_uniform_buffer_memory.mapMemory(0, sizeof(T)));
-
-    memcpy(p_data, &data, sizeof(T));
-
-    m_uniform_buffer_memory.unmapMemory();
+    // the allocator keeps host visible memory mapped
+    memcpy(m_uniform_buffer_memory.mapped(), &data, sizeof(T));
 }
 template void Core::upload_uniform_buffer<glm::vec3>(const glm::vec3& data);
 
@@ -292,4 +560,104 @@ vk::raii::ShaderModule Core::create_shader_module(std::string path) {
         *m_device,
         vk::ShaderModuleCreateInfo(vk::ShaderModuleCreateFlags(), spv));
 }
+
+void Core::count_pipeline_creation(
+    std::chrono::steady_clock::time_point start,
+    vk::PipelineCreationFeedback const& feedback) {
+    m_pipeline_creation_ms += std::chrono::duration<double, std::milli>(
+                                  std::chrono::steady_clock::now() - start)
+                                  .count();
+
+    m_pipeline_count++;
+    if (feedback.flags & vk::PipelineCreationFeedbackFlagBits::eValid) {
+        if (feedback.flags &
+            vk::PipelineCreationFeedbackFlagBits::eApplicationPipelineCacheHit) {
+            m_pipeline_cache_hits++;
+        } else {
+            m_pipeline_cache_misses++;
+        }
+    }
+}
+
+vk::raii::Pipeline Core::create_compute_pipeline(
+    std::string path, vk::raii::PipelineLayout const& layout,
+    vk::SpecializationInfo const* specialization_info) {
+    vk::raii::ShaderModule shader_module = create_shader_module(path);
+    vk::PipelineShaderStageCreateInfo stage_create_info(
+        {}, vk::ShaderStageFlagBits::eCompute, shader_module, "main",
+        specialization_info);
+    vk::PipelineCreationFeedback pipeline_feedback;
+    vk::PipelineCreationFeedback stage_feedback;
+    vk::PipelineCreationFeedbackCreateInfo feedback_create_info(
+        &pipeline_feedback, 1, &stage_feedback);
+    vk::ComputePipelineCreateInfo pipeline_create_info =
+        vk::ComputePipelineCreateInfo()
+            .setStage(stage_create_info)
+            .setLayout(*layout)
+            .setPNext(&feedback_create_info);
+
+    auto start = std::chrono::steady_clock::now();
+    vk::raii::Pipeline pipeline(*m_device, m_pipeline_cache,
+                                pipeline_create_info);
+    count_pipeline_creation(start, pipeline_feedback);
+    return pipeline;
+}
+
+vk::raii::Pipeline Core::create_graphics_pipeline(
+    std::string vertex_path, std::string fragment_path,
+    vk::raii::PipelineLayout const& layout, vk::Format color_format,
+    vk::PipelineColorBlendAttachmentState const& blend_attachment) {
+    vk::raii::ShaderModule vertex_module = create_shader_module(vertex_path);
+    vk::raii::ShaderModule fragment_module =
+        create_shader_module(fragment_path);
+    std::array<vk::PipelineShaderStageCreateInfo, 2> stage_create_infos = {
+        vk::PipelineShaderStageCreateInfo(
+            {}, vk::ShaderStageFlagBits::eVertex, vertex_module, "main"),
+        vk::PipelineShaderStageCreateInfo(
+            {}, vk::ShaderStageFlagBits::eFragment, fragment_module, "main")};
+
+    // the vertex shader makes up its vertices from the vertex and instance
+    // indices
+    vk::PipelineVertexInputStateCreateInfo vertex_input_state;
+    vk::PipelineInputAssemblyStateCreateInfo input_assembly_state(
+        {}, vk::PrimitiveTopology::eTriangleList);
+    vk::PipelineViewportStateCreateInfo viewport_state({}, 1, nullptr, 1,
+                                                       nullptr);
+    vk::PipelineRasterizationStateCreateInfo rasterization_state(
+        {}, false, false, vk::PolygonMode::eFill, vk::CullModeFlagBits::eNone,
+        vk::FrontFace::eCounterClockwise, false, 0.0f, 0.0f, 0.0f, 1.0f);
+    vk::PipelineMultisampleStateCreateInfo multisample_state(
+        {}, vk::SampleCountFlagBits::e1);
+    vk::PipelineColorBlendStateCreateInfo color_blend_state(
+        {}, false, vk::LogicOp::eCopy, blend_attachment);
+    std::array<vk::DynamicState, 2> dynamic_states = {
+        vk::DynamicState::eViewport, vk::DynamicState::eScissor};
+    vk::PipelineDynamicStateCreateInfo dynamic_state({}, dynamic_states);
+    vk::PipelineRenderingCreateInfo rendering_create_info(0, color_format);
+
+    vk::PipelineCreationFeedback pipeline_feedback;
+    std::array<vk::PipelineCreationFeedback, 2> stage_feedbacks;
+    vk::PipelineCreationFeedbackCreateInfo feedback_create_info(
+        &pipeline_feedback, stage_feedbacks.size(), stage_feedbacks.data());
+    rendering_create_info.setPNext(&feedback_create_info);
+
+    vk::GraphicsPipelineCreateInfo pipeline_create_info =
+        vk::GraphicsPipelineCreateInfo()
+            .setStages(stage_create_infos)
+            .setPVertexInputState(&vertex_input_state)
+            .setPInputAssemblyState(&input_assembly_state)
+            .setPViewportState(&viewport_state)
+            .setPRasterizationState(&rasterization_state)
+            .setPMultisampleState(&multisample_state)
+            .setPColorBlendState(&color_blend_state)
+            .setPDynamicState(&dynamic_state)
+            .setLayout(*layout)
+            .setPNext(&rendering_create_info);
+
+    auto start = std::chrono::steady_clock::now();
+    vk::raii::Pipeline pipeline(*m_device, m_pipeline_cache,
+                                pipeline_create_info);
+    count_pipeline_creation(start, pipeline_feedback);
+    return pipeline;
+}
 }  // namespace gfx
@@ -0,0 +1,301 @@
+#include "gfx/allocator.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+#include <vulkan/vulkan_enums.hpp>
+#include <vulkan/vulkan_structs.hpp>
+
+// size of the blocks suballocations are made from, requests above half of it
+// get a block of their own
+const static vk::DeviceSize BLOCK_SIZE = 64ull << 20;
+
+namespace gfx {
+static vk::DeviceSize align_up(vk::DeviceSize value, vk::DeviceSize alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+static double mebibytes(vk::DeviceSize bytes) {
+    return bytes / (1024.0 * 1024.0);
+}
+
+Allocation::~Allocation() { release(); }
+
+Allocation::Allocation(Allocation&& other) noexcept
+    : m_allocator(other.m_allocator),
+      m_block(other.m_block),
+      m_memory(other.m_memory),
+      m_offset(other.m_offset),
+      m_size(other.m_size),
+      m_mapped(other.m_mapped) {
+    other.m_allocator = nullptr;
+}
+
+Allocation& Allocation::operator=(Allocation&& other) noexcept {
+    if (this != &other) {
+        release();
+        m_allocator = other.m_allocator;
+        m_block = other.m_block;
+        m_memory = other.m_memory;
+        m_offset = other.m_offset;
+        m_size = other.m_size;
+        m_mapped = other.m_mapped;
+        other.m_allocator = nullptr;
+    }
+    return *this;
+}
+
+void Allocation::release() {
+    if (m_allocator != nullptr) {
+        m_allocator->free(*this);
+        m_allocator = nullptr;
+    }
+}
+
+Allocator::Allocator(vk::raii::Device& device,
+                     vk::raii::PhysicalDevice& physical_device,
+                     bool memory_budget)
+    : m_device(device),
+      m_memory_properties(physical_device.getMemoryProperties()),
+      m_physical_device(physical_device),
+      m_memory_budget(memory_budget) {}
+
+Allocator::~Allocator() {}
+
+uint32_t Allocator::find_memory_type(uint32_t type_bits,
+                                     vk::MemoryPropertyFlags required,
+                                     vk::MemoryPropertyFlags preferred) {
+    for (vk::MemoryPropertyFlags flags : {required | preferred, required}) {
+        for (uint32_t i = 0; i < m_memory_properties.memoryTypeCount; i++) {
+            if ((type_bits & (1u << i)) &&
+                (m_memory_properties.memoryTypes[i].propertyFlags & flags) ==
+                    flags) {
+                return i;
+            }
+        }
+    }
+    throw std::runtime_error("no memory type with the required properties");
+}
+
+uint32_t Allocator::create_block(uint32_t memory_type, vk::DeviceSize size,
+                                 bool linear, bool dedicated) {
+    auto block = std::make_unique<Block>();
+    block->memory = vk::raii::DeviceMemory(
+        m_device, vk::MemoryAllocateInfo(size, memory_type));
+    block->size = size;
+    block->memory_type = memory_type;
+    block->linear = linear;
+    block->dedicated = dedicated;
+    block->free_ranges[0] = size;
+    if (m_memory_properties.memoryTypes[memory_type].propertyFlags &
+        vk::MemoryPropertyFlagBits::eHostVisible) {
+        block->mapped =
+            static_cast<uint8_t*>(block->memory.mapMemory(0, vk::WholeSize));
+    }
+
+    // reuse the slot of a released block
+    for (uint32_t i = 0; i < m_blocks.size(); i++) {
+        if (!m_blocks[i]) {
+            m_blocks[i] = std::move(block);
+            return i;
+        }
+    }
+    m_blocks.push_back(std::move(block));
+    return m_blocks.size() - 1;
+}
+
+bool Allocator::try_allocate(uint32_t block_index,
+                             vk::MemoryRequirements const& requirements,
+                             Allocation& allocation) {
+    Block& block = *m_blocks[block_index];
+    for (auto it = block.free_ranges.begin(); it != block.free_ranges.end();
+         it++) {
+        vk::DeviceSize range_offset = it->first;
+        vk::DeviceSize range_end = it->first + it->second;
+        vk::DeviceSize offset = align_up(range_offset, requirements.alignment);
+        if (offset + requirements.size > range_end) {
+            continue;
+        }
+
+        // the padding in front stays free, as does the tail
+        block.free_ranges.erase(it);
+        if (offset > range_offset) {
+            block.free_ranges[range_offset] = offset - range_offset;
+        }
+        if (offset + requirements.size < range_end) {
+            block.free_ranges[offset + requirements.size] =
+                range_end - offset - requirements.size;
+        }
+        block.used += requirements.size;
+
+        allocation.m_allocator = this;
+        allocation.m_block = block_index;
+        allocation.m_memory = *block.memory;
+        allocation.m_offset = offset;
+        allocation.m_size = requirements.size;
+        allocation.m_mapped =
+            block.mapped != nullptr ? block.mapped + offset : nullptr;
+        return true;
+    }
+    return false;
+}
+
+Allocation Allocator::allocate(vk::MemoryRequirements const& requirements,
+                               vk::MemoryPropertyFlags required,
+                               vk::MemoryPropertyFlags preferred,
+                               bool linear) {
+    uint32_t memory_type =
+        find_memory_type(requirements.memoryTypeBits, required, preferred);
+    Allocation allocation;
+
+    if (requirements.size > BLOCK_SIZE / 2) {
+        uint32_t block_index =
+            create_block(memory_type, requirements.size, linear, true);
+        try_allocate(block_index, requirements, allocation);
+        return allocation;
+    }
+
+    for (uint32_t i = 0; i < m_blocks.size(); i++) {
+        Block* block = m_blocks[i].get();
+        if (block != nullptr && !block->dedicated &&
+            block->memory_type == memory_type && block->linear == linear &&
+            try_allocate(i, requirements, allocation)) {
+            return allocation;
+        }
+    }
+
+    // small heaps, like the host visible device local one without
+    // resizable BAR, don't get filled up by a single block
+    vk::DeviceSize heap_size =
+        m_memory_properties
+            .memoryHeaps[m_memory_properties.memoryTypes[memory_type].heapIndex]
+            .size;
+    vk::DeviceSize block_size =
+        std::max(std::min(BLOCK_SIZE, heap_size / 8), requirements.size);
+    uint32_t block_index =
+        create_block(memory_type, block_size, linear, false);
+    try_allocate(block_index, requirements, allocation);
+    return allocation;
+}
+
+void Allocator::free(Allocation& allocation) {
+    Block& block = *m_blocks[allocation.m_block];
+    block.used -= allocation.m_size;
+    if (block.dedicated) {
+        m_blocks[allocation.m_block].reset();
+        return;
+    }
+
+    vk::DeviceSize offset = allocation.m_offset;
+    vk::DeviceSize size = allocation.m_size;
+    auto next = block.free_ranges.lower_bound(offset);
+    if (next != block.free_ranges.end() && offset + size == next->first) {
+        size += next->second;
+        next = block.free_ranges.erase(next);
+    }
+    if (next != block.free_ranges.begin()) {
+        auto previous = std::prev(next);
+        if (previous->first + previous->second == offset) {
+            previous->second += size;
+            return;
+        }
+    }
+    block.free_ranges[offset] = size;
+}
+
+std::pair<vk::raii::Buffer, Allocation> Allocator::create_buffer(
+    vk::BufferCreateInfo const& create_info, vk::MemoryPropertyFlags required,
+    vk::MemoryPropertyFlags preferred) {
+    vk::raii::Buffer buffer(m_device, create_info);
+    Allocation allocation =
+        allocate(buffer.getMemoryRequirements(), required, preferred, true);
+    buffer.bindMemory(allocation.memory(), allocation.offset());
+    return {std::move(buffer), std::move(allocation)};
+}
+
+std::pair<vk::raii::Image, Allocation> Allocator::create_image(
+    vk::ImageCreateInfo const& create_info, vk::MemoryPropertyFlags required,
+    vk::MemoryPropertyFlags preferred) {
+    vk::raii::Image image(m_device, create_info);
+    Allocation allocation =
+        allocate(image.getMemoryRequirements(), required, preferred,
+                 create_info.tiling == vk::ImageTiling::eLinear);
+    image.bindMemory(allocation.memory(), allocation.offset());
+    return {std::move(image), std::move(allocation)};
+}
+
+vk::DeviceSize Allocator::device_local_available() {
+    std::vector<vk::DeviceSize> held(m_memory_properties.memoryHeapCount, 0);
+    for (auto const& block : m_blocks) {
+        if (block) {
+            held[m_memory_properties.memoryTypes[block->memory_type]
+                     .heapIndex] += block->size;
+        }
+    }
+
+    vk::PhysicalDeviceMemoryBudgetPropertiesEXT budget;
+    if (m_memory_budget) {
+        budget = m_physical_device
+                     .getMemoryProperties2<
+                         vk::PhysicalDeviceMemoryProperties2,
+                         vk::PhysicalDeviceMemoryBudgetPropertiesEXT>()
+                     .get<vk::PhysicalDeviceMemoryBudgetPropertiesEXT>();
+    }
+
+    vk::DeviceSize available = 0;
+    for (uint32_t i = 0; i < m_memory_properties.memoryHeapCount; i++) {
+        vk::MemoryHeap const& heap = m_memory_properties.memoryHeaps[i];
+        if (!(heap.flags & vk::MemoryHeapFlagBits::eDeviceLocal)) {
+            continue;
+        }
+        vk::DeviceSize heap_available =
+            m_memory_budget
+                ? budget.heapBudget[i] -
+                      std::min(budget.heapBudget[i], budget.heapUsage[i])
+                : heap.size - std::min(heap.size, held[i]);
+        available = std::max(available, heap_available);
+    }
+    return available;
+}
+
+void Allocator::print_report() {
+    vk::PhysicalDeviceMemoryBudgetPropertiesEXT budget;
+    if (m_memory_budget) {
+        budget = m_physical_device
+                     .getMemoryProperties2<
+                         vk::PhysicalDeviceMemoryProperties2,
+                         vk::PhysicalDeviceMemoryBudgetPropertiesEXT>()
+                     .get<vk::PhysicalDeviceMemoryBudgetPropertiesEXT>();
+    }
+
+    printf("device memory:\n");
+    for (uint32_t i = 0; i < m_memory_properties.memoryHeapCount; i++) {
+        uint32_t block_count = 0;
+        vk::DeviceSize held = 0;
+        vk::DeviceSize used = 0;
+        for (auto const& block : m_blocks) {
+            if (block &&
+                m_memory_properties.memoryTypes[block->memory_type]
+                        .heapIndex == i) {
+                block_count++;
+                held += block->size;
+                used += block->used;
+            }
+        }
+
+        vk::MemoryHeap const& heap = m_memory_properties.memoryHeaps[i];
+        printf("  heap %u%s: %u blocks, %.1f MiB held, %.1f MiB used", i,
+               heap.flags & vk::MemoryHeapFlagBits::eDeviceLocal
+                   ? " (device local)"
+                   : "",
+               block_count, mebibytes(held), mebibytes(used));
+        if (m_memory_budget) {
+            printf(", process usage %.1f of %.1f MiB budget\n",
+                   mebibytes(budget.heapUsage[i]),
+                   mebibytes(budget.heapBudget[i]));
+        } else {
+            printf(", heap size %.1f MiB\n", mebibytes(heap.size));
+        }
+    }
+}
+}  // namespace gfx
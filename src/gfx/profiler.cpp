@@ -0,0 +1,218 @@
+#include "gfx/profiler.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <numeric>
+#include <stdexcept>
+#include <vulkan/vulkan_enums.hpp>
+#include <vulkan/vulkan_structs.hpp>
+
+// passes per frame the query pools have room for
+const static uint32_t MAX_PASSES = 16;
+
+namespace gfx {
+namespace {
+struct Summary {
+    double min;
+    double mean;
+    double p99;
+};
+
+Summary summarize(std::deque<double> const& samples) {
+    if (samples.empty()) {
+        return {0.0, 0.0, 0.0};
+    }
+    std::vector<double> sorted(samples.begin(), samples.end());
+    std::sort(sorted.begin(), sorted.end());
+    double sum = std::accumulate(sorted.begin(), sorted.end(), 0.0);
+    size_t p99_index = std::min(sorted.size() - 1,
+                                static_cast<size_t>(0.99 * sorted.size()));
+    return {sorted.front(), sum / sorted.size(), sorted[p99_index]};
+}
+}  // namespace
+
+Profiler::Profiler(Core& core, uint32_t frames_in_flight, uint32_t window)
+    : m_slot_passes(frames_in_flight), m_window(window) {
+    std::vector<vk::QueueFamilyProperties> queue_family_properties =
+        core.physical_device()->getQueueFamilyProperties();
+    uint32_t valid_bits = 64;
+    for (uint32_t family_index : core.queue_family_indices()) {
+        valid_bits = std::min(
+            valid_bits, queue_family_properties[family_index].timestampValidBits);
+    }
+    if (valid_bits == 0) {
+        throw std::runtime_error("the device doesn't support timestamps");
+    }
+    if (valid_bits < 64) {
+        m_timestamp_mask = (1ull << valid_bits) - 1;
+    }
+    m_timestamp_period =
+        core.physical_device()->getProperties().limits.timestampPeriod;
+
+    for (uint32_t i = 0; i < frames_in_flight; i++) {
+        m_timestamp_pools.emplace_back(
+            *core.device(),
+            vk::QueryPoolCreateInfo({}, vk::QueryType::eTimestamp,
+                                    2 * MAX_PASSES));
+        m_timestamp_pools.back().reset(0, 2 * MAX_PASSES);
+        if (core.pipeline_statistics()) {
+            m_statistics_pools.emplace_back(
+                *core.device(),
+                vk::QueryPoolCreateInfo(
+                    {}, vk::QueryType::ePipelineStatistics, MAX_PASSES,
+                    vk::QueryPipelineStatisticFlagBits::
+                        eComputeShaderInvocations));
+            m_statistics_pools.back().reset(0, MAX_PASSES);
+        }
+    }
+}
+
+Profiler::~Profiler() {}
+
+uint32_t Profiler::pass_index(std::string const& name, bool cpu) {
+    for (uint32_t i = 0; i < m_passes.size(); i++) {
+        if (m_passes[i].name == name) {
+            return i;
+        }
+    }
+    m_passes.push_back(Pass{.name = name, .cpu = cpu});
+    return m_passes.size() - 1;
+}
+
+void Profiler::begin_frame(uint32_t slot) {
+    m_slot = slot;
+    std::vector<uint32_t>& passes = m_slot_passes[slot];
+    if (passes.empty()) {
+        return;
+    }
+
+    uint32_t count = passes.size();
+    auto [result, timestamps] =
+        m_timestamp_pools[slot].getResults<uint64_t>(
+            0, 2 * count, 2 * count * sizeof(uint64_t), sizeof(uint64_t),
+            vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWait);
+    std::vector<uint64_t> invocations;
+    if (!m_statistics_pools.empty()) {
+        invocations =
+            m_statistics_pools[slot]
+                .getResults<uint64_t>(
+                    0, count, count * sizeof(uint64_t), sizeof(uint64_t),
+                    vk::QueryResultFlagBits::e64 |
+                        vk::QueryResultFlagBits::eWait)
+                .second;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        Pass& pass = m_passes[passes[i]];
+        uint64_t ticks =
+            (timestamps[2 * i + 1] - timestamps[2 * i]) & m_timestamp_mask;
+        pass.samples.push_back(ticks * m_timestamp_period / 1.0e6);
+        if (pass.samples.size() > m_window) {
+            pass.samples.pop_front();
+        }
+        if (!invocations.empty()) {
+            pass.invocations.push_back(invocations[i]);
+            if (pass.invocations.size() > m_window) {
+                pass.invocations.pop_front();
+            }
+        }
+    }
+
+    // host resets, so the queries can be written from any queue
+    m_timestamp_pools[slot].reset(0, 2 * count);
+    if (!m_statistics_pools.empty()) {
+        m_statistics_pools[slot].reset(0, count);
+    }
+    passes.clear();
+}
+
+void Profiler::end_frame() {
+    m_frame_count++;
+    if (m_frame_count % m_window == 0) {
+        print_report();
+    }
+}
+
+void Profiler::begin(vk::raii::CommandBuffer const& command_buffer,
+                     std::string const& name) {
+    std::vector<uint32_t>& passes = m_slot_passes[m_slot];
+    if (passes.size() == MAX_PASSES) {
+        throw std::runtime_error("too many profiled passes in one frame");
+    }
+    uint32_t query = passes.size();
+    passes.push_back(pass_index(name, false));
+
+    // all commands, so the pass doesn't start before the work before it ends
+    command_buffer.writeTimestamp2(vk::PipelineStageFlagBits2::eAllCommands,
+                                   *m_timestamp_pools[m_slot], 2 * query);
+    if (!m_statistics_pools.empty()) {
+        command_buffer.beginQuery(*m_statistics_pools[m_slot], query, {});
+    }
+}
+
+void Profiler::end(vk::raii::CommandBuffer const& command_buffer) {
+    uint32_t query = m_slot_passes[m_slot].size() - 1;
+    if (!m_statistics_pools.empty()) {
+        command_buffer.endQuery(*m_statistics_pools[m_slot], query);
+    }
+    command_buffer.writeTimestamp2(vk::PipelineStageFlagBits2::eAllCommands,
+                                   *m_timestamp_pools[m_slot], 2 * query + 1);
+}
+
+void Profiler::add_cpu_sample(std::string const& name, double milliseconds) {
+    Pass& pass = m_passes[pass_index(name, true)];
+    pass.samples.push_back(milliseconds);
+    if (pass.samples.size() > m_window) {
+        pass.samples.pop_front();
+    }
+}
+
+void Profiler::print_report() {
+    printf("frame %llu, last %u frames (ms):\n",
+           static_cast<unsigned long long>(m_frame_count), m_window);
+    for (Pass const& pass : m_passes) {
+        Summary summary = summarize(pass.samples);
+        printf("  %-12s %-3s min %8.3f  mean %8.3f  p99 %8.3f", pass.name.c_str(),
+               pass.cpu ? "cpu" : "gpu", summary.min, summary.mean, summary.p99);
+        if (!pass.invocations.empty()) {
+            printf("  invocations %llu",
+                   static_cast<unsigned long long>(pass.invocations.back()));
+        }
+        printf("\n");
+    }
+}
+
+void Profiler::write_json(std::string const& path) {
+    std::FILE* file = std::fopen(path.c_str(), "w");
+    if (file == nullptr) {
+        printf("error: could not open %s for writing\n", path.c_str());
+        return;
+    }
+
+    std::fprintf(file, "{\n  \"frames\": %llu,\n  \"window\": %u,\n",
+                 static_cast<unsigned long long>(m_frame_count), m_window);
+    std::fprintf(file, "  \"passes\": [");
+    for (size_t i = 0; i < m_passes.size(); i++) {
+        Pass const& pass = m_passes[i];
+        Summary summary = summarize(pass.samples);
+        std::fprintf(file,
+                     "%s\n    {\"name\": \"%s\", \"clock\": \"%s\", "
+                     "\"min_ms\": %.6f, \"mean_ms\": %.6f, \"p99_ms\": %.6f",
+                     i == 0 ? "" : ",", pass.name.c_str(),
+                     pass.cpu ? "cpu" : "gpu", summary.min, summary.mean,
+                     summary.p99);
+        if (!pass.invocations.empty()) {
+            std::fprintf(file, ", \"invocations\": %llu",
+                         static_cast<unsigned long long>(
+                             pass.invocations.back()));
+        }
+        std::fprintf(file, ", \"samples_ms\": [");
+        for (size_t j = 0; j < pass.samples.size(); j++) {
+            std::fprintf(file, "%s%.6f", j == 0 ? "" : ", ", pass.samples[j]);
+        }
+        std::fprintf(file, "]}");
+    }
+    std::fprintf(file, "\n  ]\n}\n");
+    std::fclose(file);
+}
+}  // namespace gfx
@@ -0,0 +1,58 @@
+#include "gfx/readback.hpp"
+
+#include <cstring>
+#include <limits>
+#include <vulkan/vulkan_enums.hpp>
+#include <vulkan/vulkan_structs.hpp>
+
+#include "gfx.hpp"
+
+namespace gfx {
+void submit_and_wait(
+    Core& core,
+    std::function<void(vk::raii::CommandBuffer const&)> const& record) {
+    vk::raii::Device& device = *core.device();
+    vk::raii::CommandBuffers command_buffers(
+        device, vk::CommandBufferAllocateInfo(
+                    *core.command_pool(), vk::CommandBufferLevel::ePrimary, 1));
+    vk::raii::CommandBuffer& command_buffer = command_buffers.front();
+    vk::raii::Fence fence(device, vk::FenceCreateInfo());
+
+    command_buffer.begin(vk::CommandBufferBeginInfo(
+        vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+    record(command_buffer);
+    command_buffer.end();
+    core.graphics_queue()->submit(vk::SubmitInfo({}, {}, *command_buffer),
+                                  *fence);
+    while (device.waitForFences({*fence}, vk::True,
+                                std::numeric_limits<uint64_t>::max()) ==
+           vk::Result::eTimeout);
+}
+
+void read_back(Core& core, vk::Buffer buffer, void* data,
+               vk::DeviceSize size) {
+    auto [readback, readback_memory] = core.allocator()->create_buffer(
+        vk::BufferCreateInfo({}, size, vk::BufferUsageFlagBits::eTransferDst),
+        vk::MemoryPropertyFlagBits::eHostVisible |
+            vk::MemoryPropertyFlagBits::eHostCoherent,
+        vk::MemoryPropertyFlagBits::eHostCached);
+    submit_and_wait(core, [&](vk::raii::CommandBuffer const& command_buffer) {
+        vk::MemoryBarrier2 before_copy(
+            vk::PipelineStageFlagBits2::eAllCommands,
+            vk::AccessFlagBits2::eMemoryWrite,
+            vk::PipelineStageFlagBits2::eTransfer,
+            vk::AccessFlagBits2::eTransferRead);
+        command_buffer.pipelineBarrier2(
+            vk::DependencyInfo({}, before_copy, {}, {}));
+        command_buffer.copyBuffer(buffer, *readback,
+                                  vk::BufferCopy(0, 0, size));
+        vk::MemoryBarrier2 after_copy(vk::PipelineStageFlagBits2::eTransfer,
+                                      vk::AccessFlagBits2::eTransferWrite,
+                                      vk::PipelineStageFlagBits2::eHost,
+                                      vk::AccessFlagBits2::eHostRead);
+        command_buffer.pipelineBarrier2(
+            vk::DependencyInfo({}, after_copy, {}, {}));
+    });
+    std::memcpy(data, readback_memory.mapped(), size);
+}
+}  // namespace gfx
@@ -0,0 +1,185 @@
+#include "gfx/staging.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <limits>
+#include <stdexcept>
+#include <vulkan/vulkan_enums.hpp>
+#include <vulkan/vulkan_structs.hpp>
+
+#include "gfx.hpp"
+
+// repetitions per size of benchmark_staging, after one warm-up round
+const static uint32_t BENCHMARK_REPETITIONS = 8;
+
+namespace gfx {
+Upload::~Upload() {
+    if (*m_fence) {
+        wait();
+    }
+}
+
+bool Upload::done() {
+    return !*m_fence || m_fence.getStatus() == vk::Result::eSuccess;
+}
+
+void Upload::wait() {
+    if (!*m_fence) {
+        return;
+    }
+    // large uploads may take longer than any fixed timeout
+    if (m_device->waitForFences({*m_fence}, vk::True,
+                                std::numeric_limits<uint64_t>::max()) !=
+        vk::Result::eSuccess) {
+        throw std::runtime_error("failed to wait for an upload");
+    }
+    m_fence.clear();
+    m_command_buffer.clear();
+    m_staging_buffer.clear();
+    m_staging_memory = nullptr;
+}
+
+StagingArena::StagingArena(Core& core, vk::DeviceSize capacity)
+    : m_core(core), m_capacity(capacity) {
+    if (capacity == 0) {
+        return;
+    }
+    std::tie(m_staging_buffer, m_staging_memory) =
+        core.allocator()->create_buffer(
+            vk::BufferCreateInfo({}, capacity,
+                                 vk::BufferUsageFlagBits::eTransferSrc),
+            vk::MemoryPropertyFlagBits::eHostVisible |
+                vk::MemoryPropertyFlagBits::eHostCoherent);
+}
+
+void* StagingArena::reserve(vk::DeviceSize size) {
+    if (!*m_staging_buffer) {
+        throw std::runtime_error("staging arena was already submitted");
+    }
+    if (m_used + aligned(size) > m_capacity) {
+        throw std::runtime_error("staging arena is full");
+    }
+    vk::DeviceSize offset = m_used;
+    m_used += aligned(size);
+    return static_cast<uint8_t*>(m_staging_memory.mapped()) + offset;
+}
+
+void StagingArena::copy_range(void const* staged, vk::DeviceSize size,
+                              vk::Buffer destination,
+                              vk::DeviceSize destination_offset) {
+    uint8_t const* base = static_cast<uint8_t const*>(m_staging_memory.mapped());
+    uint8_t const* begin = static_cast<uint8_t const*>(staged);
+    if (base == nullptr || begin < base || begin + size > base + m_used) {
+        throw std::runtime_error("copy of memory outside the staging arena");
+    }
+    m_copies.push_back({destination,
+                        vk::BufferCopy(begin - base, destination_offset, size)});
+}
+
+void StagingArena::fill(vk::Buffer destination, vk::DeviceSize size,
+                        uint32_t value, vk::DeviceSize destination_offset) {
+    m_fills.push_back({destination, destination_offset, size, value});
+}
+
+Upload StagingArena::submit() {
+    vk::raii::Device& device = *m_core.device();
+    bool transfer_queue = m_core.has_transfer_queue();
+    vk::raii::CommandPool& command_pool = transfer_queue
+                                              ? *m_core.transfer_command_pool()
+                                              : *m_core.command_pool();
+    vk::raii::Queue& queue =
+        transfer_queue ? *m_core.transfer_queue() : *m_core.graphics_queue();
+
+    Upload upload;
+    upload.m_device = &device;
+    upload.m_size = m_used;
+    upload.m_command_buffer = std::move(
+        vk::raii::CommandBuffers(
+            device, vk::CommandBufferAllocateInfo(
+                        *command_pool, vk::CommandBufferLevel::ePrimary, 1))
+            .front());
+    upload.m_fence = vk::raii::Fence(device, vk::FenceCreateInfo());
+
+    vk::raii::CommandBuffer& command_buffer = upload.m_command_buffer;
+    command_buffer.begin(vk::CommandBufferBeginInfo(
+        vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+    // one copy command per run of regions that share a destination
+    for (size_t first = 0; first < m_copies.size();) {
+        size_t last = first;
+        std::vector<vk::BufferCopy> regions;
+        while (last < m_copies.size() &&
+               m_copies[last].destination == m_copies[first].destination) {
+            regions.push_back(m_copies[last].region);
+            last++;
+        }
+        command_buffer.copyBuffer(*m_staging_buffer,
+                                  m_copies[first].destination, regions);
+        first = last;
+    }
+    for (Fill const& fill : m_fills) {
+        command_buffer.fillBuffer(fill.destination, fill.offset, fill.size,
+                                  fill.value);
+    }
+    command_buffer.end();
+
+    vk::CommandBufferSubmitInfo command_buffer_info(*command_buffer);
+    queue.submit2(vk::SubmitInfo2({}, {}, command_buffer_info),
+                  *upload.m_fence);
+
+    upload.m_staging_buffer = std::move(m_staging_buffer);
+    upload.m_staging_memory = std::move(m_staging_memory);
+    m_copies.clear();
+    m_fills.clear();
+    return upload;
+}
+
+void benchmark_staging(Core& core) {
+    // a quarter of the free device memory for the destination and the staging
+    // buffer each leaves room for everything else
+    vk::DeviceSize max_size =
+        std::min<vk::DeviceSize>(256ull << 20,
+                                 core.allocator()->device_local_available() / 4);
+
+    printf("staging benchmark on the %s queue, %u repetitions per size\n",
+           core.has_transfer_queue() ? "transfer" : "graphics",
+           BENCHMARK_REPETITIONS);
+    printf("%10s %14s %14s\n", "size", "stage GiB/s", "copy GiB/s");
+    for (vk::DeviceSize size = 1ull << 20; size <= max_size; size *= 4) {
+        auto [destination, destination_memory] =
+            core.allocator()->create_buffer(
+                vk::BufferCreateInfo({}, size,
+                                     vk::BufferUsageFlagBits::eTransferDst),
+                vk::MemoryPropertyFlagBits::eDeviceLocal);
+
+        double stage_seconds = 0.0;
+        double copy_seconds = 0.0;
+        for (uint32_t i = 0; i <= BENCHMARK_REPETITIONS; i++) {
+            StagingArena arena(core, size);
+
+            auto stage_start = std::chrono::steady_clock::now();
+            std::span<uint8_t> staged = arena.stage<uint8_t>(*destination, size);
+            std::fill(staged.begin(), staged.end(), static_cast<uint8_t>(i));
+            auto copy_start = std::chrono::steady_clock::now();
+            arena.submit().wait();
+            auto copy_end = std::chrono::steady_clock::now();
+
+            // the first round pays for page faults and clock ramp-up
+            if (i > 0) {
+                stage_seconds +=
+                    std::chrono::duration<double>(copy_start - stage_start)
+                        .count();
+                copy_seconds +=
+                    std::chrono::duration<double>(copy_end - copy_start)
+                        .count();
+            }
+        }
+
+        double gibibytes =
+            BENCHMARK_REPETITIONS * size / (1024.0 * 1024.0 * 1024.0);
+        printf("%7llu MiB %14.2f %14.2f\n",
+               static_cast<unsigned long long>(size >> 20),
+               gibibytes / stage_seconds, gibibytes / copy_seconds);
+    }
+}
+}  // namespace gfx
@@ -23,6 +23,58 @@ uint32_t find_graphics_queue_family_index(
                                                graphicsQueueFamilyProperty));
 }
 
+uint32_t find_compute_queue_family_index(
+    std::vector<vk::QueueFamilyProperties> const& queue_family_properties) {
+    // a compute family without graphics is usually backed by separate
+    // hardware queues; returns queue_family_properties.size() if there is none
+    std::vector<vk::QueueFamilyProperties>::const_iterator
+        computeQueueFamilyProperty = std::find_if(
+            queue_family_properties.begin(), queue_family_properties.end(),
+            [](vk::QueueFamilyProperties const& qfp) {
+                return (qfp.queueFlags & vk::QueueFlagBits::eCompute) &&
+                       !(qfp.queueFlags & vk::QueueFlagBits::eGraphics);
+            });
+    return static_cast<uint32_t>(std::distance(queue_family_properties.begin(),
+                                               computeQueueFamilyProperty));
+}
+
+uint32_t find_transfer_queue_family_index(
+    std::vector<vk::QueueFamilyProperties> const& queue_family_properties) {
+    // a family that can only transfer is usually a DMA engine that copies
+    // alongside graphics and compute; returns queue_family_properties.size()
+    // if there is none
+    std::vector<vk::QueueFamilyProperties>::const_iterator
+        transferQueueFamilyProperty = std::find_if(
+            queue_family_properties.begin(), queue_family_properties.end(),
+            [](vk::QueueFamilyProperties const& qfp) {
+                return (qfp.queueFlags & vk::QueueFlagBits::eTransfer) &&
+                       !(qfp.queueFlags & (vk::QueueFlagBits::eGraphics |
+                                           vk::QueueFlagBits::eCompute));
+            });
+    return static_cast<uint32_t>(std::distance(queue_family_properties.begin(),
+                                               transferQueueFamilyProperty));
+}
+
+uint32_t find_compute_capable_queue_family_index(
+    std::vector<vk::QueueFamilyProperties> const& queue_family_properties) {
+    // prefers a family that can also do graphics, like the one the windowed
+    // path uses; returns queue_family_properties.size() if there is none
+    uint32_t fallback = queue_family_properties.size();
+    for (uint32_t i = 0; i < queue_family_properties.size(); i++) {
+        vk::QueueFlags flags = queue_family_properties[i].queueFlags;
+        if (!(flags & vk::QueueFlagBits::eCompute)) {
+            continue;
+        }
+        if (flags & vk::QueueFlagBits::eGraphics) {
+            return i;
+        }
+        if (fallback == queue_family_properties.size()) {
+            fallback = i;
+        }
+    }
+    return fallback;
+}
+
 std::tuple<uint32_t, uint32_t> find_graphics_and_present_queue_family_index(
     vk::raii::PhysicalDevice const& physical_device,
     vk::raii::SurfaceKHR const& surface) {
@@ -235,38 +287,55 @@ void set_image_layout(vk::raii::CommandBuffer const& commandBuffer,
     return commandBuffer.pipelineBarrier(sourceStage, destinationStage, {},
                                          nullptr, nullptr, imageMemoryBarrier);
 }
-void copy_buffers_to_device_local(
-    vk::raii::Device& device, vk::raii::CommandBuffer& command_buffer,
-    vk::raii::Queue queue, std::vector<vk::raii::Buffer> const& staging_buffers,
-    std::vector<vk::raii::Buffer*> const& device_buffers,
-    std::vector<vk::DeviceSize> sizes) {
-    if (staging_buffers.size() == 0 | device_buffers.size() == 0) {
-        printf("error: Buffers cannot be of size zero!");
-        exit(-1);
-    }
-    if (staging_buffers.size() != device_buffers.size()) {
-        printf("Error: Buffers arent same sized! (staging: %zu, device: %zu)\n",
-               staging_buffers.size(), device_buffers.size());
-        exit(-1);
-    }
-
-    command_buffer.begin(vk::CommandBufferBeginInfo());
-    for (auto i = 0; i < staging_buffers.size(); i++) {
-        command_buffer.copyBuffer(*staging_buffers[i], *device_buffers[i],
-                                  {vk::BufferCopy(0, 0, sizes[i])});
+std::pair<vk::raii::Buffer, Allocation> make_buffer(
+    Allocator& allocator, vk::DeviceSize size, vk::BufferUsageFlags usage,
+    vk::MemoryPropertyFlags properties) {
+    return allocator.create_buffer(vk::BufferCreateInfo({}, size, usage),
+                                   properties);
+}
+void update_storage_buffer_descriptors(
+    vk::raii::Device const& device, vk::DescriptorSet descriptor_set,
+    std::vector<vk::Buffer> const& buffers) {
+    // binding i of the set receives buffers[i] as a whole
+    std::vector<vk::DescriptorBufferInfo> buffer_infos;
+    buffer_infos.reserve(buffers.size());
+    for (vk::Buffer buffer : buffers) {
+        buffer_infos.emplace_back(buffer, 0, vk::WholeSize);
     }
-    command_buffer.end();
-
-    vk::raii::Fence transfer_fence(device, vk::FenceCreateInfo());
 
-    vk::SubmitInfo submit_info({}, {}, *command_buffer);
-
-    queue.submit({submit_info}, *transfer_fence);
-
-    if (device.waitForFences({transfer_fence}, vk::True, util::TIMEOUT) !=
-        vk::Result::eSuccess) {
-        printf("Failed to wait for fence during transfer stage!\n");
+    std::vector<vk::WriteDescriptorSet> writes;
+    writes.reserve(buffers.size());
+    for (size_t i = 0; i < buffer_infos.size(); i++) {
+        writes.emplace_back(descriptor_set, static_cast<uint32_t>(i), 0,
+                            vk::DescriptorType::eStorageBuffer, nullptr,
+                            buffer_infos[i]);
     }
+    device.updateDescriptorSets(writes, nullptr);
+}
+void compute_barrier(vk::raii::CommandBuffer const& command_buffer) {
+    // makes compute and transfer writes visible to the next compute dispatch
+    vk::MemoryBarrier2 memory_barrier(
+        vk::PipelineStageFlagBits2::eComputeShader |
+            vk::PipelineStageFlagBits2::eTransfer,
+        vk::AccessFlagBits2::eShaderWrite | vk::AccessFlagBits2::eTransferWrite,
+        vk::PipelineStageFlagBits2::eComputeShader,
+        vk::AccessFlagBits2::eShaderRead | vk::AccessFlagBits2::eShaderWrite);
+    command_buffer.pipelineBarrier2(
+        vk::DependencyInfo({}, memory_barrier, {}, {}));
+}
+void indirect_barrier(vk::raii::CommandBuffer const& command_buffer) {
+    // compute_barrier, and makes the writes visible to indirect dispatches
+    // reading their arguments too
+    vk::MemoryBarrier2 memory_barrier(
+        vk::PipelineStageFlagBits2::eComputeShader |
+            vk::PipelineStageFlagBits2::eTransfer,
+        vk::AccessFlagBits2::eShaderWrite | vk::AccessFlagBits2::eTransferWrite,
+        vk::PipelineStageFlagBits2::eComputeShader |
+            vk::PipelineStageFlagBits2::eDrawIndirect,
+        vk::AccessFlagBits2::eShaderRead | vk::AccessFlagBits2::eShaderWrite |
+            vk::AccessFlagBits2::eIndirectCommandRead);
+    command_buffer.pipelineBarrier2(
+        vk::DependencyInfo({}, memory_barrier, {}, {}));
 }
 }  // namespace util
 }  // namespace gfx
@@ -1,9 +1,51 @@
-
+#include <cstdio>
+#include <stdexcept>
 
 #include "galaxy.hpp"
+#include "galaxy/cpu_engine.hpp"
+#include "galaxy/star_sort.hpp"
+#include "galaxy/trajectory.hpp"
+#include "gfx/staging.hpp"
 
 int main(int argc, char** argv) {
-    galaxy::Galaxy galaxy;
+    galaxy::Settings settings = galaxy::Settings::from_args(argc, argv);
+    if (!settings.inspect_trajectory_path.empty()) {
+        try {
+            galaxy::inspect_trajectory(settings.inspect_trajectory_path);
+        } catch (std::runtime_error& err) {
+            printf("error: %s\n", err.what());
+            return -1;
+        }
+        return 0;
+    }
+    if (settings.cpu) {
+        try {
+            return galaxy::run_cpu(settings) ? 0 : 1;
+        } catch (std::runtime_error& err) {
+            printf("error: %s\n", err.what());
+            return -1;
+        }
+    }
+    if (settings.benchmark_staging) {
+        gfx::Core core(true);
+        gfx::benchmark_staging(core);
+        return 0;
+    }
+    if (settings.check_sort) {
+        gfx::Core core(true);
+        return galaxy::check_star_sort(core, settings.star_count) ? 0 : 1;
+    }
+    if (settings.benchmark_sort) {
+        gfx::Core core(true);
+        galaxy::benchmark_star_sort(core);
+        return 0;
+    }
+    if (settings.check_cpu) {
+        gfx::Core core(true);
+        return galaxy::check_cpu_engine(core, settings.star_count) ? 0 : 1;
+    }
+
+    galaxy::Galaxy galaxy(settings);
     galaxy.run();
     
     return 0;
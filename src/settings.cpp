@@ -0,0 +1,366 @@
+#include "settings.hpp"
+
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+namespace galaxy {
+// the whole value has to be a number that fits into T, negative values of
+// unsigned options are rejected instead of wrapping around
+template <typename T>
+static T parse_number(std::string const& arg, std::string const& value) {
+    T number{};
+    char const* end = value.data() + value.size();
+    auto [ptr, ec] = std::from_chars(value.data(), end, number);
+    if (ec != std::errc() || ptr != end) {
+        printf("error: invalid value '%s' for %s\n", value.c_str(),
+               arg.c_str());
+        exit(-1);
+    }
+    return number;
+}
+
+static void print_usage(const char* program) {
+    printf(
+        "usage: %s [options]\n"
+        "  --stars <n|auto>              number of simulated stars, auto sizes "
+        "it to the free device memory (default: 2048)\n"
+        "  --model <cube|plummer|disk|spiral>\n"
+        "                                initial conditions (default: cube)\n"
+        "  --seed <n>                    seed of the initial conditions "
+        "(default: 1)\n"
+        "  --model-radius <m>            scale radius of the model in meters "
+        "(default: 1e10)\n"
+        "  --star-mass <kg>              mass of every star of the plummer "
+        "and disk models (default: 1e20)\n"
+        "  --catalog <path>              load the stars from a CSV or ASCII "
+        "catalog with x, y, z columns in parsecs, cached in <path>.gsnap\n"
+        "  --frames-in-flight <n>        frames recorded ahead of the GPU "
+        "(default: 2)\n"
+        "  --solver <direct|tiled|barnes-hut|pm>\n"
+        "                                gravity solver (default: direct)\n"
+        "  --opening-angle <theta>       Barnes-Hut opening angle "
+        "(default: 0.5)\n"
+        "  --tile-size <n>               stars per shared memory tile of the "
+        "tiled solver, 1 to 1024 (default: 256)\n"
+        "  --pm-grid <n>                 nodes per axis of the particle-mesh "
+        "grid, a power of two from 16 to 256 (default: 64)\n"
+        "  --timestep-levels <n>         power-of-two timestep levels of the "
+        "direct solver, 1 to 8 (default: 1)\n"
+        "  --timestep-accuracy <eta>     fraction of a star's time scale its "
+        "step may take (default: 0.02)\n"
+        "  --renderer <per-pixel|binned|sprites>\n"
+        "                                star renderer, R switches between "
+        "sprites and the others (default: per-pixel)\n"
+        "  --brightness-threshold <b>    brightness below which the binned "
+        "and sprite renderers cut a star off (default: 1/512)\n"
+        "  --bin-entries-per-star <n>    tile list entries reserved per star "
+        "(default: 16)\n"
+        "  --steps-per-second <n>        fixed simulation rate, 0 for one step "
+        "per frame (default: 60)\n"
+        "  --max-substeps <n>            most simulation steps per frame "
+        "(default: 4)\n"
+        "  --fast-forward <n>            steps simulated without rendering "
+        "before the first frame and on F (default: 0)\n"
+        "  --headless                    render without a window or display\n"
+        "  --frames <n>                  frames rendered headless (default: "
+        "600)\n"
+        "  --output <path>               file the headless frames are written "
+        "to\n"
+        "  --output-format <y4m|raw>     y4m video or raw RGBA8 frames "
+        "(default: y4m)\n"
+        "  --fps <n>                     frame rate of the headless output "
+        "(default: 60)\n"
+        "  --profile                     time each pass with GPU timestamps\n"
+        "  --profile-window <n>          frames per profiler report "
+        "(default: 120)\n"
+        "  --profile-json <path>         dump the profiler results as JSON on "
+        "exit, implies --profile\n"
+        "  --snapshot <prefix>           write <prefix>-<step>.gsnap snapshots "
+        "on S and on exit\n"
+        "  --snapshot-every <steps>      also write one every <steps> steps, "
+        "implies --snapshot snapshot\n"
+        "  --restore <path>              resume from a snapshot instead of "
+        "generating stars\n"
+        "  --trajectory <path>           stream compressed positions to "
+        "<path>\n"
+        "  --trajectory-every <steps>    steps between trajectory frames "
+        "(default: 10)\n"
+        "  --inspect-trajectory <path>   print what a trajectory holds and "
+        "exit\n"
+        "  --diagnostics-every <steps>   print energies, momentum and radius "
+        "every <steps> steps, 0 never (default: 0)\n"
+        "  --sort-every <steps>          reorder the stars in Morton order "
+        "every <steps> steps, 0 never (default: 0)\n"
+        "  --cpu                         simulate on the CPU without Vulkan, "
+        "the cube model or --catalog\n"
+        "  --cpu-steps <n>               steps simulated by --cpu "
+        "(default: 100)\n"
+        "  --cpu-kernel <scalar|avx2|avx512>\n"
+        "                                pair loop of the CPU engine "
+        "(default: the widest supported)\n"
+        "  --benchmark-staging           measure upload bandwidth and exit\n"
+        "  --check-sort                  check the Morton sort on --stars "
+        "stars and exit\n"
+        "  --benchmark-sort              time the Morton sort and its effect "
+        "on a Barnes-Hut step and exit\n"
+        "  --check-cpu                   compare the CPU engine with the GPU "
+        "on --stars stars and exit\n",
+        program);
+}
+
+Settings Settings::from_args(int argc, char** argv) {
+    Settings settings;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        auto next_value = [&]() -> std::string {
+            if (i + 1 >= argc) {
+                printf("error: missing value for %s\n", arg.c_str());
+                exit(-1);
+            }
+            return argv[++i];
+        };
+        auto next_uint32 = [&]() {
+            return parse_number<uint32_t>(arg, next_value());
+        };
+        auto next_uint64 = [&]() {
+            return parse_number<uint64_t>(arg, next_value());
+        };
+        auto next_float = [&]() {
+            return parse_number<float>(arg, next_value());
+        };
+
+        if (arg == "--help" || arg == "-h") {
+            print_usage(argv[0]);
+            exit(0);
+        } else if (arg == "--stars") {
+            std::string stars = next_value();
+            settings.auto_star_count = stars == "auto";
+            if (settings.auto_star_count) {
+                continue;
+            }
+            settings.star_count = parse_number<uint32_t>(arg, stars);
+            if (settings.star_count == 0) {
+                printf("error: at least one star is needed\n");
+                exit(-1);
+            }
+        } else if (arg == "--model") {
+            std::string model = next_value();
+            if (model == "cube") {
+                settings.initial_model = InitialModel::eCube;
+            } else if (model == "plummer") {
+                settings.initial_model = InitialModel::ePlummer;
+            } else if (model == "disk") {
+                settings.initial_model = InitialModel::eDisk;
+            } else if (model == "spiral") {
+                settings.initial_model = InitialModel::eSpiral;
+            } else {
+                printf("error: unknown model '%s'\n", model.c_str());
+                exit(-1);
+            }
+        } else if (arg == "--seed") {
+            settings.seed = next_uint64();
+        } else if (arg == "--model-radius") {
+            settings.model_radius = next_float();
+            if (settings.model_radius <= 0.0f) {
+                printf("error: the model radius must be positive\n");
+                exit(-1);
+            }
+        } else if (arg == "--star-mass") {
+            settings.star_mass = next_float();
+            if (settings.star_mass <= 0.0f) {
+                printf("error: the star mass must be positive\n");
+                exit(-1);
+            }
+        } else if (arg == "--catalog") {
+            settings.catalog_path = next_value();
+        } else if (arg == "--frames-in-flight") {
+            settings.frames_in_flight = next_uint32();
+            if (settings.frames_in_flight == 0) {
+                printf("error: at least one frame in flight is needed\n");
+                exit(-1);
+            }
+        } else if (arg == "--solver") {
+            std::string solver = next_value();
+            if (solver == "direct") {
+                settings.solver = Solver::eDirect;
+            } else if (solver == "tiled") {
+                settings.solver = Solver::eTiled;
+            } else if (solver == "barnes-hut") {
+                settings.solver = Solver::eBarnesHut;
+            } else if (solver == "pm") {
+                settings.solver = Solver::eParticleMesh;
+            } else {
+                printf("error: unknown solver '%s'\n", solver.c_str());
+                exit(-1);
+            }
+        } else if (arg == "--opening-angle") {
+            settings.opening_angle = next_float();
+            if (!std::isfinite(settings.opening_angle) ||
+                settings.opening_angle <= 0.0f) {
+                printf("error: the opening angle must be positive\n");
+                exit(-1);
+            }
+        } else if (arg == "--tile-size") {
+            settings.tile_size = next_uint32();
+            if (settings.tile_size == 0 || settings.tile_size > 1024) {
+                printf("error: tile size must be between 1 and 1024\n");
+                exit(-1);
+            }
+        } else if (arg == "--pm-grid") {
+            settings.pm_grid_size = next_uint32();
+            if (settings.pm_grid_size < 16 || settings.pm_grid_size > 256 ||
+                (settings.pm_grid_size & (settings.pm_grid_size - 1)) != 0) {
+                printf("error: the particle-mesh grid size must be a power "
+                       "of two from 16 to 256\n");
+                exit(-1);
+            }
+        } else if (arg == "--timestep-levels") {
+            settings.timestep_levels = next_uint32();
+            if (settings.timestep_levels == 0 ||
+                settings.timestep_levels > 8) {
+                printf("error: the timestep levels must be between 1 and "
+                       "8\n");
+                exit(-1);
+            }
+        } else if (arg == "--timestep-accuracy") {
+            settings.timestep_accuracy = next_float();
+            if (settings.timestep_accuracy <= 0.0f) {
+                printf("error: the timestep accuracy must be positive\n");
+                exit(-1);
+            }
+        } else if (arg == "--renderer") {
+            std::string renderer = next_value();
+            if (renderer == "per-pixel") {
+                settings.renderer = Renderer::ePerPixel;
+            } else if (renderer == "binned") {
+                settings.renderer = Renderer::eBinned;
+            } else if (renderer == "sprites") {
+                settings.renderer = Renderer::eSprites;
+            } else {
+                printf("error: unknown renderer '%s'\n", renderer.c_str());
+                exit(-1);
+            }
+        } else if (arg == "--brightness-threshold") {
+            settings.brightness_threshold = next_float();
+            if (settings.brightness_threshold <= 0.0f) {
+                printf("error: brightness threshold must be positive\n");
+                exit(-1);
+            }
+        } else if (arg == "--bin-entries-per-star") {
+            settings.bin_entries_per_star = next_uint32();
+            if (settings.bin_entries_per_star == 0) {
+                printf("error: at least one bin entry per star is needed\n");
+                exit(-1);
+            }
+        } else if (arg == "--steps-per-second") {
+            settings.steps_per_second = next_uint32();
+        } else if (arg == "--max-substeps") {
+            settings.max_substeps = next_uint32();
+            if (settings.max_substeps == 0) {
+                printf("error: at least one substep is needed\n");
+                exit(-1);
+            }
+        } else if (arg == "--fast-forward") {
+            settings.fast_forward_steps = next_uint32();
+        } else if (arg == "--headless") {
+            settings.headless = true;
+        } else if (arg == "--frames") {
+            settings.frame_count = next_uint32();
+        } else if (arg == "--output") {
+            settings.output_path = next_value();
+        } else if (arg == "--output-format") {
+            std::string format = next_value();
+            if (format == "y4m") {
+                settings.output_format = OutputFormat::eY4m;
+            } else if (format == "raw") {
+                settings.output_format = OutputFormat::eRaw;
+            } else {
+                printf("error: unknown output format '%s'\n", format.c_str());
+                exit(-1);
+            }
+        } else if (arg == "--fps") {
+            settings.fps = next_uint32();
+            if (settings.fps == 0) {
+                printf("error: fps must be positive\n");
+                exit(-1);
+            }
+        } else if (arg == "--profile") {
+            settings.profile = true;
+        } else if (arg == "--profile-window") {
+            settings.profile_window = next_uint32();
+            if (settings.profile_window == 0) {
+                printf("error: the profile window needs at least one frame\n");
+                exit(-1);
+            }
+        } else if (arg == "--profile-json") {
+            settings.profile_json = next_value();
+            settings.profile = true;
+        } else if (arg == "--snapshot") {
+            settings.snapshot_prefix = next_value();
+        } else if (arg == "--snapshot-every") {
+            settings.snapshot_every = next_uint64();
+        } else if (arg == "--restore") {
+            settings.restore_path = next_value();
+        } else if (arg == "--trajectory") {
+            settings.trajectory_path = next_value();
+        } else if (arg == "--trajectory-every") {
+            settings.trajectory_every = next_uint64();
+            if (settings.trajectory_every == 0) {
+                printf("error: at least one step between trajectory frames "
+                       "is needed\n");
+                exit(-1);
+            }
+        } else if (arg == "--inspect-trajectory") {
+            settings.inspect_trajectory_path = next_value();
+        } else if (arg == "--diagnostics-every") {
+            settings.diagnostics_every = next_uint64();
+        } else if (arg == "--sort-every") {
+            settings.sort_every = next_uint64();
+        } else if (arg == "--cpu") {
+            settings.cpu = true;
+        } else if (arg == "--cpu-steps") {
+            settings.cpu_steps = next_uint64();
+        } else if (arg == "--cpu-kernel") {
+            std::string kernel = next_value();
+            if (kernel == "scalar") {
+                settings.cpu_kernel = CpuKernel::eScalar;
+            } else if (kernel == "avx2") {
+                settings.cpu_kernel = CpuKernel::eAvx2;
+            } else if (kernel == "avx512") {
+                settings.cpu_kernel = CpuKernel::eAvx512;
+            } else {
+                printf("error: unknown CPU kernel '%s'\n", kernel.c_str());
+                exit(-1);
+            }
+        } else if (arg == "--benchmark-staging") {
+            settings.benchmark_staging = true;
+        } else if (arg == "--check-sort") {
+            settings.check_sort = true;
+        } else if (arg == "--benchmark-sort") {
+            settings.benchmark_sort = true;
+        } else if (arg == "--check-cpu") {
+            settings.check_cpu = true;
+        } else {
+            printf("error: unknown option '%s'\n", arg.c_str());
+            print_usage(argv[0]);
+            exit(-1);
+        }
+    }
+
+    if (settings.timestep_levels > 1 && settings.solver != Solver::eDirect) {
+        printf("error: --timestep-levels needs the direct solver\n");
+        exit(-1);
+    }
+
+    if (settings.snapshot_every > 0 && settings.snapshot_prefix.empty()) {
+        settings.snapshot_prefix = "snapshot";
+    }
+
+    return settings;
+}
+}  // namespace galaxy